@@ -0,0 +1,70 @@
+{
+  "variables": {
+    "alljoyn_dist%": "/usr/local"
+  },
+  "targets": [
+    {
+      "target_name": "led_addon",
+      "sources": [ "led_addon.c" ],
+      "include_dirs": [ "<(alljoyn_dist)/include" ],
+      "defines": [ "QCC_OS_GROUP_POSIX", "NAPI_VERSION=6" ],
+      "libraries": [ "-L<(alljoyn_dist)/lib", "-lalljoyn_c" ]
+    },
+    {
+      "target_name": "led_service_memory",
+      "type": "executable",
+      "sources": [ "led_service.c" ],
+      "include_dirs": [ "<(alljoyn_dist)/include" ],
+      "defines": [ "QCC_OS_GROUP_POSIX", "LED_DEFAULT_BACKEND=\"memory\"" ],
+      "libraries": [ "-L<(alljoyn_dist)/lib", "-lalljoyn_c", "-lpthread" ]
+    },
+    {
+      "target_name": "led_soak",
+      "type": "executable",
+      "sources": [ "led_soak.c" ],
+      "include_dirs": [ "<(alljoyn_dist)/include" ],
+      "defines": [ "QCC_OS_GROUP_POSIX" ],
+      "libraries": [ "-L<(alljoyn_dist)/lib", "-lalljoyn_c", "-lpthread" ]
+    },
+    {
+      "target_name": "led_bench",
+      "type": "executable",
+      "sources": [ "led_bench.c" ],
+      "include_dirs": [ "<(alljoyn_dist)/include" ],
+      "defines": [ "QCC_OS_GROUP_POSIX" ],
+      "libraries": [ "-L<(alljoyn_dist)/lib", "-lalljoyn_c", "-lpthread" ]
+    },
+    {
+      "target_name": "led_replay",
+      "type": "executable",
+      "sources": [ "led_replay.c" ],
+      "include_dirs": [ "<(alljoyn_dist)/include" ],
+      "defines": [ "QCC_OS_GROUP_POSIX" ],
+      "libraries": [ "-L<(alljoyn_dist)/lib", "-lalljoyn_c", "-lpthread" ]
+    },
+    {
+      "target_name": "ledctl",
+      "type": "static_library",
+      "sources": [ "ledctl/ledctl.cpp" ],
+      "include_dirs": [ "<(alljoyn_dist)/include", "." ],
+      "defines": [ "QCC_OS_GROUP_POSIX" ],
+      "cflags_cc": [ "-std=c++20" ],
+      "cflags_cc!": [ "-fno-exceptions" ],
+      "direct_dependent_settings": {
+        "include_dirs": [ "<(alljoyn_dist)/include", ".", "ledctl" ],
+        "defines": [ "QCC_OS_GROUP_POSIX" ]
+      },
+      "link_settings": {
+        "libraries": [ "-L<(alljoyn_dist)/lib", "-lalljoyn_c", "-lpthread" ]
+      }
+    },
+    {
+      "target_name": "ledctl_bench",
+      "type": "executable",
+      "sources": [ "ledctl/ledctl_bench.cpp" ],
+      "dependencies": [ "ledctl" ],
+      "cflags_cc": [ "-std=c++20" ],
+      "cflags_cc!": [ "-fno-exceptions" ]
+    }
+  ]
+}
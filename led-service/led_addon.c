@@ -0,0 +1,463 @@
+/**
+ * @file
+ * @brief In-process Node.js binding for the AllJoyn LED service.
+ *
+ * ledpoker.js used to exec led_client for every command.  This addon keeps
+ * one bus attachment, session and proxy object per process instead and
+ * exposes promise-returning flash/on/off/status.  Calls are issued with
+ * alljoyn_proxybusobject_methodcall_async; their replies arrive on an
+ * AllJoyn thread and are handed to the event loop through a thread-safe
+ * function, so the loop never blocks on the bus.
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include <qcc/platform.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <node_api.h>
+
+#include <alljoyn_c/BusAttachment.h>
+#include <alljoyn_c/BusObject.h>
+#include <alljoyn_c/MsgArg.h>
+#include <alljoyn_c/InterfaceDescription.h>
+#include <alljoyn_c/Status.h>
+
+#include "led_interface.h"
+
+/* One method call; owned by whichever thread currently holds it */
+typedef struct LedCall {
+    struct LedCall *next;
+    napi_deferred deferred;
+    const char *cmd;
+    double brightness;
+    uint32_t frequency;
+    QStatus status;
+    double replyBrightness;
+    uint32_t replyFrequency;
+} LedCall;
+
+enum {
+    LED_IDLE,
+    LED_CONNECTING,
+    LED_CONNECTED,
+    LED_FAILED
+};
+
+/*
+ * Connection state shared by the JS thread, the connect worker and AllJoyn's
+ * callback threads.  lock protects state, proxy, pending and sent; connectWork,
+ * closing and outstanding are only touched on the JS thread.
+ */
+static struct {
+    pthread_mutex_t lock;
+    int state;
+    QStatus error;
+    QCC_BOOL joining;
+    alljoyn_busattachment bus;
+    alljoyn_buslistener listener;
+    alljoyn_proxybusobject proxy;
+    alljoyn_sessionid sessionId;
+    LedCall *pending;
+    LedCall *sent;
+    napi_threadsafe_function completions;
+    napi_async_work connectWork;
+    QCC_BOOL closing;
+    size_t outstanding;
+} s_led = { PTHREAD_MUTEX_INITIALIZER, LED_IDLE };
+
+/* Hands a finished call back to the event loop; callable from any thread */
+static void completeCall(LedCall *call, QStatus status)
+{
+    call->status = status;
+    napi_call_threadsafe_function(s_led.completions, call, napi_tsfn_blocking);
+}
+
+static void failCalls(LedCall *calls, QStatus status)
+{
+    while (calls) {
+        LedCall *next = calls->next;
+        completeCall(calls, status);
+        calls = next;
+    }
+}
+
+/* Unlinks a call from the sent list once its reply (or send failure) is in */
+static void unlinkSent(LedCall *call)
+{
+    LedCall **link;
+    pthread_mutex_lock(&s_led.lock);
+    for (link = &s_led.sent; *link; link = &(*link)->next) {
+        if (*link == call) {
+            *link = call->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_led.lock);
+}
+
+/* ReplyHandler callback, runs on an AllJoyn thread */
+static void method_reply(alljoyn_message reply, void *context)
+{
+    LedCall *call = (LedCall *)context;
+    QStatus status = ER_BUS_REPLY_IS_ERROR_MESSAGE;
+    unlinkSent(call);
+    if (alljoyn_message_gettype(reply) == ALLJOYN_MESSAGE_METHOD_RET) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 0), "d", &call->replyBrightness);
+        if (ER_OK == status) {
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 1), "u", &call->replyFrequency);
+        }
+    }
+    completeCall(call, status);
+}
+
+/* Same calls as doFlash/doOn/doOff/doStatus in led_client.c, made asynchronous */
+static void sendCall(LedCall *call)
+{
+    QStatus status;
+    alljoyn_msgarg inputs = NULL;
+    size_t numArgs = 0;
+    if (strcmp(call->cmd, "flash") == 0) {
+        numArgs = 2;
+        inputs = alljoyn_msgarg_array_create(numArgs);
+        status = alljoyn_msgarg_array_set(inputs, &numArgs, "du", call->brightness, call->frequency);
+    } else if (strcmp(call->cmd, "on") == 0) {
+        numArgs = 1;
+        inputs = alljoyn_msgarg_array_create(numArgs);
+        status = alljoyn_msgarg_array_set(inputs, &numArgs, "d", call->brightness);
+    } else {
+        status = ER_OK;
+    }
+    if (ER_OK == status) {
+        /* linked before the call goes out, the reply may beat methodcall_async back */
+        pthread_mutex_lock(&s_led.lock);
+        call->next = s_led.sent;
+        s_led.sent = call;
+        pthread_mutex_unlock(&s_led.lock);
+        status = alljoyn_proxybusobject_methodcall_async(s_led.proxy, INTERFACE_NAME, call->cmd, method_reply, inputs, numArgs, call, 5000, 0);
+        if (ER_OK != status) {
+            unlinkSent(call);
+        }
+    }
+    if (inputs) {
+        alljoyn_msgarg_destroy(inputs);
+    }
+    if (ER_OK != status) {
+        completeCall(call, status);
+    }
+}
+
+/* JoinSession callback, runs on an AllJoyn thread */
+static void session_joined(QStatus status, alljoyn_sessionid sessionId, const alljoyn_sessionopts opts, void *context)
+{
+    LedCall *pending = NULL;
+    LedCall *ordered = NULL;
+
+    pthread_mutex_lock(&s_led.lock);
+    s_led.joining = QCC_FALSE;
+    if (ER_OK == status) {
+        s_led.sessionId = sessionId;
+        s_led.proxy = alljoyn_proxybusobject_create(s_led.bus, OBJECT_NAME, OBJECT_PATH, sessionId);
+        alljoyn_proxybusobject_addinterface(s_led.proxy, alljoyn_busattachment_getinterface(s_led.bus, INTERFACE_NAME));
+        s_led.state = LED_CONNECTED;
+    } else {
+        s_led.state = LED_FAILED;
+        s_led.error = status;
+    }
+    pending = s_led.pending;
+    s_led.pending = NULL;
+    pthread_mutex_unlock(&s_led.lock);
+
+    if (ER_OK != status) {
+        failCalls(pending, status);
+        return;
+    }
+    /* pending is newest first, send in the order the calls were made */
+    while (pending) {
+        LedCall *next = pending->next;
+        pending->next = ordered;
+        ordered = pending;
+        pending = next;
+    }
+    while (ordered) {
+        LedCall *next = ordered->next;
+        sendCall(ordered);
+        ordered = next;
+    }
+}
+
+/* FoundAdvertisedName callback */
+static void found_advertised_name(const void *context, const char *name, alljoyn_transportmask transport, const char *namePrefix)
+{
+    QCC_BOOL join = QCC_FALSE;
+    if (0 != strcmp(name, OBJECT_NAME)) {
+        return;
+    }
+    pthread_mutex_lock(&s_led.lock);
+    if (s_led.state == LED_CONNECTING && !s_led.joining) {
+        s_led.joining = join = QCC_TRUE;
+    }
+    pthread_mutex_unlock(&s_led.lock);
+    if (join) {
+        alljoyn_sessionopts opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+        QStatus status = alljoyn_busattachment_joinsessionasync(s_led.bus, name, SERVICE_PORT, NULL, opts, session_joined, NULL);
+        alljoyn_sessionopts_destroy(opts);
+        if (ER_OK != status) {
+            session_joined(status, 0, NULL, NULL);
+        }
+    }
+}
+
+/* Worker thread: attach to the bus and start discovery; the join finishes in session_joined */
+static void connect_execute(napi_env env, void *data)
+{
+    alljoyn_buslistener_callbacks callbacks = {
+        NULL,
+        NULL,
+        &found_advertised_name,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+    };
+    QStatus status;
+
+    s_led.bus = alljoyn_busattachment_create("ledAddon", QCC_TRUE);
+    status = createLedInterface(s_led.bus);
+    if (ER_OK == status) {
+        status = alljoyn_busattachment_start(s_led.bus);
+    }
+    if (ER_OK == status) {
+        status = alljoyn_busattachment_connect(s_led.bus, "unix:abstract=alljoyn");
+    }
+    if (ER_OK == status) {
+        s_led.listener = alljoyn_buslistener_create(&callbacks, NULL);
+        alljoyn_busattachment_registerbuslistener(s_led.bus, s_led.listener);
+        status = alljoyn_busattachment_findadvertisedname(s_led.bus, OBJECT_NAME);
+    }
+    s_led.error = status;
+}
+
+static void closeConnection(void);
+
+static void connect_complete(napi_env env, napi_status napiStatus, void *data)
+{
+    LedCall *pending = NULL;
+    napi_delete_async_work(env, s_led.connectWork);
+    s_led.connectWork = NULL;
+    if (s_led.closing) {
+        /* close() came in while the worker was still attaching */
+        s_led.closing = QCC_FALSE;
+        closeConnection();
+        return;
+    }
+    if (ER_OK == s_led.error) {
+        return;
+    }
+    pthread_mutex_lock(&s_led.lock);
+    s_led.state = LED_FAILED;
+    pending = s_led.pending;
+    s_led.pending = NULL;
+    pthread_mutex_unlock(&s_led.lock);
+    failCalls(pending, s_led.error);
+}
+
+/* Thread-safe function body: settles the call's promise on the JS thread */
+static void call_js(napi_env env, napi_value jsCallback, void *context, void *data)
+{
+    LedCall *call = (LedCall *)data;
+    if (env != NULL) {
+        napi_value result;
+        if (ER_OK == call->status) {
+            napi_value value;
+            napi_create_object(env, &result);
+            napi_create_string_utf8(env, call->cmd, NAPI_AUTO_LENGTH, &value);
+            napi_set_named_property(env, result, "cmd", value);
+            napi_create_double(env, call->replyBrightness, &value);
+            napi_set_named_property(env, result, "brightness", value);
+            napi_create_uint32(env, call->replyFrequency, &value);
+            napi_set_named_property(env, result, "frequency", value);
+            napi_resolve_deferred(env, call->deferred, result);
+        } else {
+            napi_value message;
+            napi_create_string_utf8(env, QCC_StatusText(call->status), NAPI_AUTO_LENGTH, &message);
+            napi_create_error(env, NULL, message, &result);
+            napi_reject_deferred(env, call->deferred, result);
+        }
+        /* let the process exit once nothing is in flight */
+        if (--s_led.outstanding == 0) {
+            napi_unref_threadsafe_function(env, s_led.completions);
+        }
+    }
+    free(call);
+}
+
+/* Starts a call from JS; connects first if this is the first call of the process */
+static napi_value startCall(napi_env env, const char *cmd, double brightness, uint32_t frequency)
+{
+    napi_value promise;
+    LedCall *call = (LedCall *)calloc(1, sizeof(LedCall));
+    int state;
+
+    if (!call) {
+        napi_throw_error(env, NULL, "out of memory");
+        return NULL;
+    }
+    call->cmd = cmd;
+    call->brightness = brightness;
+    call->frequency = frequency;
+    napi_create_promise(env, &call->deferred, &promise);
+    if (s_led.outstanding++ == 0) {
+        napi_ref_threadsafe_function(env, s_led.completions);
+    }
+
+    pthread_mutex_lock(&s_led.lock);
+    state = s_led.state;
+    if (state == LED_IDLE || state == LED_CONNECTING) {
+        call->next = s_led.pending;
+        s_led.pending = call;
+        s_led.state = LED_CONNECTING;
+    }
+    pthread_mutex_unlock(&s_led.lock);
+
+    if (state == LED_IDLE) {
+        napi_value name;
+        napi_create_string_utf8(env, "ledConnect", NAPI_AUTO_LENGTH, &name);
+        napi_create_async_work(env, NULL, name, connect_execute, connect_complete, NULL, &s_led.connectWork);
+        napi_queue_async_work(env, s_led.connectWork);
+    } else if (state == LED_CONNECTED) {
+        sendCall(call);
+    } else if (state == LED_FAILED) {
+        completeCall(call, s_led.error);
+    }
+    return promise;
+}
+
+static napi_value flash(napi_env env, napi_callback_info info)
+{
+    size_t argc = 2;
+    napi_value argv[2];
+    double brightness = 0.0;
+    uint32_t frequency = 0;
+    napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+    if (argc < 2 || napi_get_value_double(env, argv[0], &brightness) != napi_ok || napi_get_value_uint32(env, argv[1], &frequency) != napi_ok) {
+        napi_throw_type_error(env, NULL, "flash(brightness, frequency) expects two numbers");
+        return NULL;
+    }
+    return startCall(env, "flash", brightness, frequency);
+}
+
+static napi_value on(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1];
+    double brightness = 0.0;
+    napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+    if (argc < 1 || napi_get_value_double(env, argv[0], &brightness) != napi_ok) {
+        napi_throw_type_error(env, NULL, "on(brightness) expects a number");
+        return NULL;
+    }
+    return startCall(env, "on", brightness, 0);
+}
+
+static napi_value off(napi_env env, napi_callback_info info)
+{
+    return startCall(env, "off", 0.0, 0);
+}
+
+static napi_value status(napi_env env, napi_callback_info info)
+{
+    return startCall(env, "status", 0.0, 0);
+}
+
+/*
+ * Tears the connection down on the JS thread.  The bus is stopped and joined
+ * first so no AllJoyn callback is still running; every call still queued or
+ * awaiting a reply is then failed before the proxy goes away.
+ */
+static void closeConnection(void)
+{
+    LedCall *pending;
+    LedCall *sent;
+
+    if (s_led.bus) {
+        alljoyn_busattachment_stop(s_led.bus);
+        alljoyn_busattachment_join(s_led.bus);
+    }
+
+    pthread_mutex_lock(&s_led.lock);
+    pending = s_led.pending;
+    s_led.pending = NULL;
+    sent = s_led.sent;
+    s_led.sent = NULL;
+    s_led.joining = QCC_FALSE;
+    s_led.state = LED_IDLE;
+    pthread_mutex_unlock(&s_led.lock);
+    failCalls(pending, ER_BUS_STOPPING);
+    failCalls(sent, ER_BUS_STOPPING);
+
+    if (s_led.proxy) {
+        alljoyn_proxybusobject_destroy(s_led.proxy);
+        s_led.proxy = NULL;
+    }
+    if (s_led.bus) {
+        alljoyn_busattachment_destroy(s_led.bus);
+        s_led.bus = NULL;
+    }
+    if (s_led.listener) {
+        alljoyn_buslistener_destroy(s_led.listener);
+        s_led.listener = NULL;
+    }
+}
+
+/*
+ * Leaves the session and releases the bus; the next call reconnects.  While
+ * the connect worker is running the close is deferred to connect_complete.
+ */
+static napi_value closeBus(napi_env env, napi_callback_info info)
+{
+    if (s_led.connectWork) {
+        s_led.closing = QCC_TRUE;
+    } else {
+        closeConnection();
+    }
+    return NULL;
+}
+
+static napi_value Init(napi_env env, napi_value exports)
+{
+    napi_property_descriptor methods[] = {
+        { "flash", NULL, flash, NULL, NULL, NULL, napi_default, NULL },
+        { "on", NULL, on, NULL, NULL, NULL, napi_default, NULL },
+        { "off", NULL, off, NULL, NULL, NULL, napi_default, NULL },
+        { "status", NULL, status, NULL, NULL, NULL, napi_default, NULL },
+        { "close", NULL, closeBus, NULL, NULL, NULL, napi_default, NULL },
+    };
+    napi_value name;
+    napi_create_string_utf8(env, "ledCompletions", NAPI_AUTO_LENGTH, &name);
+    napi_create_threadsafe_function(env, NULL, NULL, name, 0, 1, NULL, NULL, NULL, call_js, &s_led.completions);
+    /* only held while calls are outstanding */
+    napi_unref_threadsafe_function(env, s_led.completions);
+    napi_define_properties(env, exports, sizeof(methods) / sizeof(methods[0]), methods);
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, Init)
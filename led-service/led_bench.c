@@ -0,0 +1,1023 @@
+/**
+ * @file
+ * @brief Load generator and latency benchmark for led_service.
+ *
+ * Builds a fake sysfs LED tree in a temporary directory, starts led_service
+ * against it under a private well-known name, then drives it from N client
+ * bus attachments over the local router.  Each client talks to its own LED
+ * object so the per-LED locks in the service do not serialize the run.
+ *
+ * Closed loop (the default) keeps one blocking call outstanding per client.
+ * Open loop (--rate) sends at fixed intervals regardless of completions, and
+ * measures latency from the intended send time so a stalled service shows up
+ * in the tail instead of silently lowering the offered load.
+ *
+ * Jitter mode (--jitter) instead drives one LED through the same on/off step
+ * sequence twice: first with a client call per step, then as one server-side
+ * pattern call.  An inotify watch on the fake brightness file timestamps each
+ * edge, and the report compares how far the edge intervals stray from the
+ * step length in the two runs.
+ *
+ * With --local the clients call the service over its --local-socket instead
+ * of the bus; run the same load with and without it to see what the AllJoyn
+ * router costs per call.
+ *
+ * The result is a single JSON object on stdout; progress goes to stderr.
+ *
+ * Build: gcc -o led_bench led_bench.c -lalljoyn_c -lpthread
+ * Run:   ./led_bench --service ./led_service --clients 8 --duration 10 --mix 1:1:1:7
+ *        ./led_bench --service ./led_service --jitter 40 --step-ms 50
+ *        ./led_bench --service ./led_service --clients 8 --duration 10 --local
+ *        npm run bench    (after npm install, against the led_service_memory target)
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* mkdtemp, clock_nanosleep */
+#endif
+
+#include <qcc/platform.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <alljoyn_c/DBusStdDefines.h>
+#include <alljoyn_c/BusAttachment.h>
+#include <alljoyn_c/BusObject.h>
+#include <alljoyn_c/MsgArg.h>
+#include <alljoyn_c/InterfaceDescription.h>
+#include <alljoyn_c/Status.h>
+
+#include "led_interface.h"
+#include "led_local.h"
+
+typedef enum {
+    BENCH_FLASH,
+    BENCH_ON,
+    BENCH_OFF,
+    BENCH_STATUS,
+    BENCH_METHOD_COUNT
+} BenchMethod;
+
+static const char *BENCH_METHOD_NAMES[BENCH_METHOD_COUNT] = { "flash", "on", "off", "status" };
+
+/*
+ * Files every fake LED directory gets, with their initial contents.  Only
+ * none and timer are offered so patterns run on the service's step engine,
+ * which is the one jitter mode measures.
+ */
+static const char *FAKE_LED_FILES[][2] = {
+    { "trigger", "[none] timer\n" },
+    { "brightness", "0\n" },
+    { "max_brightness", "255\n" },
+    { "delay_on", "500\n" },
+    { "delay_off", "500\n" },
+};
+
+/* Settings from the command line */
+static const char *s_servicePath = "./led_service";
+static int s_clientCount = 4;
+static int s_ledCount = 4;
+static double s_durationSec = 10.0;
+static double s_warmupSec = 1.0;
+static double s_rate = 0.0;
+static unsigned s_weights[BENCH_METHOD_COUNT] = { 1, 1, 1, 7 };
+static uint32_t s_timeoutMs = 5000;
+static const char *s_backend = NULL;
+static const char *s_latency = NULL;
+static int s_jitterSteps = 0;
+static uint32_t s_stepMs = 50;
+static int s_local = 0;
+
+static char s_serviceName[256];
+static char s_root[PATH_MAX];
+static char s_localPath[PATH_MAX];
+static pid_t s_servicePid = -1;
+
+/* Start of the run and the window in which sent calls are counted, CLOCK_MONOTONIC ns */
+static uint64_t s_runStart;
+static uint64_t s_measureStart;
+static uint64_t s_measureEnd;
+
+static volatile sig_atomic_t g_interrupt = QCC_FALSE;
+
+/* Latencies in microseconds for calls sent inside the measurement window */
+typedef struct {
+    uint32_t *samples;
+    size_t count;
+    size_t capacity;
+} LatencyLog;
+
+typedef struct {
+    int index;
+    alljoyn_busattachment bus;
+    alljoyn_buslistener listener;
+    alljoyn_proxybusobject proxy;
+    alljoyn_sessionid sessionId;
+    int localFd;
+    uint32_t localSeq;
+    int found;
+    alljoyn_msgarg args[BENCH_METHOD_COUNT];
+    size_t numArgs[BENCH_METHOD_COUNT];
+    pthread_t thread;
+    unsigned seed;
+
+    /* open loop replies arrive on AllJoyn threads, so these are guarded by lock */
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    LatencyLog log;
+    uint64_t calls[BENCH_METHOD_COUNT];
+    uint64_t errors;
+    uint64_t outstanding;
+} BenchClient;
+
+/* Context for one open loop call */
+typedef struct {
+    BenchClient *client;
+    BenchMethod method;
+    uint64_t intended;
+} PendingCall;
+
+static pthread_mutex_t s_foundLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_foundCond = PTHREAD_COND_INITIALIZER;
+static int s_foundCount = 0;
+
+static void SigIntHandler(int sig)
+{
+    g_interrupt = QCC_TRUE;
+}
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleepUntil(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_interrupt) {
+    }
+}
+
+static void logLatency(LatencyLog *log, uint64_t ns)
+{
+    if (log->count == log->capacity) {
+        size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+        uint32_t *samples = realloc(log->samples, capacity * sizeof(uint32_t));
+        if (!samples) {
+            return;
+        }
+        log->samples = samples;
+        log->capacity = capacity;
+    }
+    log->samples[log->count++] = ns / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(ns / 1000);
+}
+
+/* Records a finished call; caller holds client->lock in open loop mode */
+static void recordCall(BenchClient *client, BenchMethod method, uint64_t sent, uint64_t done, int ok)
+{
+    if (sent < s_measureStart || sent >= s_measureEnd) {
+        return;
+    }
+    client->calls[method]++;
+    if (ok) {
+        logLatency(&client->log, done - sent);
+    } else {
+        client->errors++;
+    }
+}
+
+static BenchMethod pickMethod(BenchClient *client)
+{
+    unsigned total = 0, roll;
+    int m;
+    for (m = 0; m < BENCH_METHOD_COUNT; m++) {
+        total += s_weights[m];
+    }
+    roll = rand_r(&client->seed) % total;
+    for (m = 0; m < BENCH_METHOD_COUNT - 1; m++) {
+        if (roll < s_weights[m]) {
+            break;
+        }
+        roll -= s_weights[m];
+    }
+    return (BenchMethod)m;
+}
+
+/****** FAKE SYSFS ******/
+
+static int writeFile(const char *path, const char *contents)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs(contents, fp);
+    return fclose(fp);
+}
+
+static int createFakeTree(void)
+{
+    char dir[PATH_MAX], file[PATH_MAX];
+    int l;
+    size_t f;
+
+    snprintf(s_root, sizeof(s_root), "%s/led_bench.XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(s_root)) {
+        fprintf(stderr, "mkdtemp(%s): %s\n", s_root, strerror(errno));
+        return -1;
+    }
+    for (l = 0; l < s_ledCount; l++) {
+        if (snprintf(dir, sizeof(dir), "%s/bench:green:usr%d", s_root, l) >= (int)sizeof(dir)) {
+            fprintf(stderr, "%s: path too long\n", s_root);
+            return -1;
+        }
+        if (mkdir(dir, 0755) != 0) {
+            return -1;
+        }
+        for (f = 0; f < sizeof(FAKE_LED_FILES) / sizeof(FAKE_LED_FILES[0]); f++) {
+            if (snprintf(file, sizeof(file), "%s/%s", dir, FAKE_LED_FILES[f][0]) >= (int)sizeof(file)) {
+                fprintf(stderr, "%s: path too long\n", dir);
+                return -1;
+            }
+            if (writeFile(file, FAKE_LED_FILES[f][1]) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void removeFakeTree(void)
+{
+    char dir[PATH_MAX], file[PATH_MAX];
+    int l;
+    size_t f;
+
+    if (!s_root[0]) {
+        return;
+    }
+    for (l = 0; l < s_ledCount; l++) {
+        /* createFakeTree made nothing it could not name */
+        if (snprintf(dir, sizeof(dir), "%s/bench:green:usr%d", s_root, l) >= (int)sizeof(dir)) {
+            break;
+        }
+        for (f = 0; f < sizeof(FAKE_LED_FILES) / sizeof(FAKE_LED_FILES[0]); f++) {
+            if (snprintf(file, sizeof(file), "%s/%s", dir, FAKE_LED_FILES[f][0]) < (int)sizeof(file)) {
+                unlink(file);
+            }
+        }
+        rmdir(dir);
+    }
+    rmdir(s_root);
+}
+
+/****** SERVICE PROCESS ******/
+
+static int startService(void)
+{
+    s_servicePid = fork();
+    if (s_servicePid < 0) {
+        fprintf(stderr, "fork: %s\n", strerror(errno));
+        return -1;
+    }
+    if (s_servicePid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+        char leds[16];
+        const char *args[16];
+        int n = 0;
+        args[n++] = s_servicePath;
+        if (s_backend && strcmp(s_backend, "memory") == 0) {
+            /* the service makes its own LEDs; usr<i> maps to the same object paths */
+            snprintf(leds, sizeof(leds), "%d", s_ledCount);
+            args[n++] = "--backend";
+            args[n++] = "memory";
+            args[n++] = "--leds";
+            args[n++] = leds;
+            args[n++] = "--latency-us";
+            args[n++] = s_latency ? s_latency : "0";
+        } else {
+            args[n++] = "--led-root";
+            args[n++] = s_root;
+            args[n++] = "--default-led";
+            args[n++] = "bench:green:usr0";
+        }
+        args[n++] = "--name";
+        args[n++] = s_serviceName;
+        if (s_local) {
+            args[n++] = "--local-socket";
+            args[n++] = s_localPath;
+        }
+        args[n] = NULL;
+        execv(s_servicePath, (char * const *)args);
+        fprintf(stderr, "exec %s: %s\n", s_servicePath, strerror(errno));
+        _exit(127);
+    }
+    return 0;
+}
+
+static int serviceExited(void)
+{
+    return s_servicePid > 0 && waitpid(s_servicePid, NULL, WNOHANG) == s_servicePid;
+}
+
+static void stopService(void)
+{
+    int i;
+    if (s_servicePid <= 0) {
+        return;
+    }
+    kill(s_servicePid, SIGINT);
+    for (i = 0; i < 50; i++) {
+        if (waitpid(s_servicePid, NULL, WNOHANG) == s_servicePid) {
+            s_servicePid = -1;
+            return;
+        }
+        usleep(100 * 1000);
+    }
+    kill(s_servicePid, SIGKILL);
+    waitpid(s_servicePid, NULL, 0);
+    s_servicePid = -1;
+}
+
+/****** CLIENTS ******/
+
+/* FoundAdvertisedName callback */
+static void found_advertised_name(const void* context, const char* name, alljoyn_transportmask transport, const char* namePrefix)
+{
+    BenchClient *client = (BenchClient *)context;
+    if (strcmp(name, s_serviceName) == 0) {
+        pthread_mutex_lock(&s_foundLock);
+        if (!client->found) {
+            client->found = 1;
+            s_foundCount++;
+            pthread_cond_broadcast(&s_foundCond);
+        }
+        pthread_mutex_unlock(&s_foundLock);
+    }
+}
+
+static QStatus clientCreate(BenchClient *client, int index)
+{
+    alljoyn_buslistener_callbacks callbacks = {
+        NULL,
+        NULL,
+        &found_advertised_name,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+    };
+    QStatus status;
+
+    memset(client, 0, sizeof(*client));
+    client->index = index;
+    client->seed = 0x5eed + index;
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->idle, NULL);
+
+    client->numArgs[BENCH_FLASH] = 2;
+    client->args[BENCH_FLASH] = alljoyn_msgarg_array_create(2);
+    alljoyn_msgarg_array_set(client->args[BENCH_FLASH], &client->numArgs[BENCH_FLASH], "du", 1.0, 200);
+    client->numArgs[BENCH_ON] = 1;
+    client->args[BENCH_ON] = alljoyn_msgarg_array_create(1);
+    alljoyn_msgarg_array_set(client->args[BENCH_ON], &client->numArgs[BENCH_ON], "d", 1.0);
+
+    client->localFd = -1;
+    if (s_local) {
+        /* nothing to discover; clientJoin connects once the service is up */
+        client->found = 1;
+        s_foundCount++;
+        return ER_OK;
+    }
+
+    client->bus = alljoyn_busattachment_create("ledBench", QCC_TRUE);
+    status = createLedInterface(client->bus);
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_start(client->bus);
+    }
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_connect(client->bus, "unix:abstract=alljoyn");
+    }
+    if (status == ER_OK) {
+        client->listener = alljoyn_buslistener_create(&callbacks, client);
+        alljoyn_busattachment_registerbuslistener(client->bus, client->listener);
+        status = alljoyn_busattachment_findadvertisedname(client->bus, s_serviceName);
+    }
+    return status;
+}
+
+/* Connects to the service's local socket, giving it up to 10 s to create it */
+static QStatus clientConnectLocal(BenchClient *client)
+{
+    int i;
+    for (i = 0; i < 100 && !g_interrupt && !serviceExited(); i++) {
+        client->localFd = ledLocalConnect(s_localPath);
+        if (client->localFd >= 0) {
+            return ER_OK;
+        }
+        usleep(100 * 1000);
+    }
+    return ER_BUS_NOT_CONNECTED;
+}
+
+static QStatus clientJoin(BenchClient *client)
+{
+    char path[64];
+    alljoyn_sessionopts opts;
+    QStatus status;
+    if (s_local) {
+        return clientConnectLocal(client);
+    }
+    opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+    status = alljoyn_busattachment_joinsession(client->bus, s_serviceName, SERVICE_PORT, NULL, &client->sessionId, opts);
+    alljoyn_sessionopts_destroy(opts);
+    if (status != ER_OK) {
+        client->sessionId = 0;
+        return status;
+    }
+    /* spread clients across the LEDs so they do not all contend for one device */
+    snprintf(path, sizeof(path), "%s/usr%d", OBJECT_PATH, client->index % s_ledCount);
+    client->proxy = alljoyn_proxybusobject_create(client->bus, s_serviceName, path, client->sessionId);
+    return alljoyn_proxybusobject_addinterface(client->proxy, alljoyn_busattachment_getinterface(client->bus, INTERFACE_NAME));
+}
+
+static void clientDestroy(BenchClient *client)
+{
+    int m;
+    if (client->localFd >= 0) {
+        close(client->localFd);
+    }
+    if (client->proxy) {
+        alljoyn_proxybusobject_destroy(client->proxy);
+    }
+    if (client->bus) {
+        if (client->sessionId) {
+            alljoyn_busattachment_leavesession(client->bus, client->sessionId);
+        }
+        alljoyn_busattachment_stop(client->bus);
+        alljoyn_busattachment_join(client->bus);
+        alljoyn_busattachment_destroy(client->bus);
+    }
+    if (client->listener) {
+        alljoyn_buslistener_destroy(client->listener);
+    }
+    for (m = 0; m < BENCH_METHOD_COUNT; m++) {
+        if (client->args[m]) {
+            alljoyn_msgarg_destroy(client->args[m]);
+        }
+    }
+    free(client->log.samples);
+    pthread_cond_destroy(&client->idle);
+    pthread_mutex_destroy(&client->lock);
+}
+
+/* One call over the local socket, to the same LED the bus client would use */
+static int localCall(BenchClient *client, BenchMethod method)
+{
+    /* BenchMethod and LedLocalMethod list flash, on, off and status in the same order */
+    LedLocalRequest request;
+    LedLocalReply reply;
+    memset(&request, 0, sizeof(request));
+    request.seq = ++client->localSeq;
+    request.method = (uint32_t)method;
+    request.brightness = 1.0;
+    request.frequency = method == BENCH_FLASH ? 200 : 0;
+    snprintf(request.led, sizeof(request.led), "usr%d", client->index % s_ledCount);
+    return ledLocalCall(client->localFd, &request, &reply, s_timeoutMs) == ER_OK && reply.status == ER_OK;
+}
+
+/* One blocking call at a time until the window closes */
+static void *closedLoopThread(void *arg)
+{
+    BenchClient *client = (BenchClient *)arg;
+    while (!g_interrupt && nowNs() < s_measureEnd) {
+        BenchMethod method = pickMethod(client);
+        if (s_local) {
+            uint64_t sent = nowNs();
+            int ok = localCall(client, method);
+            recordCall(client, method, sent, nowNs(), ok);
+            continue;
+        }
+        alljoyn_message reply = alljoyn_message_create(client->bus);
+        uint64_t sent = nowNs();
+        QStatus status = alljoyn_proxybusobject_methodcall(client->proxy, INTERFACE_NAME, BENCH_METHOD_NAMES[method],
+                                                           client->args[method], client->numArgs[method], reply, s_timeoutMs, 0);
+        recordCall(client, method, sent, nowNs(), status == ER_OK);
+        alljoyn_message_destroy(reply);
+    }
+    return NULL;
+}
+
+/* ReplyHandler callback for open loop calls */
+static void open_loop_reply(alljoyn_message message, void* context)
+{
+    PendingCall *call = (PendingCall *)context;
+    BenchClient *client = call->client;
+    uint64_t done = nowNs();
+
+    pthread_mutex_lock(&client->lock);
+    recordCall(client, call->method, call->intended, done, alljoyn_message_gettype(message) == ALLJOYN_MESSAGE_METHOD_RET);
+    if (--client->outstanding == 0) {
+        pthread_cond_signal(&client->idle);
+    }
+    pthread_mutex_unlock(&client->lock);
+    free(call);
+}
+
+/* Sends on a fixed schedule of s_rate / clients calls per second, independent of replies */
+static void *openLoopThread(void *arg)
+{
+    BenchClient *client = (BenchClient *)arg;
+    uint64_t interval = (uint64_t)(1e9 * s_clientCount / s_rate);
+    /* stagger the clients so their sends do not line up */
+    uint64_t intended = s_runStart + interval * client->index / s_clientCount;
+
+    while (!g_interrupt && intended < s_measureEnd) {
+        PendingCall *call;
+        QStatus status;
+
+        sleepUntil(intended);
+        call = malloc(sizeof(*call));
+        if (!call) {
+            break;
+        }
+        call->client = client;
+        call->method = pickMethod(client);
+        call->intended = intended;
+
+        pthread_mutex_lock(&client->lock);
+        client->outstanding++;
+        pthread_mutex_unlock(&client->lock);
+        status = alljoyn_proxybusobject_methodcall_async(client->proxy, INTERFACE_NAME, BENCH_METHOD_NAMES[call->method], &open_loop_reply,
+                                                         client->args[call->method], client->numArgs[call->method], call, s_timeoutMs, 0);
+        if (status != ER_OK) {
+            pthread_mutex_lock(&client->lock);
+            client->outstanding--;
+            recordCall(client, call->method, intended, nowNs(), 0);
+            pthread_mutex_unlock(&client->lock);
+            free(call);
+        }
+        intended += interval;
+    }
+
+    /* every reply, or its timeout, has to arrive before the client can be torn down */
+    pthread_mutex_lock(&client->lock);
+    while (client->outstanding > 0) {
+        pthread_cond_wait(&client->idle, &client->lock);
+    }
+    pthread_mutex_unlock(&client->lock);
+    return NULL;
+}
+
+/****** REPORT ******/
+
+static int compareU32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of a sorted sample set */
+static uint32_t percentile(const uint32_t *sorted, size_t count, double p)
+{
+    size_t rank;
+    if (count == 0) {
+        return 0;
+    }
+    rank = (size_t)(p * count + 0.999999);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void report(BenchClient *clients, double elapsedSec)
+{
+    uint64_t calls[BENCH_METHOD_COUNT] = { 0 };
+    uint64_t total = 0, errors = 0;
+    uint32_t *all = NULL;
+    size_t count = 0;
+    int c, m;
+
+    for (c = 0; c < s_clientCount; c++) {
+        count += clients[c].log.count;
+        errors += clients[c].errors;
+        for (m = 0; m < BENCH_METHOD_COUNT; m++) {
+            calls[m] += clients[c].calls[m];
+            total += clients[c].calls[m];
+        }
+    }
+    all = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!all) {
+        return;
+    }
+    count = 0;
+    for (c = 0; c < s_clientCount; c++) {
+        memcpy(all + count, clients[c].log.samples, clients[c].log.count * sizeof(uint32_t));
+        count += clients[c].log.count;
+    }
+    qsort(all, count, sizeof(uint32_t), compareU32);
+
+    printf("{ \"mode\": \"%s\", \"transport\": \"%s\", \"clients\": %d, \"leds\": %d, \"offered_rate\": %.1f, \"duration_s\": %.3f,\n",
+           s_rate > 0 ? "open" : "closed", s_local ? "local" : "bus", s_clientCount, s_ledCount, s_rate, elapsedSec);
+    printf("  \"calls\": %llu, \"errors\": %llu, \"throughput\": %.1f,\n",
+           (unsigned long long)total, (unsigned long long)errors, elapsedSec > 0 ? count / elapsedSec : 0.0);
+    printf("  \"methods\": {");
+    for (m = 0; m < BENCH_METHOD_COUNT; m++) {
+        printf("%s \"%s\": %llu", m ? "," : "", BENCH_METHOD_NAMES[m], (unsigned long long)calls[m]);
+    }
+    printf(" },\n");
+    printf("  \"latency_us\": { \"p50\": %u, \"p90\": %u, \"p99\": %u, \"p99.9\": %u, \"max\": %u } }\n",
+           percentile(all, count, 0.50), percentile(all, count, 0.90), percentile(all, count, 0.99),
+           percentile(all, count, 0.999), count ? all[count - 1] : 0);
+    free(all);
+}
+
+/****** JITTER ******/
+
+/* Most steps one pattern call can carry; matches the service's limit */
+#define JITTER_MAX_STEPS 64
+
+/* Brightness edges seen on the watched LED, CLOCK_MONOTONIC ns */
+typedef struct {
+    int fd;
+    int file;
+    int on;
+    uint64_t *edges;
+    size_t count;
+    size_t capacity;
+    volatile int stop;
+} EdgeWatch;
+
+/*
+ * The service rewrites brightness with pwrite and ftruncate, so one step can
+ * raise several events, and the read can race the truncate.  Only a change in
+ * on/off counts as an edge, which folds those together.
+ */
+static void *edgeWatchThread(void *arg)
+{
+    EdgeWatch *watch = (EdgeWatch *)arg;
+    struct pollfd pfd = { watch->fd, POLLIN, 0 };
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (!watch->stop) {
+        char value[16];
+        ssize_t len;
+        uint64_t seen;
+
+        if (poll(&pfd, 1, 100) <= 0 || read(watch->fd, events, sizeof(events)) <= 0) {
+            continue;
+        }
+        seen = nowNs();
+        len = pread(watch->file, value, sizeof(value) - 1, 0);
+        if (len <= 0) {
+            continue;
+        }
+        value[len] = '\0';
+        if ((atoi(value) > 0) != watch->on && watch->count < watch->capacity) {
+            watch->on = !watch->on;
+            watch->edges[watch->count++] = seen;
+        }
+    }
+    return NULL;
+}
+
+/* Deviation of each edge interval from the step length, reported in microseconds */
+static void reportEdges(const char *name, const EdgeWatch *watch, int last)
+{
+    uint32_t deviations[JITTER_MAX_STEPS];
+    uint64_t step = (uint64_t)s_stepMs * 1000000ull;
+    uint64_t sum = 0;
+    size_t count = 0, i;
+
+    for (i = 1; i < watch->count && count < JITTER_MAX_STEPS; i++) {
+        uint64_t interval = watch->edges[i] - watch->edges[i - 1];
+        uint64_t deviation = interval > step ? interval - step : step - interval;
+        deviations[count] = (uint32_t)(deviation / 1000);
+        sum += deviations[count++];
+    }
+    qsort(deviations, count, sizeof(uint32_t), compareU32);
+    printf("  \"%s\": { \"edges\": %zu, \"mean_us\": %.1f, \"p50_us\": %u, \"p99_us\": %u, \"max_us\": %u }%s\n",
+           name, watch->count, count ? (double)sum / count : 0.0, percentile(deviations, count, 0.50),
+           percentile(deviations, count, 0.99), count ? deviations[count - 1] : 0, last ? "" : ",");
+}
+
+/* One blocking call per step, each sent at its scheduled time */
+static int clientSteps(BenchClient *client)
+{
+    uint64_t start = nowNs();
+    int errors = 0;
+    int i;
+
+    for (i = 0; i < s_jitterSteps && !g_interrupt; i++) {
+        BenchMethod method = (i & 1) ? BENCH_OFF : BENCH_ON;
+        alljoyn_message reply = alljoyn_message_create(client->bus);
+        sleepUntil(start + (uint64_t)i * s_stepMs * 1000000ull);
+        if (alljoyn_proxybusobject_methodcall(client->proxy, INTERFACE_NAME, BENCH_METHOD_NAMES[method],
+                                              client->args[method], client->numArgs[method], reply, s_timeoutMs, 0) != ER_OK) {
+            errors++;
+        }
+        alljoyn_message_destroy(reply);
+    }
+    return errors;
+}
+
+/* The same steps as one pattern call, run once */
+static int serverSteps(BenchClient *client)
+{
+    alljoyn_msgarg steps = alljoyn_msgarg_array_create(s_jitterSteps);
+    alljoyn_msgarg inputs = alljoyn_msgarg_array_create(2);
+    alljoyn_message reply = alljoyn_message_create(client->bus);
+    size_t numInputs = 2;
+    QStatus status = ER_OK;
+    int i;
+
+    for (i = 0; i < s_jitterSteps && status == ER_OK; i++) {
+        status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(steps, i), "(du)", (i & 1) ? 0.0 : 1.0, s_stepMs);
+    }
+    if (status == ER_OK) {
+        status = alljoyn_msgarg_array_set(inputs, &numInputs, "a(du)u", (size_t)s_jitterSteps, steps, (uint32_t)1);
+    }
+    if (status == ER_OK) {
+        status = alljoyn_proxybusobject_methodcall(client->proxy, INTERFACE_NAME, "pattern", inputs, numInputs, reply, s_timeoutMs, 0);
+    }
+    if (status == ER_OK) {
+        /* the pattern ends with the LED off, one step after its last edge */
+        sleepUntil(nowNs() + (uint64_t)(s_jitterSteps + 1) * s_stepMs * 1000000ull);
+    } else {
+        fprintf(stderr, "pattern call failed (%s)\n", QCC_StatusText(status));
+    }
+    alljoyn_message_destroy(reply);
+    alljoyn_msgarg_destroy(inputs);
+    alljoyn_msgarg_destroy(steps);
+    return status == ER_OK ? 0 : 1;
+}
+
+/* Runs both step sequences on the client's LED and prints the comparison */
+static int runJitter(BenchClient *client)
+{
+    static const char *NAMES[] = { "client", "server" };
+    char path[PATH_MAX];
+    EdgeWatch watches[2];
+    int errors = 0;
+    int run;
+
+    if (snprintf(path, sizeof(path), "%s/bench:green:usr%d/brightness", s_root, client->index % s_ledCount) >= (int)sizeof(path)) {
+        fprintf(stderr, "%s: path too long\n", s_root);
+        return 1;
+    }
+    for (run = 0; run < 2 && !g_interrupt; run++) {
+        EdgeWatch *watch = &watches[run];
+        pthread_t thread;
+
+        memset(watch, 0, sizeof(*watch));
+        watch->capacity = s_jitterSteps + 1;
+        watch->edges = calloc(watch->capacity, sizeof(uint64_t));
+        watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        watch->file = open(path, O_RDONLY | O_CLOEXEC);
+        if (!watch->edges || watch->fd < 0 || watch->file < 0 || inotify_add_watch(watch->fd, path, IN_MODIFY) < 0 ||
+            pthread_create(&thread, NULL, edgeWatchThread, watch) != 0) {
+            fprintf(stderr, "Cannot watch %s: %s\n", path, strerror(errno));
+            errors++;
+        } else {
+            errors += run ? serverSteps(client) : clientSteps(client);
+            /* let the last write land, then park the LED off for the next run */
+            sleepUntil(nowNs() + (uint64_t)s_stepMs * 1000000ull);
+            watch->stop = 1;
+            pthread_join(thread, NULL);
+            if (run == 0) {
+                alljoyn_message reply = alljoyn_message_create(client->bus);
+                alljoyn_proxybusobject_methodcall(client->proxy, INTERFACE_NAME, "off", NULL, 0, reply, s_timeoutMs, 0);
+                alljoyn_message_destroy(reply);
+                sleepUntil(nowNs() + (uint64_t)s_stepMs * 1000000ull);
+            }
+        }
+        if (watch->fd >= 0) {
+            close(watch->fd);
+        }
+        if (watch->file >= 0) {
+            close(watch->file);
+        }
+    }
+
+    if (run == 2) {
+        printf("{ \"mode\": \"jitter\", \"steps\": %d, \"step_ms\": %u, \"errors\": %d,\n", s_jitterSteps, s_stepMs, errors);
+        reportEdges(NAMES[0], &watches[0], 0);
+        reportEdges(NAMES[1], &watches[1], 1);
+        printf("}\n");
+    }
+    for (run--; run >= 0; run--) {
+        free(watches[run].edges);
+    }
+    return errors ? 1 : 0;
+}
+
+static void usage(const char *cmd)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "   --service <path>      led_service binary to start (default %s)\n", s_servicePath);
+    fprintf(stderr, "   --clients <n>         client bus attachments (default %d)\n", s_clientCount);
+    fprintf(stderr, "   --leds <n>            LEDs in the fake sysfs tree (default %d)\n", s_ledCount);
+    fprintf(stderr, "   --duration <sec>      measured run time (default %.0f)\n", s_durationSec);
+    fprintf(stderr, "   --warmup <sec>        unmeasured run time before that (default %.0f)\n", s_warmupSec);
+    fprintf(stderr, "   --rate <calls/sec>    open loop at this total rate; 0 runs closed loop (default)\n");
+    fprintf(stderr, "   --mix <f:on:off:s>    relative weights of flash, on, off and status (default 1:1:1:7)\n");
+    fprintf(stderr, "   --timeout <ms>        per-call timeout (default %u)\n", s_timeoutMs);
+    fprintf(stderr, "   --backend memory      run the service on its in-memory backend instead of the fake sysfs tree\n");
+    fprintf(stderr, "   --latency-us <w>[:r]  with --backend memory, the attribute write (and read) latency to model\n");
+    fprintf(stderr, "   --local               call over the service's --local-socket instead of the bus (closed loop only)\n");
+    fprintf(stderr, "   --jitter <steps>      compare client-driven and server-side on/off steps instead (max %d)\n", JITTER_MAX_STEPS);
+    fprintf(stderr, "   --step-ms <ms>        step length in jitter mode (default %u)\n", s_stepMs);
+    exit(1);
+}
+
+static int parseMix(const char *spec)
+{
+    unsigned total = 0;
+    int m;
+    for (m = 0; m < BENCH_METHOD_COUNT; m++) {
+        char *end;
+        s_weights[m] = strtoul(spec, &end, 10);
+        total += s_weights[m];
+        if (end == spec || (m < BENCH_METHOD_COUNT - 1 ? *end != ':' : *end != '\0')) {
+            return -1;
+        }
+        spec = end + 1;
+    }
+    return total > 0 ? 0 : -1;
+}
+
+/** Main entry point */
+int main(int argc, char** argv)
+{
+    BenchClient *clients = NULL;
+    int created = 0, started = 0;
+    int ret = 1;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--local") == 0) {
+            s_local = 1;
+        } else if (i + 1 >= argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "--service") == 0) {
+            s_servicePath = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0) {
+            s_clientCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--leds") == 0) {
+            s_ledCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0) {
+            s_durationSec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            s_warmupSec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            s_rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--mix") == 0) {
+            if (parseMix(argv[++i]) != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--timeout") == 0) {
+            s_timeoutMs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--backend") == 0) {
+            s_backend = argv[++i];
+        } else if (strcmp(argv[i], "--latency-us") == 0) {
+            s_latency = argv[++i];
+        } else if (strcmp(argv[i], "--jitter") == 0) {
+            s_jitterSteps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--step-ms") == 0) {
+            s_stepMs = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (s_clientCount < 1 || s_ledCount < 1 || s_durationSec <= 0 || s_warmupSec < 0 || s_rate < 0 ||
+        s_jitterSteps < 0 || s_jitterSteps > JITTER_MAX_STEPS || s_stepMs == 0 ||
+        /* jitter mode watches the brightness file, which only the fake tree has */
+        (s_backend && (strcmp(s_backend, "memory") != 0 || s_jitterSteps > 0)) ||
+        /* the local socket has no async calls and jitter mode needs pattern, which it does not offer */
+        (s_local && (s_rate > 0 || s_jitterSteps > 0))) {
+        usage(argv[0]);
+    }
+    if (s_jitterSteps > 0) {
+        /* one LED, one caller: anything else would only add noise */
+        s_clientCount = 1;
+    }
+
+    signal(SIGINT, SigIntHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* a private name keeps the run away from any real service on the same router */
+    snprintf(s_serviceName, sizeof(s_serviceName), "org.alljoyn.sample.ledbench.p%d", (int)getpid());
+    snprintf(s_localPath, sizeof(s_localPath), "%s/led_bench.%d.sock", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+    if (createFakeTree() != 0 || startService() != 0) {
+        goto cleanup;
+    }
+
+    clients = calloc(s_clientCount, sizeof(BenchClient));
+    if (!clients) {
+        goto cleanup;
+    }
+    for (created = 0; created < s_clientCount; created++) {
+        QStatus status = clientCreate(&clients[created], created);
+        if (status != ER_OK) {
+            fprintf(stderr, "Client %d failed to connect (%s)\n", created, QCC_StatusText(status));
+            created++;
+            goto cleanup;
+        }
+    }
+
+    /* wait until every attachment has seen the service's advertisement */
+    pthread_mutex_lock(&s_foundLock);
+    for (i = 0; i < 100 && s_foundCount < s_clientCount && !g_interrupt && !serviceExited(); i++) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&s_foundCond, &s_foundLock, &ts);
+    }
+    pthread_mutex_unlock(&s_foundLock);
+    if (s_foundCount < s_clientCount) {
+        fprintf(stderr, "Service %s did not come up\n", s_serviceName);
+        goto cleanup;
+    }
+    for (i = 0; i < s_clientCount; i++) {
+        QStatus status = clientJoin(&clients[i]);
+        if (status != ER_OK) {
+            fprintf(stderr, "Client %d failed to join (%s)\n", i, QCC_StatusText(status));
+            goto cleanup;
+        }
+    }
+
+    if (s_jitterSteps > 0) {
+        fprintf(stderr, "Running %d steps of %u ms, client-driven then server-side\n", s_jitterSteps, s_stepMs);
+        ret = runJitter(&clients[0]);
+        goto cleanup;
+    }
+
+    fprintf(stderr, "Running %d %s loop clients for %.1f s (+%.1f s warmup)\n",
+            s_clientCount, s_rate > 0 ? "open" : "closed", s_durationSec, s_warmupSec);
+    s_runStart = nowNs();
+    s_measureStart = s_runStart + (uint64_t)(s_warmupSec * 1e9);
+    s_measureEnd = s_measureStart + (uint64_t)(s_durationSec * 1e9);
+    for (started = 0; started < s_clientCount; started++) {
+        if (pthread_create(&clients[started].thread, NULL, s_rate > 0 ? openLoopThread : closedLoopThread, &clients[started]) != 0) {
+            g_interrupt = QCC_TRUE;
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(clients[i].thread, NULL);
+    }
+
+    if (started == s_clientCount) {
+        uint64_t end = nowNs() < s_measureEnd ? nowNs() : s_measureEnd;
+        report(clients, end > s_measureStart ? (end - s_measureStart) / 1e9 : 0.0);
+        ret = 0;
+    }
+
+cleanup:
+    for (i = 0; i < created; i++) {
+        clientDestroy(&clients[i]);
+    }
+    free(clients);
+    stopService();
+    removeFakeTree();
+    return ret;
+}
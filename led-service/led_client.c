@@ -26,10 +26,17 @@
 #include <qcc/platform.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <alljoyn_c/DBusStdDefines.h>
 #include <alljoyn_c/BusAttachment.h>
@@ -40,21 +47,69 @@
 
 #include <alljoyn_c/Status.h>
 
+#include "led_interface.h"
+#include "led_local.h"
+#include "led_trace.h"
+
 /** Static top level message bus object */
 static alljoyn_busattachment g_msgBus = NULL;
 
-/*constants*/
-static const char* INTERFACE_NAME = "org.alljoyn.sample.ledcontroller";
-static const char* OBJECT_NAME = "org.alljoyn.sample.ledcontroller.beagle";
-static const char* OBJECT_PATH = "/beagle";
-static const alljoyn_sessionport SERVICE_PORT = 42;
 
+/*
+ * Join state, guarded by s_joinLock.  s_joinCond is signalled when a join
+ * attempt finishes, when the session is lost and on SIGINT, so waiters block
+ * on it instead of polling.
+ */
+static pthread_mutex_t s_joinLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_joinCond = PTHREAD_COND_INITIALIZER;
 static QCC_BOOL s_joinComplete = QCC_FALSE;
+static QStatus s_joinStatus = ER_OK;
+static uintptr_t s_joinAttempt = 0;
 static alljoyn_sessionid s_sessionId = 0;
+static volatile QCC_BOOL s_sessionLost = QCC_FALSE;
+
+/* --timing: time spent in waitForJoin and what a 100 ms polling loop would have added to it */
+static int s_timing = 0;
+static uint64_t s_joinWaitNs = 0;
+static uint64_t s_pollPenaltyNs = 0;
+#define POLL_INTERVAL_NS (100 * 1000000ull)
+
+/* Bus name the proxies talk to: the service's unique name once known */
+static char s_serviceName[256];
+
+/* Well-known name discovery turned up: OBJECT_NAME or OBJECT_NAME.<suffix> */
+static char s_foundName[256];
+
+/* How long a join to the cached unique name may take before falling back to discovery */
+#define CACHE_JOIN_TIMEOUT_MS 500
+
+/* --timeout: deadline for each method call */
+static uint32_t s_callTimeoutMs = 5000;
+
+/* --hedge-ms: state of the standby session idempotent calls are hedged to, guarded by s_joinLock */
+typedef enum { HEDGE_IDLE, HEDGE_JOINING, HEDGE_READY, HEDGE_LOST } HedgeState;
+static uint32_t s_hedgeMs = 0;
+static HedgeState s_hedgeState = HEDGE_IDLE;
+static alljoyn_sessionid s_hedgeSessionId = 0;
+static char s_hedgeName[256];
+static size_t s_hedgeOutstanding = 0;
+
+/* Another service discovery turned up besides the one joined; preferred for hedging */
+static char s_altName[256];
+
+/* --local: the service's local socket, which replaces the bus for off, on, flash and status */
+static int s_localFd = -1;
+static uint32_t s_localSeq = 0;
 
 /* Static BusListener */
 static alljoyn_buslistener g_busListener;
 
+/* Static SessionListener, tells the streaming mode to rejoin */
+static alljoyn_sessionlistener s_sessionListener = NULL;
+
+/* Replies are written here: stdout, or the original stdout in --stdin mode */
+static FILE *s_out = NULL;
+
 static volatile sig_atomic_t g_interrupt = QCC_FALSE;
 
 static void SigIntHandler(int sig)
@@ -62,32 +117,122 @@ static void SigIntHandler(int sig)
     g_interrupt = QCC_TRUE;
 }
 
+/*
+ * SIGINT is blocked in every thread and taken here with sigwait, which unlike
+ * a handler may lock s_joinLock and wake whoever is waiting.
+ */
+static void *signalThread(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    int sig;
+    if (sigwait(set, &sig) == 0) {
+        pthread_mutex_lock(&s_joinLock);
+        g_interrupt = QCC_TRUE;
+        pthread_cond_broadcast(&s_joinCond);
+        pthread_mutex_unlock(&s_joinLock);
+    }
+    return NULL;
+}
+
+static uint64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* SessionLost callback */
+void session_lost(const void* context, alljoyn_sessionid sessionId, alljoyn_sessionlostreason reason)
+{
+    printf("session_lost(sessionId=%u, reason=%d)\n", sessionId, (int)reason);
+    pthread_mutex_lock(&s_joinLock);
+    if (s_hedgeState == HEDGE_READY && sessionId == s_hedgeSessionId) {
+        /* only the standby went away; the next hedge rejoins it */
+        s_hedgeState = HEDGE_LOST;
+    } else {
+        s_sessionLost = QCC_TRUE;
+    }
+    pthread_cond_broadcast(&s_joinCond);
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* Records the outcome of a join attempt and wakes the waiting thread */
+static void finishJoin(QStatus status, alljoyn_sessionid sessionId)
+{
+    pthread_mutex_lock(&s_joinLock);
+    s_joinStatus = status;
+    s_sessionId = sessionId;
+    s_joinComplete = QCC_TRUE;
+    pthread_cond_broadcast(&s_joinCond);
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* True for OBJECT_NAME and for the OBJECT_NAME.<suffix> names of services started with --suffix */
+static int isServiceName(const char *name)
+{
+    size_t len = strlen(OBJECT_NAME);
+    return strncmp(name, OBJECT_NAME, len) == 0 && (name[len] == 0 || name[len] == '.');
+}
+
+static int s_fanOut = 0;
+static void fanOutFound(const char *name);
+
 /* FoundAdvertisedName callback */
 void found_advertised_name(const void* context, const char* name, alljoyn_transportmask transport, const char* namePrefix)
 {
     printf("found_advertised_name(name=%s, prefix=%s)\n", name, namePrefix);
-    if (0 == strcmp(name, OBJECT_NAME)) {
+    if (!isServiceName(name)) {
+        return;
+    }
+    if (s_fanOut) {
+        fanOutFound(name);
+    } else if (s_joinComplete) {
+        pthread_mutex_lock(&s_joinLock);
+        if (!s_altName[0] && strcmp(name, s_foundName) != 0) {
+            snprintf(s_altName, sizeof(s_altName), "%s", name);
+        }
+        pthread_mutex_unlock(&s_joinLock);
+    } else {
         /* We found a remote bus that is advertising basic service's  well-known name so connect to it */
         alljoyn_sessionopts opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+        alljoyn_sessionid sessionId = 0;
+        uint64_t begin = ledTraceBegin();
         QStatus status;
         /* enable concurrent callbacks so joinsession can be called */
         alljoyn_busattachment_enableconcurrentcallbacks(g_msgBus);
-        status = alljoyn_busattachment_joinsession(g_msgBus, name, SERVICE_PORT, NULL, &s_sessionId, opts);
+        status = alljoyn_busattachment_joinsession(g_msgBus, name, SERVICE_PORT, s_sessionListener, &sessionId, opts);
+        ledTraceEnd("joinsession", begin);
 
         if (ER_OK != status) {
             printf("alljoyn_busattachment_joinsession failed (status=%s)\n", QCC_StatusText(status));
         } else {
-            printf("alljoyn_busattachment_joinsession SUCCESS (Session id=%d)\n", s_sessionId);
+            snprintf(s_foundName, sizeof(s_foundName), "%s", name);
+            printf("alljoyn_busattachment_joinsession SUCCESS (Session id=%d)\n", sessionId);
         }
         alljoyn_sessionopts_destroy(opts);
+        finishJoin(status, sessionId);
+    }
+}
+
+/* JoinSession callback for the direct join to a cached name */
+void cached_session_joined(QStatus status, alljoyn_sessionid sessionId, const alljoyn_sessionopts opts, void* context)
+{
+    QCC_BOOL stale;
+    pthread_mutex_lock(&s_joinLock);
+    stale = (uintptr_t)context != s_joinAttempt;
+    pthread_mutex_unlock(&s_joinLock);
+    if (!stale) {
+        finishJoin(status, sessionId);
+    } else if (ER_OK == status) {
+        /* we gave up on this join and fell back to discovery */
+        alljoyn_busattachment_leavesession(g_msgBus, sessionId);
     }
-    s_joinComplete = QCC_TRUE;
 }
 
 /* NameOwnerChanged callback */
 void name_owner_changed(const void* context, const char* busName, const char* previousOwner, const char* newOwner)
 {
-    if (newOwner && (0 == strcmp(busName, OBJECT_NAME))) {
+    if (newOwner && isServiceName(busName)) {
         printf("name_owner_changed: name=%s, oldOwner=%s, newOwner=%s\n",
                busName,
                previousOwner ? previousOwner : "<none>",
@@ -95,6 +240,11 @@ void name_owner_changed(const void* context, const char* busName, const char* pr
     }
 }
 
+static void printState(const char *cmd, double brightness, uint32_t frequency)
+{
+    fprintf(s_out, "{ \"cmd\": \"%s\", \"brightness\": %lf, \"frequency\": %u }", cmd, brightness, frequency);
+}
+
 void processResponse(char *cmd, alljoyn_message reply)
 {
     QStatus status = ER_OK;
@@ -110,10 +260,12 @@ void processResponse(char *cmd, alljoyn_message reply)
     if (ER_OK != status) {
         printf("Ping: Error reading alljoyn_message\n");
     }
-    fprintf(stdout, "{ \"cmd\": \"%s\", \"brightness\": %lf, \"frequency\": %u }", cmd, brightness, frequency);
+    printState(cmd, brightness, frequency);
 }
 
-void doFlash(alljoyn_proxybusobject *remoteObj, double brightness, uint32_t frequency)
+QStatus hedgedCall(alljoyn_proxybusobject *remoteObj, const char *method, alljoyn_msgarg args, size_t numArgs);
+
+QStatus doFlash(alljoyn_proxybusobject *remoteObj, double brightness, uint32_t frequency)
 {
     QStatus status = ER_OK;
     alljoyn_message reply; 
@@ -125,7 +277,7 @@ void doFlash(alljoyn_proxybusobject *remoteObj, double brightness, uint32_t freq
     if (ER_OK != status) {
         printf("Arg assignment failed: %s\n", QCC_StatusText(status));
     } else {
-        status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "flash", inputs, numArgs, reply, 5000, 0);
+        status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "flash", inputs, numArgs, reply, s_callTimeoutMs, 0);
         if (ER_OK == status) {
             processResponse("flash", reply);
         } else {
@@ -134,9 +286,10 @@ void doFlash(alljoyn_proxybusobject *remoteObj, double brightness, uint32_t freq
     }
     alljoyn_message_destroy(reply);
     alljoyn_msgarg_destroy(inputs);
+    return status;
 }
 
-void doOn(alljoyn_proxybusobject *remoteObj, double brightness)
+QStatus doOn(alljoyn_proxybusobject *remoteObj, double brightness)
 {
     QStatus status = ER_OK;
     alljoyn_message reply;
@@ -147,8 +300,10 @@ void doOn(alljoyn_proxybusobject *remoteObj, double brightness)
     status = alljoyn_msgarg_array_set(inputs, &numArgs, "d", brightness);
     if (ER_OK != status) {
         printf("Arg assignment failed: %s\n", QCC_StatusText(status));
+    } else if (s_hedgeMs) {
+        status = hedgedCall(remoteObj, "on", inputs, numArgs);
     } else {
-        status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "on", inputs, numArgs, reply, 5000, 0);
+        status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "on", inputs, numArgs, reply, s_callTimeoutMs, 0);
         if (ER_OK == status) {
             processResponse("on", reply);
         } else {
@@ -157,47 +312,1481 @@ void doOn(alljoyn_proxybusobject *remoteObj, double brightness)
     }
     alljoyn_message_destroy(reply);
     alljoyn_msgarg_destroy(inputs);
+    return status;
 }
 
-void doOff(alljoyn_proxybusobject *remoteObj)
+QStatus doOff(alljoyn_proxybusobject *remoteObj)
 {
     QStatus status = ER_OK;
     alljoyn_message reply; 
-    alljoyn_msgarg inputs;
     size_t numArgs = 0;
+    if (s_hedgeMs) {
+        return hedgedCall(remoteObj, "off", NULL, numArgs);
+    }
     reply = alljoyn_message_create(g_msgBus);
-    status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "off", NULL, numArgs, reply, 5000, 0);
+    status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "off", NULL, numArgs, reply, s_callTimeoutMs, 0);
     if (ER_OK == status) {
         processResponse("off", reply);
     } else {
         printf("MethodCall on %s.%s failed\n", INTERFACE_NAME, "off");
     }
     alljoyn_message_destroy(reply);
+    return status;
 }
 
-void doStatus(alljoyn_proxybusobject *remoteObj)
+QStatus doStatus(alljoyn_proxybusobject *remoteObj)
 {
     QStatus status = ER_OK;
     alljoyn_message reply; 
-    alljoyn_msgarg inputs;
     size_t numArgs = 0;
+    if (s_hedgeMs) {
+        return hedgedCall(remoteObj, "status", NULL, numArgs);
+    }
     reply = alljoyn_message_create(g_msgBus);
-    status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "status", NULL, numArgs, reply, 5000, 0);
+    status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "status", NULL, numArgs, reply, s_callTimeoutMs, 0);
     if (ER_OK == status) {
         processResponse("status", reply);
     } else {
         printf("MethodCall on %s.%s failed\n", INTERFACE_NAME, "status");
     }
     alljoyn_message_destroy(reply);
+    return status;
+}
+
+/*
+ * Applies a batch of changes given as <led>:<brightness>:<frequency> strings,
+ * where led is an object path element such as usr0 (empty for the default LED).
+ */
+QStatus doApply(alljoyn_proxybusobject *remoteObj, int numChanges, char **changes)
+{
+    QStatus status = ER_OK;
+    alljoyn_message reply;
+    alljoyn_msgarg entries;
+    alljoyn_msgarg inputs;
+    alljoyn_msgarg results;
+    size_t numResults = 0;
+    size_t i;
+
+    reply = alljoyn_message_create(g_msgBus);
+    entries = alljoyn_msgarg_array_create(numChanges);
+    inputs = alljoyn_msgarg_create();
+    for (i = 0; i < (size_t)numChanges && ER_OK == status; i++) {
+        /* split in place: led:brightness:frequency */
+        char *id = changes[i];
+        char *brightness = strchr(id, ':');
+        char *frequency = brightness ? strchr(brightness + 1, ':') : NULL;
+        if (!frequency) {
+            fprintf(stderr, "Bad change '%s', expected <led>:<brightness>:<frequency>\n", id);
+            status = ER_BAD_ARG_1;
+            break;
+        }
+        *brightness++ = 0;
+        *frequency++ = 0;
+        status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(entries, i), "(sdu)", id, atof(brightness), (uint32_t)atoi(frequency));
+    }
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_set(inputs, "a(sdu)", (size_t)numChanges, entries);
+    }
+    if (ER_OK != status) {
+        printf("Arg assignment failed: %s\n", QCC_StatusText(status));
+    } else {
+        status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "apply", inputs, 1, reply, s_callTimeoutMs, 0);
+        if (ER_OK == status) {
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 0), "a(sudu)", &numResults, &results);
+        } else {
+            printf("MethodCall on %s.%s failed\n", INTERFACE_NAME, "apply");
+        }
+    }
+    if (ER_OK == status) {
+        fprintf(s_out, "{ \"cmd\": \"apply\", \"results\": [");
+        for (i = 0; i < numResults; i++) {
+            char *id;
+            uint32_t entryStatus;
+            double brightness;
+            uint32_t frequency;
+            if (ER_OK == alljoyn_msgarg_get(alljoyn_msgarg_array_element(results, i), "(sudu)", &id, &entryStatus, &brightness, &frequency)) {
+                fprintf(s_out, "%s { \"led\": \"%s\", \"status\": \"%s\", \"brightness\": %lf, \"frequency\": %u }",
+                        i ? "," : "", id, QCC_StatusText((QStatus)entryStatus), brightness, frequency);
+            }
+        }
+        fprintf(s_out, " ] }");
+    }
+    alljoyn_message_destroy(reply);
+    alljoyn_msgarg_destroy(inputs);
+    alljoyn_msgarg_destroy(entries);
+    return status;
+}
+
+/*
+ * Uploads a pattern given as <brightness>:<ms> steps, run repeat times (0 for
+ * forever) by the service.
+ */
+QStatus doPattern(alljoyn_proxybusobject *remoteObj, uint32_t repeat, int numSteps, char **steps)
+{
+    QStatus status = ER_OK;
+    alljoyn_message reply;
+    alljoyn_msgarg entries;
+    alljoyn_msgarg inputs;
+    size_t numInputs = 2;
+    size_t i;
+
+    reply = alljoyn_message_create(g_msgBus);
+    entries = alljoyn_msgarg_array_create(numSteps);
+    inputs = alljoyn_msgarg_array_create(numInputs);
+    for (i = 0; i < (size_t)numSteps && ER_OK == status; i++) {
+        char *end;
+        double brightness = strtod(steps[i], &end);
+        if (*end != ':') {
+            fprintf(stderr, "Bad step '%s', expected <brightness>:<ms>\n", steps[i]);
+            status = ER_BAD_ARG_1;
+            break;
+        }
+        status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(entries, i), "(du)", brightness, (uint32_t)strtoul(end + 1, NULL, 10));
+    }
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_array_set(inputs, &numInputs, "a(du)u", (size_t)numSteps, entries, repeat);
+    }
+    if (ER_OK != status) {
+        printf("Arg assignment failed: %s\n", QCC_StatusText(status));
+    } else {
+        status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "pattern", inputs, numInputs, reply, s_callTimeoutMs, 0);
+        if (ER_OK == status) {
+            char *engine;
+            uint32_t period;
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 0), "s", &engine);
+            if (ER_OK == status) {
+                status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 1), "u", &period);
+            }
+            if (ER_OK == status) {
+                fprintf(s_out, "{ \"cmd\": \"pattern\", \"engine\": \"%s\", \"period\": %u }", engine, period);
+            }
+        } else {
+            printf("MethodCall on %s.%s failed\n", INTERFACE_NAME, "pattern");
+        }
+    }
+    alljoyn_message_destroy(reply);
+    alljoyn_msgarg_destroy(inputs);
+    alljoyn_msgarg_destroy(entries);
+    return status;
+}
+
+/* Prints the service's counters as one JSON object */
+QStatus doStats(alljoyn_proxybusobject *remoteObj)
+{
+    alljoyn_message reply = alljoyn_message_create(g_msgBus);
+    alljoyn_msgarg entries;
+    size_t numEntries = 0;
+    size_t i;
+    QStatus status = alljoyn_proxybusobject_methodcall(*remoteObj, INTERFACE_NAME, "stats", NULL, 0, reply, s_callTimeoutMs, 0);
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 0), "a{st}", &numEntries, &entries);
+    }
+    if (ER_OK == status) {
+        fprintf(s_out, "{ \"cmd\": \"stats\", \"counters\": {");
+        for (i = 0; i < numEntries && ER_OK == status; i++) {
+            char *name;
+            uint64_t value;
+            status = alljoyn_msgarg_get(alljoyn_msgarg_array_element(entries, i), "{st}", &name, &value);
+            if (ER_OK == status) {
+                fprintf(s_out, "%s \"%s\": %llu", i ? "," : "", name, (unsigned long long)value);
+            }
+        }
+        fprintf(s_out, " } }");
+    } else {
+        printf("MethodCall on %s.%s failed\n", INTERFACE_NAME, "stats");
+    }
+    alljoyn_message_destroy(reply);
+    return status;
+}
+
+/* Prints ", "<name>": <value>" for one of the LED properties; val may be the variant or its contents */
+static QStatus printProperty(const char *name, alljoyn_msgarg val)
+{
+    QStatus status = ER_BUS_NO_SUCH_PROPERTY;
+    if (strcmp(name, "Brightness") == 0) {
+        double brightness;
+        if (ER_OK == (status = alljoyn_msgarg_get(val, "d", &brightness))) {
+            fprintf(s_out, ", \"%s\": %lf", name, brightness);
+        }
+    } else if (strcmp(name, "Frequency") == 0) {
+        uint32_t frequency;
+        if (ER_OK == (status = alljoyn_msgarg_get(val, "u", &frequency))) {
+            fprintf(s_out, ", \"%s\": %u", name, frequency);
+        }
+    } else if (strcmp(name, "Trigger") == 0) {
+        char *trigger;
+        if (ER_OK == (status = alljoyn_msgarg_get(val, "s", &trigger))) {
+            fprintf(s_out, ", \"%s\": \"%s\"", name, trigger);
+        }
+    }
+    return status;
+}
+
+/* Reads one property; repeat reads on the same proxy come from its cache */
+QStatus doGet(alljoyn_proxybusobject *remoteObj, const char *property)
+{
+    alljoyn_msgarg value = alljoyn_msgarg_create();
+    QStatus status = alljoyn_proxybusobject_getproperty(*remoteObj, INTERFACE_NAME, property, value);
+    if (ER_OK == status) {
+        fprintf(s_out, "{ \"cmd\": \"get\"");
+        status = printProperty(property, value);
+        fprintf(s_out, " }");
+    }
+    alljoyn_msgarg_destroy(value);
+    return status;
+}
+
+QStatus doGetAll(alljoyn_proxybusobject *remoteObj)
+{
+    alljoyn_msgarg values = alljoyn_msgarg_create();
+    alljoyn_msgarg entries;
+    size_t numEntries = 0;
+    size_t i;
+    QStatus status = alljoyn_proxybusobject_getallproperties(*remoteObj, INTERFACE_NAME, values);
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_get(values, "a{sv}", &numEntries, &entries);
+    }
+    if (ER_OK == status) {
+        fprintf(s_out, "{ \"cmd\": \"getall\"");
+        for (i = 0; i < numEntries && ER_OK == status; i++) {
+            char *name;
+            alljoyn_msgarg value;
+            status = alljoyn_msgarg_get(alljoyn_msgarg_array_element(entries, i), "{sv}", &name, &value);
+            if (ER_OK == status) {
+                status = printProperty(name, value);
+            }
+        }
+        fprintf(s_out, " }");
+    }
+    alljoyn_msgarg_destroy(values);
+    return status;
+}
+
+QStatus doSet(alljoyn_proxybusobject *remoteObj, const char *property, const char *text)
+{
+    alljoyn_msgarg value;
+    QStatus status;
+    if (strcmp(property, "Brightness") == 0) {
+        value = alljoyn_msgarg_create_and_set("d", atof(text));
+    } else if (strcmp(property, "Frequency") == 0) {
+        value = alljoyn_msgarg_create_and_set("u", (uint32_t)strtoul(text, NULL, 10));
+    } else {
+        return ER_BUS_PROPERTY_ACCESS_DENIED;
+    }
+    status = alljoyn_proxybusobject_setproperty(*remoteObj, INTERFACE_NAME, property, value);
+    if (ER_OK == status) {
+        fprintf(s_out, "{ \"cmd\": \"set\", \"property\": \"%s\", \"value\": \"%s\" }", property, text);
+    }
+    alljoyn_msgarg_destroy(value);
+    return status;
+}
+
+/* stateChanged handler: one JSON line per change, limited to s_watchLed when set */
+static const char *s_watchLed = NULL;
+void state_changed(const alljoyn_interfacedescription_member* member, const char* srcPath, alljoyn_message msg)
+{
+    char *led = NULL;
+    char *trigger = NULL;
+    double brightness = 0.0;
+    uint32_t frequency = 0;
+
+    if (ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "s", &led) ||
+        ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 1), "d", &brightness) ||
+        ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 2), "u", &frequency) ||
+        ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 3), "s", &trigger)) {
+        printf("Watch: Error reading alljoyn_message\n");
+        return;
+    }
+    if (s_watchLed && strcmp(s_watchLed, led) != 0) {
+        return;
+    }
+    fprintf(s_out, "{ \"cmd\": \"watch\", \"led\": \"%s\", \"brightness\": %lf, \"frequency\": %u, \"trigger\": \"%s\" }\n",
+            led, brightness, frequency, trigger);
+    fflush(s_out);
+}
+
+QStatus joinService(int useCache);
+
+/* Prints stateChanged signals until interrupted, rejoining if the session drops */
+QStatus doWatch(const char *led)
+{
+    static const char *rule = "type='signal',interface='org.alljoyn.sample.ledcontroller',member='stateChanged'";
+    alljoyn_interfacedescription_member member;
+    QStatus status = ER_OK;
+
+    if (!alljoyn_interfacedescription_getmember(alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME), "stateChanged", &member)) {
+        return ER_BUS_INTERFACE_NO_SUCH_MEMBER;
+    }
+    s_watchLed = led;
+    status = alljoyn_busattachment_registersignalhandler(g_msgBus, state_changed, member, NULL);
+    if (ER_OK == status) {
+        status = alljoyn_busattachment_addmatch(g_msgBus, rule);
+    }
+    while (ER_OK == status && g_interrupt == QCC_FALSE) {
+        pthread_mutex_lock(&s_joinLock);
+        while (!s_sessionLost && g_interrupt == QCC_FALSE) {
+            pthread_cond_wait(&s_joinCond, &s_joinLock);
+        }
+        pthread_mutex_unlock(&s_joinLock);
+        if (s_sessionLost && g_interrupt == QCC_FALSE) {
+            status = joinService(0);
+        }
+    }
+    alljoyn_busattachment_removematch(g_msgBus, rule);
+    alljoyn_busattachment_unregistersignalhandler(g_msgBus, state_changed, member, NULL);
+    return status;
+}
+
+/*
+ * Emits groupCommand as a sessionless signal from a bus object of our own,
+ * so every service in group gets it without a join.  The router only hands
+ * it out while we are connected, hence the --linger-ms wait before exiting.
+ */
+#define BROADCAST_PATH "/beagle/broadcast"
+static alljoyn_busobject s_broadcastObj = NULL;
+static unsigned s_lingerMs = 1000;
+
+QStatus doBroadcast(const char *group, double brightness, uint32_t frequency)
+{
+    alljoyn_interfacedescription iface = alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME);
+    alljoyn_interfacedescription_member member;
+    alljoyn_msgarg args;
+    size_t numArgs = 3;
+    QStatus status;
+
+    if (!alljoyn_interfacedescription_getmember(iface, "groupCommand", &member)) {
+        return ER_BUS_INTERFACE_NO_SUCH_MEMBER;
+    }
+    if (!s_broadcastObj) {
+        alljoyn_busobject_callbacks callbacks = { NULL, NULL, NULL, NULL };
+        s_broadcastObj = alljoyn_busobject_create(BROADCAST_PATH, QCC_FALSE, &callbacks, NULL);
+        status = alljoyn_busobject_addinterface(s_broadcastObj, iface);
+        if (ER_OK == status) {
+            status = alljoyn_busattachment_registerbusobject(g_msgBus, s_broadcastObj);
+        }
+        if (ER_OK != status) {
+            alljoyn_busobject_destroy(s_broadcastObj);
+            s_broadcastObj = NULL;
+            return status;
+        }
+    }
+    args = alljoyn_msgarg_array_create(numArgs);
+    status = alljoyn_msgarg_array_set(args, &numArgs, "sdu", group, brightness, frequency);
+    if (ER_OK == status) {
+        status = alljoyn_busobject_signal(s_broadcastObj, NULL, 0, member, args, numArgs, 0, ALLJOYN_MESSAGE_FLAG_SESSIONLESS);
+    }
+    if (ER_OK == status) {
+        fprintf(s_out, "{ \"cmd\": \"broadcast\", \"group\": \"%s\", \"brightness\": %lf, \"frequency\": %u }", group, brightness, frequency);
+    } else {
+        printf("Signal %s.groupCommand failed (%s)\n", INTERFACE_NAME, QCC_StatusText(status));
+    }
+    alljoyn_msgarg_destroy(args);
+    return status;
+}
+
+/* Sleeps for ms, or until SIGINT */
+static void linger(unsigned ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&s_joinLock);
+    while (g_interrupt == QCC_FALSE && pthread_cond_timedwait(&s_joinCond, &s_joinLock, &deadline) != ETIMEDOUT) {
+    }
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* A parsed command line; led is NULL for the default LED */
+typedef struct {
+    int cmd; /* cmd map:  0 - off, 1 - on, 2 - flash, 3 - status, 4 - apply, 5 - watch, 6 - pattern, 7 - stats, 8 - get, 9 - getall, 10 - set, 11 - broadcast */
+    const char *led;
+    const char *group;
+    double brightness;
+    uint32_t frequency;
+    uint32_t repeat;
+    const char *property;
+    const char *value;
+    int numChanges; /* apply entries or pattern steps */
+    char **changes;
+} LedCommand;
+
+static const char *COMMAND_NAMES[] = { "off", "on", "flash", "status", "apply", "watch", "pattern", "stats", "get", "getall", "set", "broadcast" };
+
+/* Parses [--led <name>] <command> <...args>; returns 0 on success */
+int parseCommand(int argc, char **argv, LedCommand *command)
+{
+    memset(command, 0, sizeof(*command));
+    command->cmd = -1;
+    if(argc > 2 && strcmp(argv[0], "--led") == 0) {
+        command->led = argv[1];
+        argv += 2;
+        argc -= 2;
+    }
+    if(argc < 1) {
+        return -1;
+    }
+    if(strcmp(argv[0], "off") == 0 && argc == 1) {
+        command->cmd = 0;
+    } else if(strcmp(argv[0], "on") == 0 && argc == 2) {
+        command->brightness = atof(argv[1]);
+        command->cmd = 1;
+    } else if(strcmp(argv[0], "flash") == 0 && argc == 3) {
+        command->brightness = atof(argv[1]);
+        command->frequency = atoi(argv[2]);
+        command->cmd = 2;
+    } else if(strcmp(argv[0], "status") == 0 && argc == 1) {
+        command->cmd = 3;
+    } else if(strcmp(argv[0], "apply") == 0 && argc >= 2) {
+        command->numChanges = argc - 1;
+        command->changes = argv + 1;
+        command->cmd = 4;
+    } else if(strcmp(argv[0], "watch") == 0 && argc == 1) {
+        command->cmd = 5;
+    } else if(strcmp(argv[0], "pattern") == 0 && argc >= 3) {
+        command->repeat = (uint32_t)strtoul(argv[1], NULL, 10);
+        command->numChanges = argc - 2;
+        command->changes = argv + 2;
+        command->cmd = 6;
+    } else if(strcmp(argv[0], "stats") == 0 && argc == 1) {
+        command->cmd = 7;
+    } else if(strcmp(argv[0], "get") == 0 && argc == 2) {
+        command->property = argv[1];
+        command->cmd = 8;
+    } else if(strcmp(argv[0], "getall") == 0 && argc == 1) {
+        command->cmd = 9;
+    } else if(strcmp(argv[0], "set") == 0 && argc == 3) {
+        command->property = argv[1];
+        command->value = argv[2];
+        command->cmd = 10;
+    } else if(strcmp(argv[0], "broadcast") == 0 && (argc == 3 || argc == 4)) {
+        command->group = argv[1];
+        command->brightness = atof(argv[2]);
+        command->frequency = argc == 4 ? atoi(argv[3]) : 0;
+        command->cmd = 11;
+    }
+    return command->cmd < 0 ? -1 : 0;
+}
+
+/*
+ * Proxy objects are created once per object path and kept for the life of
+ * the session, so the streaming mode pays for them only on first use.
+ */
+#define MAX_PROXIES 32
+typedef struct {
+    char path[256];
+    alljoyn_proxybusobject obj;
+} LedProxy;
+static LedProxy s_proxies[MAX_PROXIES];
+static size_t s_numProxies = 0;
+
+/* The same for the --hedge-ms standby session */
+static LedProxy s_hedgeProxies[MAX_PROXIES];
+static size_t s_numHedgeProxies = 0;
+
+static alljoyn_proxybusobject *proxyFor(LedProxy *proxies, size_t *numProxies, const char *service, alljoyn_sessionid sessionId, const char *path)
+{
+    size_t i;
+    for (i = 0; i < *numProxies; i++) {
+        if (strcmp(proxies[i].path, path) == 0) {
+            return &proxies[i].obj;
+        }
+    }
+    if (*numProxies == MAX_PROXIES) {
+        return NULL;
+    }
+    snprintf(proxies[i].path, sizeof(proxies[i].path), "%s", path);
+    proxies[i].obj = alljoyn_proxybusobject_create(g_msgBus, service, path, sessionId);
+    /* the service emits PropertiesChanged, so cached reads stay current without a round trip */
+    alljoyn_proxybusobject_enablepropertycaching(proxies[i].obj);
+    alljoyn_proxybusobject_addinterface(proxies[i].obj, alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME));
+    (*numProxies)++;
+    return &proxies[i].obj;
+}
+
+alljoyn_proxybusobject *getProxy(const char *led)
+{
+    char path[256];
+    if (led) {
+        snprintf(path, sizeof(path), "%s/%s", OBJECT_PATH, led);
+    } else {
+        snprintf(path, sizeof(path), "%s", OBJECT_PATH);
+    }
+    return proxyFor(s_proxies, &s_numProxies, s_serviceName, s_sessionId, path);
+}
+
+/* Waits for hedged calls still in flight, whose replies may arrive through these proxies */
+static void hedgeDrain(void)
+{
+    pthread_mutex_lock(&s_joinLock);
+    while (s_hedgeOutstanding > 0) {
+        pthread_cond_wait(&s_joinCond, &s_joinLock);
+    }
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+void destroyProxies(void)
+{
+    size_t i;
+    hedgeDrain();
+    for (i = 0; i < s_numProxies; i++) {
+        alljoyn_proxybusobject_destroy(s_proxies[i].obj);
+    }
+    s_numProxies = 0;
+}
+
+/* Runs off, on, flash or status over the local socket, printing the reply as the bus path would */
+static QStatus localCommand(const LedCommand *command)
+{
+    static const uint32_t LOCAL_METHODS[] = { LED_LOCAL_OFF, LED_LOCAL_ON, LED_LOCAL_FLASH, LED_LOCAL_STATUS };
+    LedLocalRequest request;
+    LedLocalReply reply;
+    QStatus status;
+
+    if (command->cmd > 3) {
+        return ER_NOT_IMPLEMENTED;
+    }
+    memset(&request, 0, sizeof(request));
+    request.seq = ++s_localSeq;
+    request.method = LOCAL_METHODS[command->cmd];
+    request.brightness = command->brightness;
+    request.frequency = command->frequency;
+    if (command->led && strlen(command->led) >= sizeof(request.led)) {
+        return ER_BAD_ARG_1;
+    }
+    if (command->led) {
+        strcpy(request.led, command->led);
+    }
+    status = ledLocalCall(s_localFd, &request, &reply, s_callTimeoutMs);
+    if (ER_OK == status) {
+        status = (QStatus)reply.status;
+    }
+    if (ER_OK == status) {
+        printState(COMMAND_NAMES[command->cmd], reply.brightness, reply.frequency);
+    } else {
+        printf("Local call %s failed (%s)\n", COMMAND_NAMES[command->cmd], QCC_StatusText(status));
+    }
+    return status;
+}
+
+static QStatus dispatchCommand(const LedCommand *command)
+{
+    alljoyn_proxybusobject *remoteObj;
+    if (s_localFd >= 0) {
+        return localCommand(command);
+    }
+    if (command->cmd == 11) {
+        /* sessionless, so no proxy */
+        return doBroadcast(command->group, command->brightness, command->frequency);
+    }
+    remoteObj = getProxy(command->led);
+    if (!remoteObj) {
+        return ER_OUT_OF_MEMORY;
+    }
+    switch(command->cmd) {
+        case 0:
+            return doOff(remoteObj);
+        case 1:
+            return doOn(remoteObj, command->brightness);
+        case 2:
+            return doFlash(remoteObj, command->brightness, command->frequency);
+        case 3:
+            return doStatus(remoteObj);
+        case 4:
+            return doApply(remoteObj, command->numChanges, command->changes);
+        case 5:
+            return doWatch(command->led);
+        case 6:
+            return doPattern(remoteObj, command->repeat, command->numChanges, command->changes);
+        case 7:
+            return doStats(remoteObj);
+        case 8:
+            return doGet(remoteObj, command->property);
+        case 9:
+            return doGetAll(remoteObj);
+        case 10:
+            return doSet(remoteObj, command->property, command->value);
+    }
+    return ER_FAIL;
+}
+
+/* Runs command, traced as a span named after it */
+QStatus runCommand(const LedCommand *command)
+{
+    uint64_t begin = ledTraceBegin();
+    QStatus status = dispatchCommand(command);
+    ledTraceEnd(COMMAND_NAMES[command->cmd], begin);
+    return status;
+}
+
+/****** HEDGING ******/
+
+/*
+ * --hedge-ms: status, on and off are idempotent, so when a reply has not
+ * arrived after s_hedgeMs the same call also goes to a standby session and
+ * the first successful reply is used.  The standby is joined in the
+ * background after the main join, to another instance discovery reported if
+ * there is one and otherwise as a second session to the same service; until
+ * it is up, slow calls simply are not hedged.  Both legs share the --timeout
+ * deadline.  Latencies are kept for the --timing report, which compares the
+ * hedged latency with what the first leg alone took.
+ */
+typedef struct HedgeCall HedgeCall;
+typedef struct {
+    HedgeCall *call;
+    int hedge;
+} HedgeLeg;
+struct HedgeCall {
+    HedgeLeg legs[2];
+    int refs;       /* the caller plus each leg not yet answered */
+    int pending;    /* legs sent and not yet answered */
+    int winner;     /* leg whose reply is used, -1 until one succeeds */
+    QStatus status; /* the latest failure */
+    double brightness;
+    uint32_t frequency;
+    uint64_t started;
+};
+
+#define HEDGE_SAMPLES 4096
+static uint64_t s_hedgeCalls = 0;
+static uint64_t s_hedgesSent = 0;
+static uint64_t s_hedgeWins = 0;
+static uint64_t s_hedgeUnavailable = 0;
+static uint32_t s_latencyUs[HEDGE_SAMPLES];
+static size_t s_numLatency = 0;
+static uint32_t s_firstLegUs[HEDGE_SAMPLES];
+static size_t s_numFirstLeg = 0;
+
+/* JoinSession callback for the standby session */
+static void hedge_joined(QStatus status, alljoyn_sessionid sessionId, const alljoyn_sessionopts opts, void* context)
+{
+    pthread_mutex_lock(&s_joinLock);
+    if (ER_OK == status) {
+        s_hedgeSessionId = sessionId;
+        s_hedgeState = HEDGE_READY;
+    } else {
+        printf("Hedge session to %s failed (%s)\n", s_hedgeName, QCC_StatusText(status));
+        s_hedgeState = HEDGE_IDLE;
+    }
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* Starts joining the standby session unless it is up or on its way */
+static void hedgePrepare(void)
+{
+    alljoyn_sessionopts opts;
+    QStatus status;
+
+    pthread_mutex_lock(&s_joinLock);
+    if (!s_hedgeMs || s_hedgeState == HEDGE_JOINING || s_hedgeState == HEDGE_READY) {
+        pthread_mutex_unlock(&s_joinLock);
+        return;
+    }
+    s_hedgeState = HEDGE_JOINING;
+    snprintf(s_hedgeName, sizeof(s_hedgeName), "%s", s_altName[0] ? s_altName : s_serviceName);
+    pthread_mutex_unlock(&s_joinLock);
+
+    opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+    status = alljoyn_busattachment_joinsessionasync(g_msgBus, s_hedgeName, SERVICE_PORT, s_sessionListener, opts, hedge_joined, NULL);
+    alljoyn_sessionopts_destroy(opts);
+    if (ER_OK != status) {
+        hedge_joined(status, 0, NULL, NULL);
+    }
+}
+
+/* Leaves the standby session and drops its proxies */
+static void hedgeReset(void)
+{
+    size_t i;
+    hedgeDrain();
+    for (i = 0; i < s_numHedgeProxies; i++) {
+        alljoyn_proxybusobject_destroy(s_hedgeProxies[i].obj);
+    }
+    s_numHedgeProxies = 0;
+    pthread_mutex_lock(&s_joinLock);
+    if (s_hedgeState == HEDGE_READY) {
+        alljoyn_busattachment_leavesession(g_msgBus, s_hedgeSessionId);
+    }
+    s_hedgeState = HEDGE_IDLE;
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* The standby session's proxy for path, or NULL while there is none */
+static alljoyn_proxybusobject *hedgeProxy(const char *path)
+{
+    HedgeState state;
+    pthread_mutex_lock(&s_joinLock);
+    state = s_hedgeState;
+    pthread_mutex_unlock(&s_joinLock);
+    if (state == HEDGE_READY) {
+        return proxyFor(s_hedgeProxies, &s_numHedgeProxies, s_hedgeName, s_hedgeSessionId, path);
+    }
+    if (state == HEDGE_LOST) {
+        hedgeReset();
+    }
+    hedgePrepare();
+    return NULL;
+}
+
+/* Converts a monotonicNs() deadline for pthread_cond_timedwait on s_joinCond */
+static int hedgeWaitUntil(uint64_t deadline)
+{
+    struct timespec ts;
+    uint64_t now = monotonicNs();
+    uint64_t left = deadline > now ? deadline - now : 0;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += left / 1000000000ull;
+    ts.tv_nsec += left % 1000000000ull;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(&s_joinCond, &s_joinLock, &ts);
+}
+
+/* Drops a reference with s_joinLock held; returns the call if it is now to be freed */
+static HedgeCall *hedgeRelease(HedgeCall *call)
+{
+    return --call->refs == 0 ? call : NULL;
+}
+
+static void hedge_reply(alljoyn_message message, void* context)
+{
+    HedgeLeg *leg = (HedgeLeg *)context;
+    HedgeCall *call = leg->call;
+    QStatus status = ER_BUS_REPLY_IS_ERROR_MESSAGE;
+    double brightness = 0;
+    uint32_t frequency = 0;
+    uint64_t elapsed = monotonicNs() - call->started;
+
+    if (alljoyn_message_gettype(message) == ALLJOYN_MESSAGE_METHOD_RET) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(message, 0), "d", &brightness);
+        if (ER_OK == status) {
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(message, 1), "u", &frequency);
+        }
+    }
+    pthread_mutex_lock(&s_joinLock);
+    if (!leg->hedge && s_numFirstLeg < HEDGE_SAMPLES) {
+        s_firstLegUs[s_numFirstLeg++] = (uint32_t)(elapsed / 1000);
+    }
+    if (ER_OK == status && call->winner < 0) {
+        call->winner = leg->hedge;
+        call->brightness = brightness;
+        call->frequency = frequency;
+    } else if (ER_OK != status) {
+        call->status = status;
+    }
+    call->pending--;
+    s_hedgeOutstanding--;
+    pthread_cond_broadcast(&s_joinCond);
+    call = hedgeRelease(call);
+    pthread_mutex_unlock(&s_joinLock);
+    free(call);
+}
+
+/* Sends one leg, with whatever is left of the deadline as its timeout */
+static void hedgeSend(HedgeCall *call, int hedge, alljoyn_proxybusobject proxy, const char *method,
+                      alljoyn_msgarg args, size_t numArgs, uint64_t deadline)
+{
+    uint64_t now = monotonicNs();
+    uint32_t timeoutMs = deadline > now ? (uint32_t)((deadline - now + 999999) / 1000000) : 1;
+    QStatus status;
+
+    pthread_mutex_lock(&s_joinLock);
+    call->legs[hedge].call = call;
+    call->legs[hedge].hedge = hedge;
+    call->refs++;
+    call->pending++;
+    s_hedgeOutstanding++;
+    pthread_mutex_unlock(&s_joinLock);
+    status = alljoyn_proxybusobject_methodcall_async(proxy, INTERFACE_NAME, method, hedge_reply, args, numArgs, &call->legs[hedge], timeoutMs, 0);
+    if (ER_OK != status) {
+        pthread_mutex_lock(&s_joinLock);
+        call->refs--;
+        call->pending--;
+        s_hedgeOutstanding--;
+        call->status = status;
+        pthread_mutex_unlock(&s_joinLock);
+    }
+}
+
+/* Calls method on remoteObj, hedged to the standby session, and prints the "du" reply */
+QStatus hedgedCall(alljoyn_proxybusobject *remoteObj, const char *method, alljoyn_msgarg args, size_t numArgs)
+{
+    HedgeCall *call = (HedgeCall *)calloc(1, sizeof(HedgeCall));
+    uint64_t deadline;
+    QStatus status;
+
+    if (!call) {
+        return ER_OUT_OF_MEMORY;
+    }
+    call->refs = 1;
+    call->winner = -1;
+    call->status = ER_TIMEOUT;
+    call->started = monotonicNs();
+    deadline = call->started + (uint64_t)s_callTimeoutMs * 1000000;
+    pthread_mutex_lock(&s_joinLock);
+    s_hedgeCalls++;
+    pthread_mutex_unlock(&s_joinLock);
+    hedgeSend(call, 0, *remoteObj, method, args, numArgs, deadline);
+
+    pthread_mutex_lock(&s_joinLock);
+    while (call->winner < 0 && call->pending > 0 && g_interrupt == QCC_FALSE &&
+           hedgeWaitUntil(call->started + (uint64_t)s_hedgeMs * 1000000) != ETIMEDOUT) {
+    }
+    if (call->winner < 0 && call->pending > 0 && g_interrupt == QCC_FALSE) {
+        alljoyn_proxybusobject *backup;
+        pthread_mutex_unlock(&s_joinLock);
+        backup = hedgeProxy(alljoyn_proxybusobject_getpath(*remoteObj));
+        if (backup) {
+            hedgeSend(call, 1, *backup, method, args, numArgs, deadline);
+        }
+        pthread_mutex_lock(&s_joinLock);
+        if (backup) {
+            s_hedgesSent++;
+        } else {
+            s_hedgeUnavailable++;
+        }
+        while (call->winner < 0 && call->pending > 0 && g_interrupt == QCC_FALSE && hedgeWaitUntil(deadline) != ETIMEDOUT) {
+        }
+    }
+    if (call->winner >= 0) {
+        status = ER_OK;
+        s_hedgeWins += call->winner;
+        if (s_numLatency < HEDGE_SAMPLES) {
+            s_latencyUs[s_numLatency++] = (uint32_t)((monotonicNs() - call->started) / 1000);
+        }
+        printState(method, call->brightness, call->frequency);
+    } else {
+        status = call->pending > 0 ? ER_TIMEOUT : call->status;
+        printf("MethodCall on %s.%s failed (%s)\n", INTERFACE_NAME, method, QCC_StatusText(status));
+    }
+    call = hedgeRelease(call);
+    pthread_mutex_unlock(&s_joinLock);
+    free(call);
+    return status;
+}
+
+static int compareU32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double quantileMs(uint32_t *samples, size_t n, double q)
+{
+    size_t i;
+    if (n == 0) {
+        return 0;
+    }
+    qsort(samples, n, sizeof(uint32_t), compareU32);
+    i = (size_t)(q * n + 0.999999);
+    return samples[(i ? i : 1) - 1] / 1e3;
+}
+
+/*
+ * --timing with --hedge-ms: hedge rate and the tail with hedging against the
+ * first leg alone.  First legs that never answered count as --timeout.
+ */
+static void hedgeReport(void)
+{
+    pthread_mutex_lock(&s_joinLock);
+    while (s_numFirstLeg < s_hedgeCalls && s_numFirstLeg < HEDGE_SAMPLES) {
+        s_firstLegUs[s_numFirstLeg++] = s_callTimeoutMs * 1000;
+    }
+    fprintf(stderr, "{ \"hedge\": { \"calls\": %llu, \"hedged\": %llu, \"rate\": %.4f, \"wins\": %llu, \"unavailable\": %llu,"
+            " \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"first_leg_p50_ms\": %.3f, \"first_leg_p99_ms\": %.3f } }\n",
+            (unsigned long long)s_hedgeCalls, (unsigned long long)s_hedgesSent,
+            s_hedgeCalls ? (double)s_hedgesSent / s_hedgeCalls : 0.0,
+            (unsigned long long)s_hedgeWins, (unsigned long long)s_hedgeUnavailable,
+            quantileMs(s_latencyUs, s_numLatency, 0.50), quantileMs(s_latencyUs, s_numLatency, 0.99),
+            quantileMs(s_firstLegUs, s_numFirstLeg, 0.50), quantileMs(s_firstLegUs, s_numFirstLeg, 0.99));
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/****** SESSION ******/
+static long elapsedMs(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * The last service we joined is cached as "<unique name> <port>" so the next
+ * run can join it directly instead of waiting for discovery.  The cache only
+ * lives in XDG_RUNTIME_DIR; a shared directory like /tmp would let another
+ * user plant the file or a symlink in its place.
+ */
+static int cachePath(char *path, size_t size)
+{
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir || !dir[0]) {
+        return -1;
+    }
+    return snprintf(path, size, "%s/led_client.cache", dir) < (int)size ? 0 : -1;
+}
+
+static int readCache(char name[256], alljoyn_sessionport *port)
+{
+    char path[512];
+    char line[512];
+    unsigned cachedPort;
+    struct stat st;
+    FILE *f;
+    int fd;
+    int result = -1;
+    if (cachePath(path, sizeof(path)) != 0 || (fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    /* only trust a regular file of ours that nobody else can write */
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        close(fd);
+        return -1;
+    }
+    if ((f = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        return -1;
+    }
+    if (fgets(line, sizeof(line), f) && sscanf(line, "%255s %u", name, &cachedPort) == 2 && name[0] == ':') {
+        *port = (alljoyn_sessionport)cachedPort;
+        result = 0;
+    }
+    fclose(f);
+    return result;
+}
+
+static void writeCache(const char *name, alljoyn_sessionport port)
+{
+    char path[512];
+    char tmp[520];
+    FILE *f;
+    int fd;
+    if (cachePath(path, sizeof(path)) != 0) {
+        return;
+    }
+    /* mkstemp creates the file exclusively with mode 0600, never through a symlink */
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp)) < 0) {
+        return;
+    }
+    if ((f = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    fprintf(f, "%s %u\n", name, (unsigned)port);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+    }
+}
+
+static void removeCache(void)
+{
+    char path[512];
+    if (cachePath(path, sizeof(path)) == 0) {
+        unlink(path);
+    }
+}
+
+/* Asks the router who owns the well-known name discovery found */
+static QStatus lookupUniqueName(char *name, size_t size)
+{
+    alljoyn_proxybusobject dbusObj = alljoyn_busattachment_getdbusproxyobj(g_msgBus);
+    alljoyn_message reply = alljoyn_message_create(g_msgBus);
+    alljoyn_msgarg arg = alljoyn_msgarg_create_and_set("s", s_foundName);
+    char *owner = NULL;
+    QStatus status = alljoyn_proxybusobject_methodcall(dbusObj, "org.freedesktop.DBus", "GetNameOwner", arg, 1, reply, s_callTimeoutMs, 0);
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 0), "s", &owner);
+    }
+    if (ER_OK == status) {
+        snprintf(name, size, "%s", owner);
+    }
+    alljoyn_msgarg_destroy(arg);
+    alljoyn_message_destroy(reply);
+    return status;
+}
+
+/* Waits for finishJoin(); timeoutMs < 0 waits until the join completes or SIGINT */
+static QStatus waitForJoin(long timeoutMs)
+{
+    struct timespec start;
+    QStatus status = ER_TIMEOUT;
+    uint64_t began = monotonicNs(), waited;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&s_joinLock);
+    while (!s_joinComplete && g_interrupt == QCC_FALSE) {
+        long remaining = timeoutMs - elapsedMs(&start);
+        struct timespec deadline;
+        if (timeoutMs < 0) {
+            /* SIGINT broadcasts s_joinCond too, so there is nothing to poll for */
+            pthread_cond_wait(&s_joinCond, &s_joinLock);
+            continue;
+        }
+        if (remaining <= 0) {
+            break;
+        }
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += remaining / 1000;
+        deadline.tv_nsec += (remaining % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&s_joinCond, &s_joinLock, &deadline);
+    }
+    if (s_joinComplete) {
+        status = s_joinStatus;
+    } else if (g_interrupt) {
+        status = ER_BUS_STOPPING;
+    }
+    pthread_mutex_unlock(&s_joinLock);
+
+    /* a loop checking once, then every POLL_INTERVAL_NS, would have noticed at the next multiple */
+    waited = monotonicNs() - began;
+    s_joinWaitNs += waited;
+    if (waited % POLL_INTERVAL_NS) {
+        s_pollPenaltyNs += POLL_INTERVAL_NS - waited % POLL_INTERVAL_NS;
+    }
+    return status;
+}
+
+static void resetJoin(void)
+{
+    pthread_mutex_lock(&s_joinLock);
+    s_joinAttempt++;
+    s_joinComplete = QCC_FALSE;
+    s_joinStatus = ER_OK;
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/*
+ * Joins the LED service.  With useCache the cached unique name is tried first
+ * with a short timeout; discovery of OBJECT_NAME is the fallback, joining the
+ * first service advertising it or a suffixed name, and its result refreshes
+ * the cache.
+ */
+QStatus joinService(int useCache)
+{
+    alljoyn_sessionport port = SERVICE_PORT;
+    struct timespec start;
+    char cached[256];
+    uint64_t phase;
+    QStatus status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    destroyProxies();
+    s_sessionLost = QCC_FALSE;
+
+    if (useCache && readCache(cached, &port) == 0) {
+        alljoyn_sessionopts opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+        phase = ledTraceBegin();
+        resetJoin();
+        status = alljoyn_busattachment_joinsessionasync(g_msgBus, cached, port, s_sessionListener, opts, cached_session_joined, (void*)s_joinAttempt);
+        alljoyn_sessionopts_destroy(opts);
+        if (ER_OK == status) {
+            status = waitForJoin(CACHE_JOIN_TIMEOUT_MS);
+        }
+        ledTraceEnd("join_cached", phase);
+        if (ER_OK == status) {
+            snprintf(s_serviceName, sizeof(s_serviceName), "%s", cached);
+            printf("Joined cached service %s (Session id=%d) in %ld ms\n", cached, s_sessionId, elapsedMs(&start));
+            hedgePrepare();
+            return ER_OK;
+        }
+        printf("Cached service %s not reachable (%s), falling back to discovery\n", cached, QCC_StatusText(status));
+        removeCache();
+    }
+
+    /* Begin discovery on the well-known name of the service to be called */
+    phase = ledTraceBegin();
+    resetJoin();
+    alljoyn_busattachment_cancelfindadvertisedname(g_msgBus, OBJECT_NAME);
+    status = alljoyn_busattachment_findadvertisedname(g_msgBus, OBJECT_NAME);
+    if (status != ER_OK) {
+        printf("alljoyn_busattachment_findadvertisedname failed (%s))\n", QCC_StatusText(status));
+        return status;
+    }
+
+    /* Wait for join session to complete */
+    status = waitForJoin(-1);
+    ledTraceEnd("discover", phase);
+    if (ER_OK != status) {
+        s_sessionLost = QCC_TRUE;
+        return status;
+    }
+    phase = ledTraceBegin();
+    status = lookupUniqueName(s_serviceName, sizeof(s_serviceName));
+    ledTraceEnd("get_name_owner", phase);
+    if (ER_OK == status) {
+        writeCache(s_serviceName, SERVICE_PORT);
+    } else {
+        snprintf(s_serviceName, sizeof(s_serviceName), "%s", s_foundName);
+    }
+    printf("Joined %s (Session id=%d) through discovery in %ld ms\n", s_serviceName, s_sessionId, elapsedMs(&start));
+    hedgePrepare();
+    return ER_OK;
+}
+/****** SESSION ******/
+
+/****** FAN-OUT ******/
+
+/*
+ * --all: every service advertising OBJECT_NAME or OBJECT_NAME.<suffix> during
+ * the discovery window is joined at once, then sent the command with at most
+ * s_maxInFlight calls outstanding.  The replies are printed as one JSON array
+ * sorted by service name.  Joins and calls complete on AllJoyn's threads and
+ * are counted down under s_joinLock, so SIGINT wakes these waits as well.
+ */
+typedef struct {
+    char name[256];
+    QStatus status;
+    alljoyn_sessionid sessionId;
+    alljoyn_proxybusobject proxy;
+    uint64_t joinStarted, joined, sent, done;
+    double brightness;
+    uint32_t frequency;
+} FanTarget;
+
+static unsigned s_maxInFlight = 8;
+static unsigned s_discoverMs = 1000;
+static unsigned s_expect = 0;
+static FanTarget *s_targets = NULL;
+static size_t s_numTargets = 0;
+static size_t s_maxTargets = 0;
+static size_t s_fanPending = 0;
+
+/* Collects a discovered name while the discovery window is open (s_fanOut == 1) */
+static void fanOutFound(const char *name)
+{
+    size_t i;
+    pthread_mutex_lock(&s_joinLock);
+    if (s_fanOut != 1) {
+        /* a late name after the window closed */
+        pthread_mutex_unlock(&s_joinLock);
+        return;
+    }
+    for (i = 0; i < s_numTargets && strcmp(s_targets[i].name, name) != 0; i++) {
+    }
+    if (i == s_numTargets) {
+        if (s_numTargets == s_maxTargets) {
+            size_t maxTargets = s_maxTargets ? s_maxTargets * 2 : 16;
+            FanTarget *targets = (FanTarget *)realloc(s_targets, maxTargets * sizeof(FanTarget));
+            if (!targets) {
+                pthread_mutex_unlock(&s_joinLock);
+                return;
+            }
+            s_targets = targets;
+            s_maxTargets = maxTargets;
+        }
+        memset(&s_targets[i], 0, sizeof(FanTarget));
+        snprintf(s_targets[i].name, sizeof(s_targets[i].name), "%s", name);
+        s_targets[i].status = ER_NONE;
+        s_numTargets++;
+        pthread_cond_broadcast(&s_joinCond);
+    }
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* JoinSession callback; context is the index into s_targets */
+static void fan_joined(QStatus status, alljoyn_sessionid sessionId, const alljoyn_sessionopts opts, void* context)
+{
+    FanTarget *target = &s_targets[(uintptr_t)context];
+    pthread_mutex_lock(&s_joinLock);
+    target->status = status;
+    target->sessionId = sessionId;
+    target->joined = monotonicNs();
+    ledTraceSpan("fan_join", target->joinStarted, target->joined);
+    s_fanPending--;
+    pthread_cond_broadcast(&s_joinCond);
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+/* Reply handler for the "du" replies of off, on, flash and status */
+static void fan_reply(alljoyn_message message, void* context)
+{
+    FanTarget *target = &s_targets[(uintptr_t)context];
+    QStatus status = ER_BUS_REPLY_IS_ERROR_MESSAGE;
+    double brightness = 0;
+    uint32_t frequency = 0;
+    if (alljoyn_message_gettype(message) == ALLJOYN_MESSAGE_METHOD_RET) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(message, 0), "d", &brightness);
+        if (ER_OK == status) {
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(message, 1), "u", &frequency);
+        }
+    }
+    pthread_mutex_lock(&s_joinLock);
+    target->status = status;
+    target->brightness = brightness;
+    target->frequency = frequency;
+    target->done = monotonicNs();
+    ledTraceSpan("fan_call", target->sent, target->done);
+    s_fanPending--;
+    pthread_cond_broadcast(&s_joinCond);
+    pthread_mutex_unlock(&s_joinLock);
+}
+
+static int compareTargets(const void *a, const void *b)
+{
+    return strcmp(((const FanTarget *)a)->name, ((const FanTarget *)b)->name);
+}
+
+/* Waits, with s_joinLock held, until s_fanPending drops below limit */
+static void fanOutWait(size_t limit)
+{
+    while (s_fanPending >= limit) {
+        pthread_cond_wait(&s_joinCond, &s_joinLock);
+    }
+}
+
+QStatus runFanOut(const LedCommand *command)
+{
+    static const char *METHODS[] = { "off", "on", "flash", "status" };
+    alljoyn_sessionopts opts;
+    alljoyn_msgarg args = NULL;
+    size_t numArgs = 0;
+    char path[256];
+    struct timespec deadline;
+    uint64_t phase;
+    QStatus status;
+    size_t i, found, failed = 0;
+
+    if (command->cmd < 0 || command->cmd > 3) {
+        return ER_NOT_IMPLEMENTED;
+    }
+    if (command->led) {
+        snprintf(path, sizeof(path), "%s/%s", OBJECT_PATH, command->led);
+    } else {
+        snprintf(path, sizeof(path), "%s", OBJECT_PATH);
+    }
+
+    /* Collect names for the discovery window, or until --expect of them turned up */
+    s_fanOut = 1;
+    phase = ledTraceBegin();
+    status = alljoyn_busattachment_findadvertisedname(g_msgBus, OBJECT_NAME);
+    if (status != ER_OK) {
+        printf("alljoyn_busattachment_findadvertisedname failed (%s))\n", QCC_StatusText(status));
+        return status;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += s_discoverMs / 1000;
+    deadline.tv_nsec += (s_discoverMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&s_joinLock);
+    while (g_interrupt == QCC_FALSE && (s_expect == 0 || s_numTargets < s_expect)) {
+        if (pthread_cond_timedwait(&s_joinCond, &s_joinLock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    /* s_targets is fixed from here on; the callbacks address it by index */
+    qsort(s_targets, s_numTargets, sizeof(FanTarget), compareTargets);
+    s_fanOut = 2;
+    pthread_mutex_unlock(&s_joinLock);
+    alljoyn_busattachment_cancelfindadvertisedname(g_msgBus, OBJECT_NAME);
+    ledTraceEnd("fan_discover", phase);
+    printf("Found %zu services\n", s_numTargets);
+
+    /* Join all of them at once */
+    opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+    for (i = 0; i < s_numTargets && g_interrupt == QCC_FALSE; i++) {
+        pthread_mutex_lock(&s_joinLock);
+        s_fanPending++;
+        s_targets[i].joinStarted = monotonicNs();
+        pthread_mutex_unlock(&s_joinLock);
+        status = alljoyn_busattachment_joinsessionasync(g_msgBus, s_targets[i].name, SERVICE_PORT, NULL, opts, fan_joined, (void*)(uintptr_t)i);
+        if (ER_OK != status) {
+            pthread_mutex_lock(&s_joinLock);
+            s_targets[i].status = status;
+            s_fanPending--;
+            pthread_mutex_unlock(&s_joinLock);
+        }
+    }
+    alljoyn_sessionopts_destroy(opts);
+    pthread_mutex_lock(&s_joinLock);
+    fanOutWait(1);
+    pthread_mutex_unlock(&s_joinLock);
+
+    for (i = 0; i < s_numTargets; i++) {
+        if (s_targets[i].status == ER_OK) {
+            s_targets[i].proxy = alljoyn_proxybusobject_create(g_msgBus, s_targets[i].name, path, s_targets[i].sessionId);
+            alljoyn_proxybusobject_addinterface(s_targets[i].proxy, alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME));
+        }
+    }
+
+    /* Every target gets the same arguments */
+    if (command->cmd == 1) {
+        numArgs = 1;
+        args = alljoyn_msgarg_array_create(numArgs);
+        status = alljoyn_msgarg_array_set(args, &numArgs, "d", command->brightness);
+    } else if (command->cmd == 2) {
+        numArgs = 2;
+        args = alljoyn_msgarg_array_create(numArgs);
+        status = alljoyn_msgarg_array_set(args, &numArgs, "du", command->brightness, command->frequency);
+    } else {
+        status = ER_OK;
+    }
+
+    /* Send with at most s_maxInFlight calls outstanding; the call timeout bounds each reply */
+    pthread_mutex_lock(&s_joinLock);
+    for (i = 0; i < s_numTargets && ER_OK == status && g_interrupt == QCC_FALSE; i++) {
+        QStatus sent;
+        if (!s_targets[i].proxy) {
+            continue;
+        }
+        fanOutWait(s_maxInFlight);
+        s_fanPending++;
+        s_targets[i].status = ER_NONE;
+        s_targets[i].sent = monotonicNs();
+        pthread_mutex_unlock(&s_joinLock);
+        sent = alljoyn_proxybusobject_methodcall_async(s_targets[i].proxy, INTERFACE_NAME, METHODS[command->cmd], fan_reply, args, numArgs, (void*)(uintptr_t)i, s_callTimeoutMs, 0);
+        pthread_mutex_lock(&s_joinLock);
+        if (ER_OK != sent) {
+            s_targets[i].status = sent;
+            s_fanPending--;
+        }
+    }
+    fanOutWait(1);
+    pthread_mutex_unlock(&s_joinLock);
+    if (args) {
+        alljoyn_msgarg_destroy(args);
+    }
+
+    fprintf(s_out, "[");
+    for (i = 0; i < s_numTargets; i++) {
+        FanTarget *target = &s_targets[i];
+        if (target->status != ER_OK) {
+            failed++;
+        }
+        fprintf(s_out, "%s\n  { \"service\": \"%s\", \"status\": \"%s\"", i ? "," : "", target->name, QCC_StatusText(target->status));
+        if (target->joined) {
+            fprintf(s_out, ", \"join_us\": %llu", (unsigned long long)(target->joined - target->joinStarted) / 1000);
+        }
+        if (target->done) {
+            fprintf(s_out, ", \"latency_us\": %llu", (unsigned long long)(target->done - target->sent) / 1000);
+        }
+        if (target->status == ER_OK) {
+            fprintf(s_out, ", \"brightness\": %lf, \"frequency\": %u", target->brightness, target->frequency);
+        }
+        fprintf(s_out, " }");
+    }
+    fprintf(s_out, "%s]\n", s_numTargets ? "\n" : "");
+    fflush(s_out);
+
+    for (i = 0; i < s_numTargets; i++) {
+        if (s_targets[i].proxy) {
+            alljoyn_proxybusobject_destroy(s_targets[i].proxy);
+            alljoyn_busattachment_leavesession(g_msgBus, s_targets[i].sessionId);
+        }
+    }
+    found = s_numTargets;
+    free(s_targets);
+    s_targets = NULL;
+    s_numTargets = s_maxTargets = 0;
+
+    if (ER_OK != status) {
+        return status;
+    }
+    if (g_interrupt) {
+        return ER_BUS_STOPPING;
+    }
+    if (found == 0) {
+        return ER_TIMEOUT;
+    }
+    return failed ? ER_FAIL : ER_OK;
+}
+
+/*
+ * --stdin: reads one command per line, in the same form as the command line,
+ * and writes one JSON line per command.  Commands that fail are answered with
+ * { "cmd": ..., "error": ... } so every input line gets exactly one reply.
+ */
+#define MAX_LINE 4096
+#define MAX_WORDS 256
+void streamCommands(void)
+{
+    char line[MAX_LINE];
+    char *words[MAX_WORDS];
+    while (g_interrupt == QCC_FALSE && fgets(line, sizeof(line), stdin)) {
+        LedCommand command;
+        QStatus status = ER_OK;
+        int numWords = 0;
+        char *word;
+        for (word = strtok(line, " \t\r\n"); word && numWords < MAX_WORDS; word = strtok(NULL, " \t\r\n")) {
+            words[numWords++] = word;
+        }
+        if (numWords == 0) {
+            continue;
+        }
+        if (parseCommand(numWords, words, &command) != 0) {
+            fprintf(s_out, "{ \"cmd\": \"%s\", \"error\": \"invalid command\" }\n", words[0]);
+            fflush(s_out);
+            continue;
+        }
+        if (command.cmd == 5) {
+            /* watch never returns a reply, so it would stall the stream */
+            status = ER_NOT_IMPLEMENTED;
+        } else if (s_sessionLost) {
+            status = joinService(0);
+        }
+        if (ER_OK == status) {
+            status = runCommand(&command);
+        }
+        if (ER_OK != status) {
+            fprintf(s_out, "{ \"cmd\": \"%s\", \"error\": \"%s\" }", COMMAND_NAMES[command.cmd], QCC_StatusText(status));
+        }
+        fprintf(s_out, "\n");
+        fflush(s_out);
+    }
 }
 
 void usage(char *cmd)
 {
-    fprintf(stderr, "Usage: %s <command> <...args>\n", cmd);
+    fprintf(stderr, "Usage: %s [--no-cache] [--timing] [--led <name>] <command> <...args>\n", cmd);
+    fprintf(stderr, "       %s [--no-cache] [--timing] --stdin\n", cmd);
+    fprintf(stderr, "       %s [--timing] --local [--local-socket <path>] [--led <name>] <off|on|flash|status> <...args> | --stdin\n", cmd);
+    fprintf(stderr, "       %s [--timing] --all [--max-inflight <n>] [--discover-ms <ms>] [--expect <n>] [--led <name>] <off|on|flash|status> <...args>\n", cmd);
     fprintf(stderr, "   flash <brightness> <frequency>\n");
     fprintf(stderr, "   on <brightness>\n");
     fprintf(stderr, "   off\n");
     fprintf(stderr, "   status\n");
+    fprintf(stderr, "   apply <led>:<brightness>:<frequency> [...]\n");
+    fprintf(stderr, "   pattern <repeat> <brightness>:<ms> [...]   run the steps repeat times, 0 for forever\n");
+    fprintf(stderr, "   get <Brightness|Frequency|Trigger>\n");
+    fprintf(stderr, "   getall\n");
+    fprintf(stderr, "   set <Brightness|Frequency> <value>\n");
+    fprintf(stderr, "   broadcast <group> <brightness> [<frequency>]   set the default LED of every service in group\n");
+    fprintf(stderr, "                          (\"*\" for all) with one sessionless signal instead of a join per service\n");
+    fprintf(stderr, "   stats                  print the service's call, latency, sysfs and session counters\n");
+    fprintf(stderr, "   watch                  print each state change as a JSON line until interrupted\n");
+    fprintf(stderr, "--led <name> addresses %s/<name> (e.g. usr0) instead of the default LED;\n", OBJECT_PATH);
+    fprintf(stderr, "             with watch it limits the output to that LED\n");
+    fprintf(stderr, "--stdin keeps one session open and reads newline-delimited commands from stdin,\n");
+    fprintf(stderr, "        writing one JSON reply per line\n");
+    fprintf(stderr, "--all sends the command to every service advertising %s or %s.<suffix>,\n", OBJECT_NAME, OBJECT_NAME);
+    fprintf(stderr, "      joining them concurrently and keeping at most --max-inflight calls (default %u)\n", s_maxInFlight);
+    fprintf(stderr, "      outstanding; discovery lasts --discover-ms (default %u) or until --expect services\n", s_discoverMs);
+    fprintf(stderr, "      are found.  Prints one JSON array with each service's status, join and call latency\n");
+    fprintf(stderr, "--linger-ms <ms> how long to stay connected after a broadcast so remote routers can\n");
+    fprintf(stderr, "                 fetch it (default %u)\n", s_lingerMs);
+    fprintf(stderr, "--trace <path> writes each phase (bus start, connect, discovery, join, the call, teardown)\n");
+    fprintf(stderr, "               as Chrome trace JSON; LED_TRACE does the same, %%p in path becomes the pid\n");
+    fprintf(stderr, "--timeout <ms> deadline for each call (default %u)\n", s_callTimeoutMs);
+    fprintf(stderr, "--hedge-ms <ms> when status, on or off has no reply after ms, also send it over a standby\n");
+    fprintf(stderr, "                session (another instance if discovery saw one) and take the first reply;\n");
+    fprintf(stderr, "                --timing then reports the hedge rate and p50/p99 against the first leg alone\n");
+    fprintf(stderr, "--local talks to a service on this board over its --local-socket (default %s) instead of\n", LED_LOCAL_SOCKET);
+    fprintf(stderr, "        the bus; off, on, flash and status only.  --local-socket <path> does the same at path\n");
+    fprintf(stderr, "--no-cache always discovers the service instead of joining the last one seen (the cache needs XDG_RUNTIME_DIR)\n");
+    fprintf(stderr, "--timing prints where the run's wall-clock time went as JSON on stderr, including\n");
+    fprintf(stderr, "         what polling for the join every 100 ms would have added\n");
     exit(1);
 }
 
@@ -207,7 +1796,6 @@ int main(int argc, char** argv, char** envArg)
 {
     QStatus status = ER_OK;
     char* connectArgs = "unix:abstract=alljoyn";
-    alljoyn_interfacedescription testIntf = NULL;
     /* Create a bus listener */
     alljoyn_buslistener_callbacks callbacks = {
         NULL,
@@ -220,65 +1808,146 @@ int main(int argc, char** argv, char** envArg)
         NULL
     };
 
-    int cmd = -1; /* cmd map:  0 - off, 1 - on, 2 - flash, 3 - status */
-    double brightness = 0.0;
-    uint32_t frequency = 0;
-    if((argc < 2) || (argc > 4)) {
-        usage(argv[0]);
-    } else if(argc == 2) {
-        if((strcmp(argv[1], "off") != 0) && (strcmp(argv[1], "status") != 0)) {
-            usage(argv[0]);
-        }
-    } else if(strcmp(argv[1], "on") == 0) {
-        if(argc != 3) {
-            usage(argv[0]);
-        } 
-        brightness = atof(argv[2]);
-        cmd = 1;
-    } else if(strcmp(argv[1], "flash") == 0) {
-        if(argc != 4) {
-            usage(argv[0]);
-        }
-        brightness = atof(argv[2]);
-        frequency = atoi(argv[3]);
-        cmd = 2;
-    } else {
-        usage(argv[0]);
+    alljoyn_sessionlistener_callbacks sessionCallbacks = {
+        &session_lost,
+        NULL,
+        NULL
+    };
+    LedCommand command;
+    int stream = 0;
+    int fanOut = 0;
+    int useCache = 1;
+    char *program = argv[0];
+    sigset_t signals;
+    pthread_t sigThread;
+    const char *tracePath = NULL;
+    const char *localPath = NULL;
+    uint64_t started = monotonicNs(), connected = 0, joined = 0, ran = 0, phase;
+
+    for (; argc > 1; argv++, argc--) {
+        if (strcmp(argv[1], "--no-cache") == 0) {
+            useCache = 0;
+        } else if (strcmp(argv[1], "--timing") == 0) {
+            s_timing = 1;
+        } else if (strcmp(argv[1], "--all") == 0) {
+            fanOut = 1;
+        } else if (strcmp(argv[1], "--max-inflight") == 0 && argc > 2) {
+            s_maxInFlight = (unsigned)strtoul(argv[2], NULL, 10);
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--discover-ms") == 0 && argc > 2) {
+            s_discoverMs = (unsigned)strtoul(argv[2], NULL, 10);
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--linger-ms") == 0 && argc > 2) {
+            s_lingerMs = (unsigned)strtoul(argv[2], NULL, 10);
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--timeout") == 0 && argc > 2) {
+            s_callTimeoutMs = (uint32_t)strtoul(argv[2], NULL, 10);
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--hedge-ms") == 0 && argc > 2) {
+            s_hedgeMs = (uint32_t)strtoul(argv[2], NULL, 10);
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--trace") == 0 && argc > 2) {
+            tracePath = argv[2];
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--local") == 0) {
+            localPath = localPath ? localPath : LED_LOCAL_SOCKET;
+        } else if (strcmp(argv[1], "--local-socket") == 0 && argc > 2) {
+            localPath = argv[2];
+            argv++, argc--;
+        } else if (strcmp(argv[1], "--expect") == 0 && argc > 2) {
+            s_expect = (unsigned)strtoul(argv[2], NULL, 10);
+            argv++, argc--;
+        } else {
+            break;
+        }
+    }
+    if(argc == 2 && strcmp(argv[1], "--stdin") == 0 && !fanOut) {
+        stream = 1;
+    } else if(parseCommand(argc - 1, argv + 1, &command) != 0) {
+        usage(program);
+    } else if(fanOut && (command.cmd > 3 || s_maxInFlight == 0)) {
+        usage(program);
+    }
+    if (s_callTimeoutMs == 0 || (s_hedgeMs && (fanOut || s_hedgeMs >= s_callTimeoutMs))) {
+        usage(program);
+    }
+    if (localPath && (fanOut || s_hedgeMs || (!stream && command.cmd > 3))) {
+        usage(program);
+    }
+
+    s_out = stdout;
+    if (stream || fanOut) {
+        /* keep the original stdout for replies and send all other output to stderr */
+        int replyFd = dup(STDOUT_FILENO);
+        if (replyFd < 0 || (s_out = fdopen(replyFd, "w")) == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Failed to set up the reply stream\n");
+            return 1;
+        }
+    }
+
+    if (ledTraceOpen(tracePath, "led_client") != 0) {
+        fprintf(stderr, "Failed to create the trace file\n");
     }
-    if(cmd < 0) {
-        if(strcmp(argv[1], "off") == 0) {
-            cmd = 0;
+
+    if (localPath) {
+        /* the service is on this board: no bus attachment at all */
+        phase = ledTraceBegin();
+        s_localFd = ledLocalConnect(localPath);
+        ledTraceEnd("local_connect", phase);
+        connected = monotonicNs();
+        if (s_localFd < 0) {
+            fprintf(stderr, "Cannot connect to %s: %s\n", localPath, strerror(errno));
+            status = ER_BUS_NOT_CONNECTED;
+        } else if (stream) {
+            streamCommands();
         } else {
-            cmd = 3;
+            status = runCommand(&command);
+        }
+        ran = monotonicNs();
+        if (s_localFd >= 0) {
+            close(s_localFd);
+        }
+        ledTraceSpan("total", started, monotonicNs());
+        ledTraceClose();
+        if (s_timing) {
+            fprintf(stderr, "{ \"timing\": { \"connect_ms\": %.3f, \"command_ms\": %.3f, \"total_ms\": %.3f } }\n",
+                    (connected - started) / 1e6, (ran - connected) / 1e6, (monotonicNs() - started) / 1e6);
         }
+        return (int) status;
     }
 
     printf("AllJoyn Library version: %s\n", alljoyn_getversion());
     printf("AllJoyn Library build info: %s\n", alljoyn_getbuildinfo());
 
-    /* Install SIGINT handler */
-    signal(SIGINT, SigIntHandler);
-    
+    /* Take SIGINT on a thread of its own; the mask has to be set before AllJoyn starts its threads */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0 || pthread_create(&sigThread, NULL, signalThread, &signals) != 0) {
+        pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+        signal(SIGINT, SigIntHandler);
+    } else {
+        pthread_detach(sigThread);
+    }
+
     /* Create message bus */
+    phase = ledTraceBegin();
     g_msgBus = alljoyn_busattachment_create("myApp", QCC_TRUE);
 
     /* Add org.alljoyn.Bus.method_sample interface */
-    status = alljoyn_busattachment_createinterface(g_msgBus, INTERFACE_NAME, &testIntf);
+    status = createLedInterface(g_msgBus);
     if (status == ER_OK) {
         printf("Interface Created.\n");
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "flash", "du",  "du", "brightnessIn,frequencyIn,brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "on", "d",  "du", "brightnessIn,brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "off", NULL,  "du", "brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "status", NULL,  "du", "brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_activate(testIntf);
     } else {
         printf("Failed to create interface 'org.alljoyn.Bus.method_sample'\n");
     }
+    ledTraceEnd("bus_create", phase);
 
 
     /* Start the msg bus */
     if (ER_OK == status) {
+        phase = ledTraceBegin();
         status = alljoyn_busattachment_start(g_msgBus);
+        ledTraceEnd("bus_start", phase);
         if (ER_OK != status) {
             printf("alljoyn_busattachment_start failed\n");
         } else {
@@ -288,7 +1957,9 @@ int main(int argc, char** argv, char** envArg)
 
     /* Connect to the bus */
     if (ER_OK == status) {
+        phase = ledTraceBegin();
         status = alljoyn_busattachment_connect(g_msgBus, connectArgs);
+        ledTraceEnd("connect", phase);
         if (ER_OK != status) {
             printf("alljoyn_busattachment_connect(\"%s\") failed\n", connectArgs);
         } else {
@@ -297,6 +1968,7 @@ int main(int argc, char** argv, char** envArg)
     }
 
     g_busListener = alljoyn_buslistener_create(&callbacks, NULL);
+    s_sessionListener = alljoyn_sessionlistener_create(&sessionCallbacks, NULL);
 
     /* Register a bus listener in order to get discovery indications */
     if (ER_OK == status) {
@@ -304,58 +1976,65 @@ int main(int argc, char** argv, char** envArg)
         printf("alljoyn_buslistener Registered.\n");
     }
 
-    /* Begin discovery on the well-known name of the service to be called */
-    if (ER_OK == status) {
-        status = alljoyn_busattachment_findadvertisedname(g_msgBus, OBJECT_NAME);
-        if (status != ER_OK) {
-            printf("alljoyn_busattachment_findadvertisedname failed (%s))\n", QCC_StatusText(status));
-        }
-    }
-
-    /* Wait for join session to complete */
-    while (s_joinComplete == QCC_FALSE && g_interrupt == QCC_FALSE) {
-#ifdef _WIN32
-        Sleep(10);
-#else
-        usleep(100 * 1000);
-#endif
+    /* Join the service, through the cached name when there is one; --all joins every service later */
+    connected = monotonicNs();
+    if (ER_OK == status && (stream || (!fanOut && command.cmd != 11))) {
+        phase = ledTraceBegin();
+        status = joinService(useCache);
+        ledTraceEnd("join", phase);
     }
+    joined = monotonicNs();
 
     if (status == ER_OK && g_interrupt == QCC_FALSE) {
-        alljoyn_proxybusobject remoteObj = alljoyn_proxybusobject_create(g_msgBus, OBJECT_NAME, OBJECT_PATH, s_sessionId);
-        const alljoyn_interfacedescription alljoynTestIntf = alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME);
-        assert(alljoynTestIntf);
-        alljoyn_proxybusobject_addinterface(remoteObj, alljoynTestIntf);
-
-        switch(cmd) {
-            case 0:
-	            doOff(&remoteObj);
-                break;
-            case 1:
-                doOn(&remoteObj, brightness);
-                break;
-            case 2:
-	            doFlash(&remoteObj, brightness, frequency);
-                break;
-            case 3:
-	            doStatus(&remoteObj);
-                break;
+        assert(alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME));
+        if (fanOut) {
+            /* discovery and the joins happen in here, so --timing counts them as command time */
+            status = runFanOut(&command);
+        } else if (stream) {
+            streamCommands();
+        } else {
+            runCommand(&command);
+        }
+        destroyProxies();
+        hedgeReset();
+        if (s_broadcastObj) {
+            linger(s_lingerMs);
         }
-
-        alljoyn_proxybusobject_destroy(remoteObj);
     }
+    ran = monotonicNs();
 
     /* Deallocate bus */
+    phase = ledTraceBegin();
     if (g_msgBus) {
         alljoyn_busattachment deleteMe = g_msgBus;
         g_msgBus = NULL;
         alljoyn_busattachment_destroy(deleteMe);
     }
 
+    if (s_broadcastObj) {
+        alljoyn_busobject_destroy(s_broadcastObj);
+    }
+
     /* Deallocate bus listener */
     alljoyn_buslistener_destroy(g_busListener);
 
+    /* Deallocate session listener */
+    alljoyn_sessionlistener_destroy(s_sessionListener);
+    ledTraceEnd("shutdown", phase);
+    ledTraceSpan("total", started, monotonicNs());
+    ledTraceClose();
+
     printf("basic client exiting with status %d (%s)\n", status, QCC_StatusText(status));
+    if (s_timing) {
+        uint64_t done = monotonicNs();
+        fprintf(stderr, "{ \"timing\": { \"connect_ms\": %.3f, \"join_ms\": %.3f, \"join_wait_ms\": %.3f, \"command_ms\": %.3f,"
+                " \"shutdown_ms\": %.3f, \"total_ms\": %.3f, \"poll_saved_ms\": %.3f } }\n",
+                (connected - started) / 1e6, (joined - connected) / 1e6, s_joinWaitNs / 1e6, (ran - joined) / 1e6,
+                (done - ran) / 1e6, (done - started) / 1e6, s_pollPenaltyNs / 1e6);
+        if (s_hedgeMs) {
+            hedgeReport();
+        }
+    }
 
     return (int) status;
 }
@@ -0,0 +1,92 @@
+/**
+ * @file
+ * @brief The org.alljoyn.sample.ledcontroller interface shared by the LED
+ * service and its clients.
+ *
+ * Both sides must build an identical interface description, so the members
+ * are defined once here rather than in each main().
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef LED_INTERFACE_H
+#define LED_INTERFACE_H
+
+#include <alljoyn_c/BusAttachment.h>
+#include <alljoyn_c/InterfaceDescription.h>
+#include <alljoyn_c/Status.h>
+
+/*constants*/
+#define INTERFACE_NAME "org.alljoyn.sample.ledcontroller"
+#define OBJECT_NAME "org.alljoyn.sample.ledcontroller.beagle"
+#define OBJECT_PATH "/beagle"
+static const alljoyn_sessionport SERVICE_PORT = 42;
+
+/*
+ * Creates and activates the LED controller interface on bus.
+ *
+ * apply takes (led, brightness, frequency) entries, where led is the object
+ * path element of an LED ("usr0") or "" for the default LED, and answers
+ * (led, status, brightness, frequency) for each entry in the same order.
+ *
+ * pattern takes (brightness, duration ms) steps and a repeat count, 0 for
+ * forever, and answers with the engine running it ("pattern" or "oneshot"
+ * for the kernel triggers, "software" otherwise) and the period in ms.
+ *
+ * stats answers with the service's counters as name/value pairs: per method
+ * "<method>.calls", ".errors", ".total_us", ".p50_us" and ".p99_us" (the
+ * latter two rounded up to a power of two), then "sysfs.*", "writer.*",
+ * "pattern.*", "sessions.*", "throttled.*", "record.*", "local.*" and
+ * "memory.*".
+ *
+ * The Brightness (d), Frequency (u) and Trigger (s) properties mirror status.
+ * Setting Brightness or Frequency is the same as calling on, off or flash;
+ * Trigger is read-only.  All three emit PropertiesChanged, so a proxy with
+ * property caching enabled only goes to the service for the first read.
+ *
+ * stateChanged is sent by each LED's own object (not the OBJECT_PATH alias)
+ * to every joined session when its brightness, frequency or trigger changes.
+ *
+ * groupCommand is emitted sessionless by led_client broadcast; each service
+ * applies it to its default LED if it is a member of group (or group is "*"),
+ * with the same brightness/frequency meaning as off, on and flash.
+ */
+static QStatus createLedInterface(alljoyn_busattachment bus)
+{
+    alljoyn_interfacedescription testIntf = NULL;
+    QStatus status = alljoyn_busattachment_createinterface(bus, INTERFACE_NAME, &testIntf);
+    if (status == ER_OK) {
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "flash", "du",  "du", "brightnessIn,frequencyIn,brightnessOut,frequencyOut", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "on", "d",  "du", "brightnessIn,brightnessOut,frequencyOut", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "off", NULL,  "du", "brightnessOut,frequencyOut", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "status", NULL,  "du", "brightnessOut,frequencyOut", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "apply", "a(sdu)",  "a(sudu)", "changes,results", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "pattern", "a(du)u",  "su", "steps,repeat,engine,period", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "stats", NULL,  "a{st}", "counters", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_SIGNAL, "stateChanged", "sdus",  NULL, "led,brightness,frequency,trigger", 0);
+        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_SIGNAL, "groupCommand", "sdu",  NULL, "group,brightness,frequency", 0);
+        alljoyn_interfacedescription_addproperty(testIntf, "Brightness", "d", ALLJOYN_PROP_ACCESS_RW);
+        alljoyn_interfacedescription_addproperty(testIntf, "Frequency", "u", ALLJOYN_PROP_ACCESS_RW);
+        alljoyn_interfacedescription_addproperty(testIntf, "Trigger", "s", ALLJOYN_PROP_ACCESS_READ);
+        alljoyn_interfacedescription_addpropertyannotation(testIntf, "Brightness", "org.freedesktop.DBus.Property.EmitsChangedSignal", "true");
+        alljoyn_interfacedescription_addpropertyannotation(testIntf, "Frequency", "org.freedesktop.DBus.Property.EmitsChangedSignal", "true");
+        alljoyn_interfacedescription_addpropertyannotation(testIntf, "Trigger", "org.freedesktop.DBus.Property.EmitsChangedSignal", "true");
+        alljoyn_interfacedescription_activate(testIntf);
+    }
+    return status;
+}
+
+#endif /* LED_INTERFACE_H */
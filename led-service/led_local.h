@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @brief The local control socket led_service offers with --local-socket.
+ *
+ * Callers on the same board can skip the AllJoyn router: connect a
+ * SOCK_SEQPACKET socket to the service's path and send LedLocalRequest
+ * packets.  Each request is answered by one LedLocalReply carrying the same
+ * seq, in the order sent.  Both are fixed size and in host byte order, as
+ * both ends are always on the same host.
+ *
+ * Only flash, on, off and status are offered.  They behave exactly like the
+ * bus methods of the same name, including --rate limits and the stats
+ * counters; a connection counts as one joiner for --rate.  The socket is
+ * owner-only unless the service was started with --local-mode.
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef LED_LOCAL_H
+#define LED_LOCAL_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <alljoyn_c/Status.h>
+
+/* Where the service listens and clients connect unless told otherwise */
+#define LED_LOCAL_SOCKET "/run/led_service.sock"
+
+typedef enum {
+    LED_LOCAL_FLASH,
+    LED_LOCAL_ON,
+    LED_LOCAL_OFF,
+    LED_LOCAL_STATUS,
+    LED_LOCAL_METHOD_COUNT
+} LedLocalMethod;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t method;      /* LedLocalMethod */
+    double brightness;    /* flash and on */
+    uint32_t frequency;   /* flash */
+    char led[36];         /* object path element such as "usr0", or "" for the default LED */
+} LedLocalRequest;
+
+/* brightness and frequency are what the bus method would have answered with */
+typedef struct {
+    uint32_t seq;
+    uint32_t status;      /* QStatus */
+    double brightness;
+    uint32_t frequency;
+    uint32_t reserved;
+} LedLocalReply;
+
+/* Connects to the service's socket at path; returns the descriptor or -1 with errno set */
+static inline int ledLocalConnect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Sends request and waits up to timeoutMs for its reply.  Returns ER_OK once
+ * reply holds the answer, whose own status says how the call went, or the
+ * reason there is no answer.
+ */
+static inline QStatus ledLocalCall(int fd, const LedLocalRequest *request, LedLocalReply *reply, uint32_t timeoutMs)
+{
+    struct pollfd pfd;
+    ssize_t n;
+
+    if (send(fd, request, sizeof(*request), MSG_NOSIGNAL) != (ssize_t)sizeof(*request)) {
+        return ER_BUS_NOT_CONNECTED;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        int ready = poll(&pfd, 1, (int)timeoutMs);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            return ER_TIMEOUT;
+        }
+        if (ready < 0) {
+            return ER_FAIL;
+        }
+        n = recv(fd, reply, sizeof(*reply), 0);
+        if (n != (ssize_t)sizeof(*reply)) {
+            return ER_BUS_NOT_CONNECTED;
+        }
+        /* a reply to a request that timed out earlier */
+        if (reply->seq == request->seq) {
+            return ER_OK;
+        }
+    }
+}
+
+#endif /* LED_LOCAL_H */
@@ -0,0 +1,211 @@
+/**
+ * @file
+ * @brief The call recording format written by led_service --record and read
+ * by led_replay.
+ *
+ * A recording is LED_RECORD_MAGIC followed by one record per method call,
+ * in the order the calls finished.  All integers are little-endian and
+ * doubles are stored as their IEEE 754 bits, so a recording taken on the
+ * board replays from any host:
+ *
+ *     u32 size        of the whole record, this field included
+ *     u64 offset_ns   when the call arrived, from the start of the recording
+ *     u32 latency_us  time the service spent in the handler
+ *     u16 status      QStatus it was answered with
+ *     u8  method      LedRecordMethod
+ *     u8  flags       LED_RECORD_NO_ARGS
+ *     u8  len, path   object the call was made on
+ *     u8  len, joiner unique name of the caller
+ *     ... arguments:  flash   f64 brightness, u32 frequency
+ *                     on      f64 brightness
+ *                     apply   u32 count, then count x (u8 len, led, f64, u32)
+ *                     pattern u32 repeat, u32 count, then count x (f64, u32)
+ *
+ * Readers skip to the next record by size, so fields can be appended later.
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef LED_RECORD_H
+#define LED_RECORD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LED_RECORD_MAGIC "LEDREC1\n"
+#define LED_RECORD_MAGIC_SIZE 8
+
+/* Largest record the service writes; an apply batch that does not fit is recorded without its arguments */
+#define LED_RECORD_MAX_SIZE 4096
+
+/* The arguments could not be read or did not fit, so the call cannot be replayed */
+#define LED_RECORD_NO_ARGS 0x01
+
+/* Same order as the service's StatMethod, whose first entries these are */
+typedef enum {
+    LED_RECORD_FLASH,
+    LED_RECORD_ON,
+    LED_RECORD_OFF,
+    LED_RECORD_STATUS,
+    LED_RECORD_APPLY,
+    LED_RECORD_PATTERN,
+    LED_RECORD_STATS,
+    LED_RECORD_METHOD_COUNT
+} LedRecordMethod;
+
+/* The bus method name of method, which must be below LED_RECORD_METHOD_COUNT */
+static inline const char *ledRecordMethodName(unsigned method)
+{
+    static const char *names[LED_RECORD_METHOD_COUNT] = { "flash", "on", "off", "status", "apply", "pattern", "stats" };
+    return names[method];
+}
+
+/*
+ * A window onto a record being written or read.  Going past size sets
+ * overflow instead of touching memory; reads past it return zeros.
+ */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    int overflow;
+} LedRecordBuffer;
+
+/* One decoded record; path, joiner and args point into the buffer it was read from */
+typedef struct {
+    uint32_t size;
+    uint64_t offsetNs;
+    uint32_t latencyUs;
+    uint16_t status;
+    uint8_t method;
+    uint8_t flags;
+    const char *path;
+    size_t pathLen;
+    const char *joiner;
+    size_t joinerLen;
+    const uint8_t *args;
+    size_t argsSize;
+} LedRecord;
+
+static inline void ledRecordPutUint(LedRecordBuffer *b, uint64_t value, size_t bytes)
+{
+    size_t i;
+    if (b->used + bytes > b->size) {
+        b->overflow = 1;
+        return;
+    }
+    for (i = 0; i < bytes; i++) {
+        b->data[b->used++] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static inline void ledRecordPutDouble(LedRecordBuffer *b, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    ledRecordPutUint(b, bits, 8);
+}
+
+/* Length-prefixed, cut at 255 bytes */
+static inline void ledRecordPutString(LedRecordBuffer *b, const char *s)
+{
+    size_t len = s ? strlen(s) : 0;
+    if (len > 255) {
+        len = 255;
+    }
+    ledRecordPutUint(b, len, 1);
+    if (b->used + len > b->size) {
+        b->overflow = 1;
+        return;
+    }
+    memcpy(b->data + b->used, s, len);
+    b->used += len;
+}
+
+static inline uint64_t ledRecordGetUint(LedRecordBuffer *b, size_t bytes)
+{
+    uint64_t value = 0;
+    size_t i;
+    if (b->used + bytes > b->size) {
+        b->overflow = 1;
+        return 0;
+    }
+    for (i = 0; i < bytes; i++) {
+        value |= (uint64_t)b->data[b->used++] << (8 * i);
+    }
+    return value;
+}
+
+static inline double ledRecordGetDouble(LedRecordBuffer *b)
+{
+    uint64_t bits = ledRecordGetUint(b, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Copies a length-prefixed string into out, NUL terminated */
+static inline void ledRecordGetString(LedRecordBuffer *b, char *out, size_t outSize)
+{
+    size_t len = (size_t)ledRecordGetUint(b, 1);
+    if (b->used + len > b->size) {
+        b->overflow = 1;
+        len = 0;
+    }
+    if (outSize > 0) {
+        size_t n = len < outSize - 1 ? len : outSize - 1;
+        memcpy(out, b->data + b->used, n);
+        out[n] = 0;
+    }
+    b->used += len;
+}
+
+/*
+ * Decodes the record at the start of data.  Returns its size, 0 at a clean
+ * end of data, or -1 if the record is cut short or malformed.
+ */
+static inline long ledRecordDecode(const uint8_t *data, size_t size, LedRecord *record)
+{
+    LedRecordBuffer b = { (uint8_t *)data, size, 0, 0 };
+
+    if (size == 0) {
+        return 0;
+    }
+    record->size = (uint32_t)ledRecordGetUint(&b, 4);
+    if (b.overflow || record->size > size) {
+        return -1;
+    }
+    b.size = record->size;
+    record->offsetNs = ledRecordGetUint(&b, 8);
+    record->latencyUs = (uint32_t)ledRecordGetUint(&b, 4);
+    record->status = (uint16_t)ledRecordGetUint(&b, 2);
+    record->method = (uint8_t)ledRecordGetUint(&b, 1);
+    record->flags = (uint8_t)ledRecordGetUint(&b, 1);
+    record->pathLen = (size_t)ledRecordGetUint(&b, 1);
+    record->path = (const char *)data + b.used;
+    b.used += record->pathLen;
+    record->joinerLen = (size_t)ledRecordGetUint(&b, 1);
+    record->joiner = (const char *)data + b.used;
+    b.used += record->joinerLen;
+    if (b.overflow || b.used > b.size || record->method >= LED_RECORD_METHOD_COUNT) {
+        return -1;
+    }
+    record->args = data + b.used;
+    record->argsSize = b.size - b.used;
+    return (long)record->size;
+}
+
+#endif /* LED_RECORD_H */
@@ -0,0 +1,676 @@
+/**
+ * @file
+ * @brief Replays a led_service --record recording against a running service.
+ *
+ * Every recorded call is re-issued on the object it was made on, with its
+ * recorded arguments, at the pace it arrived (--speed 1), N times faster
+ * (--speed N) or as fast as the service answers (--speed max).  At most
+ * --concurrency calls are outstanding; a call whose turn comes while all of
+ * them are busy goes out late, and that lateness is reported as lag so an
+ * overloaded replay is not mistaken for a faithful one.
+ *
+ * The recording holds the time each call spent in the service's handler,
+ * while the replay can only see the whole round trip, so divergence (replay
+ * minus recorded, per call) includes the bus hop.  Compare divergence
+ * between builds, or run the target with --record as well to get both sides
+ * as handler times.
+ *
+ * The result is a single JSON object on stdout; progress goes to stderr.
+ *
+ * Build: gcc -o led_replay led_replay.c -lalljoyn_c -lpthread
+ *        (or npm install, which builds it into build/Release from binding.gyp)
+ * Run:   ./led_replay --speed 4 --concurrency 8 board.ledrec
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* clock_nanosleep */
+#endif
+
+#include <qcc/platform.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <alljoyn_c/DBusStdDefines.h>
+#include <alljoyn_c/BusAttachment.h>
+#include <alljoyn_c/MsgArg.h>
+#include <alljoyn_c/InterfaceDescription.h>
+#include <alljoyn_c/Status.h>
+
+#include "led_interface.h"
+#include "led_record.h"
+
+/* Distinct objects a recording may address; the service has one per LED plus OBJECT_PATH */
+#define REPLAY_MAX_PATHS 128
+
+/* Settings from the command line */
+static const char *s_recordingPath = NULL;
+static const char *s_serviceName = NULL;
+static const char *s_joiner = NULL;
+static double s_speed = 1.0;
+static int s_concurrency = 4;
+static uint32_t s_timeoutMs = 5000;
+
+/* The recording, read whole, and its records in arrival order */
+static uint8_t *s_data = NULL;
+static LedRecord *s_records = NULL;
+static size_t s_numRecords = 0;
+
+typedef enum {
+    REPLAY_PENDING,
+    REPLAY_SKIPPED,
+    REPLAY_DONE
+} ReplayState;
+
+/* What happened to one record; each is written by the worker that took it */
+typedef struct {
+    ReplayState state;
+    QStatus status;
+    uint64_t replayUs;
+    uint64_t lagUs;
+} ReplayResult;
+
+static ReplayResult *s_results = NULL;
+static size_t s_next = 0;
+static uint64_t s_runStart;
+static uint64_t s_runEnd;
+
+static alljoyn_busattachment s_bus = NULL;
+static alljoyn_buslistener s_listener = NULL;
+static alljoyn_sessionid s_sessionId = 0;
+
+typedef struct {
+    char path[256];
+    alljoyn_proxybusobject proxy;
+} ReplayProxy;
+
+static ReplayProxy s_proxies[REPLAY_MAX_PATHS];
+static size_t s_numProxies = 0;
+static pthread_mutex_t s_proxyLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t s_foundLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_foundCond = PTHREAD_COND_INITIALIZER;
+static int s_found = 0;
+
+static volatile sig_atomic_t g_interrupt = QCC_FALSE;
+
+static void SigIntHandler(int sig)
+{
+    g_interrupt = QCC_TRUE;
+}
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleepUntil(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_interrupt) {
+    }
+}
+
+/****** RECORDING ******/
+
+static int compareOffsets(const void *a, const void *b)
+{
+    uint64_t x = ((const LedRecord *)a)->offsetNs, y = ((const LedRecord *)b)->offsetNs;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Reads the recording and decodes its records.  A service that died while
+ * recording leaves a partial last record, which is dropped with a warning.
+ */
+static int loadRecording(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    size_t size = 0, capacity = 0, used;
+    long n;
+
+    if (!f) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        size = (size_t)n;
+        s_data = (uint8_t *)malloc(size);
+    }
+    if (!s_data || fread(s_data, 1, size, f) != size) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    if (size < LED_RECORD_MAGIC_SIZE || memcmp(s_data, LED_RECORD_MAGIC, LED_RECORD_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s is not a led_service recording\n", path);
+        return -1;
+    }
+
+    for (used = LED_RECORD_MAGIC_SIZE; used < size; used += (size_t)n) {
+        LedRecord record;
+        n = ledRecordDecode(s_data + used, size - used, &record);
+        if (n <= 0) {
+            fprintf(stderr, "Ignoring %lu bytes of damaged or partial records at the end of %s\n", (unsigned long)(size - used), path);
+            break;
+        }
+        if (s_joiner && (record.joinerLen != strlen(s_joiner) || memcmp(record.joiner, s_joiner, record.joinerLen) != 0)) {
+            continue;
+        }
+        if (s_numRecords == capacity) {
+            size_t grown = capacity ? capacity * 2 : 4096;
+            LedRecord *records = (LedRecord *)realloc(s_records, grown * sizeof(LedRecord));
+            if (!records) {
+                return -1;
+            }
+            s_records = records;
+            capacity = grown;
+        }
+        s_records[s_numRecords++] = record;
+    }
+    /* the service writes calls as they finish, so a slow call lands after quicker ones that arrived later */
+    qsort(s_records, s_numRecords, sizeof(LedRecord), compareOffsets);
+    return 0;
+}
+/****** RECORDING ******/
+
+/****** REPLAY ******/
+
+/* FoundAdvertisedName callback */
+static void found_advertised_name(const void* context, const char* name, alljoyn_transportmask transport, const char* namePrefix)
+{
+    if (strcmp(name, s_serviceName) == 0) {
+        pthread_mutex_lock(&s_foundLock);
+        s_found = 1;
+        pthread_cond_broadcast(&s_foundCond);
+        pthread_mutex_unlock(&s_foundLock);
+    }
+}
+
+/* Connects, waits up to 10 s for the service's advertisement and joins it */
+static QStatus replayConnect(void)
+{
+    alljoyn_buslistener_callbacks callbacks = {
+        NULL,
+        NULL,
+        &found_advertised_name,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+    };
+    alljoyn_sessionopts opts;
+    QStatus status;
+    int i;
+
+    s_bus = alljoyn_busattachment_create("ledReplay", QCC_TRUE);
+    status = createLedInterface(s_bus);
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_start(s_bus);
+    }
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_connect(s_bus, "unix:abstract=alljoyn");
+    }
+    if (status == ER_OK) {
+        s_listener = alljoyn_buslistener_create(&callbacks, NULL);
+        alljoyn_busattachment_registerbuslistener(s_bus, s_listener);
+        status = alljoyn_busattachment_findadvertisedname(s_bus, s_serviceName);
+    }
+    if (status != ER_OK) {
+        return status;
+    }
+
+    pthread_mutex_lock(&s_foundLock);
+    for (i = 0; i < 100 && !s_found && !g_interrupt; i++) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&s_foundCond, &s_foundLock, &ts);
+    }
+    pthread_mutex_unlock(&s_foundLock);
+    if (!s_found) {
+        return ER_TIMEOUT;
+    }
+
+    opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+    status = alljoyn_busattachment_joinsession(s_bus, s_serviceName, SERVICE_PORT, NULL, &s_sessionId, opts);
+    alljoyn_sessionopts_destroy(opts);
+    if (status != ER_OK) {
+        s_sessionId = 0;
+    }
+    return status;
+}
+
+static void replayDisconnect(void)
+{
+    size_t p;
+    for (p = 0; p < s_numProxies; p++) {
+        alljoyn_proxybusobject_destroy(s_proxies[p].proxy);
+    }
+    s_numProxies = 0;
+    if (s_bus) {
+        if (s_sessionId) {
+            alljoyn_busattachment_leavesession(s_bus, s_sessionId);
+        }
+        alljoyn_busattachment_stop(s_bus);
+        alljoyn_busattachment_join(s_bus);
+        alljoyn_busattachment_destroy(s_bus);
+        s_bus = NULL;
+    }
+    if (s_listener) {
+        alljoyn_buslistener_destroy(s_listener);
+        s_listener = NULL;
+    }
+}
+
+/* The proxy for the object record was made on, created on first use */
+static alljoyn_proxybusobject replayProxy(const LedRecord *record)
+{
+    alljoyn_proxybusobject proxy = NULL;
+    size_t p;
+
+    pthread_mutex_lock(&s_proxyLock);
+    for (p = 0; p < s_numProxies && !proxy; p++) {
+        if (strlen(s_proxies[p].path) == record->pathLen && memcmp(s_proxies[p].path, record->path, record->pathLen) == 0) {
+            proxy = s_proxies[p].proxy;
+        }
+    }
+    if (!proxy && s_numProxies < REPLAY_MAX_PATHS) {
+        ReplayProxy *entry = &s_proxies[s_numProxies];
+        memcpy(entry->path, record->path, record->pathLen);
+        entry->path[record->pathLen] = 0;
+        entry->proxy = alljoyn_proxybusobject_create(s_bus, s_serviceName, entry->path, s_sessionId);
+        if (alljoyn_proxybusobject_addinterface(entry->proxy, alljoyn_busattachment_getinterface(s_bus, INTERFACE_NAME)) == ER_OK) {
+            proxy = entry->proxy;
+            s_numProxies++;
+        } else {
+            alljoyn_proxybusobject_destroy(entry->proxy);
+        }
+    }
+    pthread_mutex_unlock(&s_proxyLock);
+    return proxy;
+}
+
+/*
+ * Builds the call's arguments from the record into args, which the caller
+ * destroys; names holds apply's LED names, which args points into, and must
+ * be at least record->argsSize bytes.  Returns the number of arguments, or
+ * -1 if the record's arguments cannot be decoded.
+ */
+static int replayArgs(const LedRecord *record, alljoyn_msgarg *args, alljoyn_msgarg *entries, char *names)
+{
+    LedRecordBuffer b = { (uint8_t *)record->args, record->argsSize, 0, 0 };
+    size_t numArgs = 0;
+    size_t count, i, used = 0;
+    uint32_t repeat;
+    QStatus status = ER_OK;
+
+    *args = NULL;
+    *entries = NULL;
+    switch (record->method) {
+    case LED_RECORD_FLASH: {
+        double brightness = ledRecordGetDouble(&b);
+        uint32_t frequency = (uint32_t)ledRecordGetUint(&b, 4);
+        numArgs = 2;
+        *args = alljoyn_msgarg_array_create(numArgs);
+        status = alljoyn_msgarg_array_set(*args, &numArgs, "du", brightness, frequency);
+        break;
+    }
+    case LED_RECORD_ON: {
+        double brightness = ledRecordGetDouble(&b);
+        numArgs = 1;
+        *args = alljoyn_msgarg_array_create(numArgs);
+        status = alljoyn_msgarg_array_set(*args, &numArgs, "d", brightness);
+        break;
+    }
+    case LED_RECORD_APPLY:
+        count = (size_t)ledRecordGetUint(&b, 4);
+        if (b.overflow || count > record->argsSize) {
+            return -1;
+        }
+        *entries = alljoyn_msgarg_array_create(count);
+        for (i = 0; i < count && ER_OK == status && !b.overflow; i++) {
+            char *id = names + used;
+            double brightness;
+            uint32_t frequency;
+            ledRecordGetString(&b, id, record->argsSize - used);
+            used += strlen(id) + 1;
+            brightness = ledRecordGetDouble(&b);
+            frequency = (uint32_t)ledRecordGetUint(&b, 4);
+            status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(*entries, i), "(sdu)", id, brightness, frequency);
+        }
+        numArgs = 1;
+        *args = alljoyn_msgarg_create();
+        if (ER_OK == status) {
+            status = alljoyn_msgarg_set(*args, "a(sdu)", count, *entries);
+        }
+        break;
+    case LED_RECORD_PATTERN:
+        repeat = (uint32_t)ledRecordGetUint(&b, 4);
+        count = (size_t)ledRecordGetUint(&b, 4);
+        if (b.overflow || count > record->argsSize) {
+            return -1;
+        }
+        *entries = alljoyn_msgarg_array_create(count);
+        for (i = 0; i < count && ER_OK == status && !b.overflow; i++) {
+            double brightness = ledRecordGetDouble(&b);
+            uint32_t duration = (uint32_t)ledRecordGetUint(&b, 4);
+            status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(*entries, i), "(du)", brightness, duration);
+        }
+        numArgs = 2;
+        *args = alljoyn_msgarg_array_create(numArgs);
+        if (ER_OK == status) {
+            status = alljoyn_msgarg_array_set(*args, &numArgs, "a(du)u", count, *entries, repeat);
+        }
+        break;
+    default:
+        break;
+    }
+    return ER_OK == status && !b.overflow ? (int)numArgs : -1;
+}
+
+/* Takes the next record in arrival order, waits for its time and issues it */
+static void *replayThread(void *arg)
+{
+    char names[LED_RECORD_MAX_SIZE];
+    uint64_t first = s_numRecords ? s_records[0].offsetNs : 0;
+
+    while (!g_interrupt) {
+        size_t i = __atomic_fetch_add(&s_next, 1, __ATOMIC_RELAXED);
+        const LedRecord *record;
+        ReplayResult *result;
+        alljoyn_proxybusobject proxy;
+        alljoyn_msgarg args = NULL, entries = NULL;
+        alljoyn_message reply;
+        uint64_t scheduled, sent;
+        int numArgs;
+
+        if (i >= s_numRecords) {
+            break;
+        }
+        record = &s_records[i];
+        result = &s_results[i];
+        if ((record->flags & LED_RECORD_NO_ARGS) || record->argsSize > sizeof(names) ||
+            (proxy = replayProxy(record)) == NULL ||
+            (numArgs = replayArgs(record, &args, &entries, names)) < 0) {
+            result->state = REPLAY_SKIPPED;
+        } else {
+            if (s_speed > 0) {
+                scheduled = s_runStart + (uint64_t)((record->offsetNs - first) / s_speed);
+                sleepUntil(scheduled);
+            } else {
+                scheduled = nowNs();
+            }
+            reply = alljoyn_message_create(s_bus);
+            sent = nowNs();
+            result->status = alljoyn_proxybusobject_methodcall(proxy, INTERFACE_NAME, ledRecordMethodName(record->method),
+                                                               args, numArgs, reply, s_timeoutMs, 0);
+            result->replayUs = (nowNs() - sent) / 1000;
+            result->lagUs = sent > scheduled ? (sent - scheduled) / 1000 : 0;
+            result->state = REPLAY_DONE;
+            alljoyn_message_destroy(reply);
+        }
+        if (args) {
+            alljoyn_msgarg_destroy(args);
+        }
+        if (entries) {
+            alljoyn_msgarg_destroy(entries);
+        }
+    }
+    return NULL;
+}
+/****** REPLAY ******/
+
+/****** REPORT ******/
+
+static int compareI64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of a sorted sample set */
+static int64_t percentile(const int64_t *sorted, size_t count, double p)
+{
+    size_t rank;
+    if (count == 0) {
+        return 0;
+    }
+    rank = (size_t)(p * count + 0.999999);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+/* Sorts samples and prints them as "name": { "p50": .., "p90": .., "p99": .., "max": .. } */
+static void printQuantiles(const char *name, int64_t *samples, size_t count)
+{
+    qsort(samples, count, sizeof(int64_t), compareI64);
+    printf("\"%s\": { \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"max\": %lld }", name,
+           (long long)percentile(samples, count, 0.50), (long long)percentile(samples, count, 0.90),
+           (long long)percentile(samples, count, 0.99), (long long)(count ? samples[count - 1] : 0));
+}
+
+static void report(void)
+{
+    size_t size = (s_numRecords + 1) * sizeof(int64_t);
+    int64_t *recorded = (int64_t *)malloc(size);
+    int64_t *replayed = (int64_t *)malloc(size);
+    int64_t *divergence = (int64_t *)malloc(size);
+    int64_t *lag = (int64_t *)malloc(size);
+    int64_t *scratch = (int64_t *)malloc(size);
+    uint8_t *methods = (uint8_t *)malloc(s_numRecords + 1);
+    uint64_t skipped = 0, failed = 0, mismatched = 0, timeouts = 0;
+    size_t count = 0, i;
+    int m, printed = 0;
+
+    if (!recorded || !replayed || !divergence || !lag || !scratch || !methods) {
+        goto done;
+    }
+    for (i = 0; i < s_numRecords; i++) {
+        const ReplayResult *result = &s_results[i];
+        if (result->state == REPLAY_SKIPPED) {
+            skipped++;
+            continue;
+        }
+        if (result->state != REPLAY_DONE) {
+            continue;
+        }
+        if (result->status != ER_OK) {
+            failed++;
+        }
+        if ((result->status == ER_OK) != (s_records[i].status == ER_OK)) {
+            mismatched++;
+        }
+        if (result->status == ER_TIMEOUT) {
+            /* no latency to compare */
+            timeouts++;
+            continue;
+        }
+        methods[count] = s_records[i].method;
+        lag[count] = (int64_t)result->lagUs;
+        recorded[count] = s_records[i].latencyUs;
+        replayed[count] = (int64_t)result->replayUs;
+        divergence[count] = replayed[count] - recorded[count];
+        count++;
+    }
+
+    printf("{ \"recording\": \"%s\", \"speed\": ", s_recordingPath);
+    if (s_speed > 0) {
+        printf("%g", s_speed);
+    } else {
+        printf("\"max\"");
+    }
+    printf(", \"concurrency\": %d,\n", s_concurrency);
+    printf("  \"records\": %lu, \"replayed\": %lu, \"skipped\": %llu, \"failed\": %llu, \"timeouts\": %llu, \"status_mismatches\": %llu,\n",
+           (unsigned long)s_numRecords, (unsigned long)count, (unsigned long long)skipped, (unsigned long long)failed,
+           (unsigned long long)timeouts, (unsigned long long)mismatched);
+    printf("  \"recorded_span_s\": %.3f, \"replay_span_s\": %.3f,\n",
+           s_numRecords ? (s_records[s_numRecords - 1].offsetNs - s_records[0].offsetNs) / 1e9 : 0.0, (s_runEnd - s_runStart) / 1e9);
+
+    /* per method, from the unsorted samples */
+    printf("  \"methods\": {");
+    for (m = 0; m < LED_RECORD_METHOD_COUNT; m++) {
+        int64_t recordedP50, recordedP99;
+        size_t n = 0;
+        for (i = 0; i < count; i++) {
+            if (methods[i] == m) {
+                scratch[n++] = recorded[i];
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+        qsort(scratch, n, sizeof(int64_t), compareI64);
+        recordedP50 = percentile(scratch, n, 0.50);
+        recordedP99 = percentile(scratch, n, 0.99);
+        for (i = 0, n = 0; i < count; i++) {
+            if (methods[i] == m) {
+                scratch[n++] = replayed[i];
+            }
+        }
+        qsort(scratch, n, sizeof(int64_t), compareI64);
+        printf("%s\n    \"%s\": { \"calls\": %lu, \"recorded_p50_us\": %lld, \"recorded_p99_us\": %lld, \"replay_p50_us\": %lld, \"replay_p99_us\": %lld }",
+               printed++ ? "," : "", ledRecordMethodName(m), (unsigned long)n, (long long)recordedP50, (long long)recordedP99,
+               (long long)percentile(scratch, n, 0.50), (long long)percentile(scratch, n, 0.99));
+    }
+    printf(" },\n  ");
+    printQuantiles("recorded_us", recorded, count);
+    printf(",\n  ");
+    printQuantiles("replay_us", replayed, count);
+    printf(",\n  ");
+    printQuantiles("divergence_us", divergence, count);
+    printf(",\n  ");
+    printQuantiles("lag_us", lag, count);
+    printf(" }\n");
+
+done:
+    free(recorded);
+    free(replayed);
+    free(divergence);
+    free(lag);
+    free(scratch);
+    free(methods);
+}
+/****** REPORT ******/
+
+static void usage(const char *cmd)
+{
+    fprintf(stderr, "Usage: %s [options] <recording>\n", cmd);
+    fprintf(stderr, "   --name <bus name>     service to replay against (default %s)\n", OBJECT_NAME);
+    fprintf(stderr, "   --speed <x>|max       x times the recorded pace, or as fast as the service answers (default 1)\n");
+    fprintf(stderr, "   --concurrency <n>     calls outstanding at most (default %d)\n", s_concurrency);
+    fprintf(stderr, "   --joiner <name>       replay only the calls this unique name made\n");
+    fprintf(stderr, "   --timeout <ms>        per-call timeout (default %u)\n", s_timeoutMs);
+    exit(1);
+}
+
+/** Main entry point */
+int main(int argc, char** argv)
+{
+    pthread_t *threads = NULL;
+    int started = 0;
+    int ret = 1;
+    int i;
+    QStatus status;
+
+    s_serviceName = OBJECT_NAME;
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' && !s_recordingPath) {
+            s_recordingPath = argv[i];
+        } else if (i + 1 >= argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "--name") == 0) {
+            s_serviceName = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0) {
+            i++;
+            s_speed = strcmp(argv[i], "max") == 0 ? 0.0 : atof(argv[i]);
+            if (s_speed <= 0 && strcmp(argv[i], "max") != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--concurrency") == 0) {
+            s_concurrency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--joiner") == 0) {
+            s_joiner = argv[++i];
+        } else if (strcmp(argv[i], "--timeout") == 0) {
+            s_timeoutMs = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!s_recordingPath || s_concurrency < 1 || s_timeoutMs == 0) {
+        usage(argv[0]);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    if (loadRecording(s_recordingPath) != 0) {
+        goto cleanup;
+    }
+    s_results = (ReplayResult *)calloc(s_numRecords + 1, sizeof(ReplayResult));
+    threads = (pthread_t *)calloc(s_concurrency, sizeof(pthread_t));
+    if (!s_results || !threads) {
+        goto cleanup;
+    }
+
+    status = replayConnect();
+    if (status != ER_OK) {
+        fprintf(stderr, "Failed to join %s (%s)\n", s_serviceName, QCC_StatusText(status));
+        goto cleanup;
+    }
+
+    fprintf(stderr, "Replaying %lu calls from %s at %s with %d in flight\n", (unsigned long)s_numRecords, s_recordingPath,
+            s_speed > 0 ? "the recorded pace scaled" : "full speed", s_concurrency);
+    s_runStart = nowNs();
+    for (started = 0; started < s_concurrency; started++) {
+        if (pthread_create(&threads[started], NULL, replayThread, NULL) != 0) {
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    s_runEnd = nowNs();
+
+    if (started > 0) {
+        report();
+        ret = 0;
+    }
+
+cleanup:
+    replayDisconnect();
+    free(threads);
+    free(s_results);
+    free(s_records);
+    free(s_data);
+    return ret;
+}
@@ -30,11 +30,30 @@
 #include <qcc/platform.h>
 
 #include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #include <xlocale.h>
 
 #include <alljoyn_c/DBusStdDefines.h>
@@ -42,108 +61,2844 @@
 #include <alljoyn_c/version.h>
 #include <alljoyn_c/Status.h>
 
+#include "led_interface.h"
+#include "led_local.h"
+#include "led_record.h"
+#include "led_trace.h"
+
 /** Static top level message bus object */
 static alljoyn_busattachment g_msgBus = NULL;
 
-/* Static SessionPortListener */
-static alljoyn_sessionportlistener s_sessionPortListener = NULL;
+/* Static SessionPortListener */
+static alljoyn_sessionportlistener s_sessionPortListener = NULL;
+
+/* Static BusListener */
+static alljoyn_buslistener g_busListener = NULL;
+
+/* OBJECT_PATH, the alias for the default LED; its property changes are emitted along with the LED's own */
+static alljoyn_busobject s_aliasObj = NULL;
+
+/* Listener for sessions joined to SERVICE_PORT */
+static alljoyn_sessionlistener s_hostSessionListener = NULL;
+
+/* Well-known name requested and advertised; --name overrides it so several services can share a router */
+static const char *g_serviceName = NULL;
+
+static volatile sig_atomic_t g_interrupt = QCC_FALSE;
+
+/****** STATS ******/
+/*
+ * Method and sysfs counters.  Each thread records into a block of its own, so
+ * the hot path is two clock reads and a few uncontended stores, with no lock
+ * and no cache line shared with another core.  Blocks are pushed onto
+ * s_threadStats on a thread's first call and kept until exit; readers sum
+ * them with relaxed loads, so a snapshot may be a call or two out of step.
+ * A thread that exits leaves its block idle for the next new thread to adopt,
+ * counters and all, so the list only grows with the most threads ever live
+ * at once, however many the bus starts and stops over the months.
+ */
+/* The methods up to STAT_STATS are numbered as led_record.h's LedRecordMethod */
+typedef enum {
+    STAT_FLASH,
+    STAT_ON,
+    STAT_OFF,
+    STAT_STATUS,
+    STAT_APPLY,
+    STAT_PATTERN,
+    STAT_STATS,
+    STAT_GET,
+    STAT_SET,
+    STAT_GROUP,
+    STAT_METHOD_COUNT
+} StatMethod;
+
+static const char *STAT_METHOD_NAMES[STAT_METHOD_COUNT] = { "flash", "on", "off", "status", "apply", "pattern", "stats", "get", "set", "group" };
+
+/* Bucket b counts calls that took less than 2^b us; the last one also takes everything slower */
+#define STAT_BUCKETS 24
+
+typedef struct LedThreadStats {
+    uint64_t calls[STAT_METHOD_COUNT];
+    uint64_t errors[STAT_METHOD_COUNT];
+    uint64_t latencyNs[STAT_METHOD_COUNT];
+    uint64_t buckets[STAT_METHOD_COUNT][STAT_BUCKETS];
+    uint64_t sysfsReads;
+    uint64_t sysfsReadNs;
+    uint64_t sysfsWrites;
+    uint64_t sysfsWriteNs;
+    uint64_t sysfsErrors;
+    int idle;
+    struct LedThreadStats *next;
+} LedThreadStats;
+
+static LedThreadStats *s_threadStats = NULL;
+static __thread LedThreadStats *t_stats = NULL;
+static pthread_key_t s_statsKey;
+static pthread_once_t s_statsOnce = PTHREAD_ONCE_INIT;
+static int s_statsKeyCreated = 0;
+
+/* Joins are rare enough for shared counters */
+static uint64_t s_sessionsAccepted = 0;
+static uint64_t s_sessionsRejected = 0;
+
+static uint64_t ledNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Only the owning thread writes its block, so no locked read-modify-write is needed */
+static inline void statAdd(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/* Key destructor: the exiting thread hands its block on */
+static void statThreadExit(void *stats)
+{
+    __atomic_store_n(&((LedThreadStats *)stats)->idle, 1, __ATOMIC_RELEASE);
+}
+
+static void statKeyCreate(void)
+{
+    s_statsKeyCreated = pthread_key_create(&s_statsKey, statThreadExit) == 0;
+}
+
+/* The calling thread's block, adopted or created on first use; NULL only if that allocation failed */
+static LedThreadStats *statThread(void)
+{
+    LedThreadStats *stats = t_stats;
+    if (stats) {
+        return stats;
+    }
+    pthread_once(&s_statsOnce, statKeyCreate);
+    for (stats = __atomic_load_n(&s_threadStats, __ATOMIC_ACQUIRE); stats; stats = stats->next) {
+        int idle = 1;
+        if (__atomic_load_n(&stats->idle, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&stats->idle, &idle, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!stats && (stats = (LedThreadStats *)calloc(1, sizeof(LedThreadStats))) != NULL) {
+        stats->next = __atomic_load_n(&s_threadStats, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&s_threadStats, &stats->next, stats, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    if (stats && s_statsKeyCreated) {
+        pthread_setspecific(s_statsKey, stats);
+    }
+    t_stats = stats;
+    return stats;
+}
+
+static unsigned statBucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned bucket = us ? 64 - __builtin_clzll(us) : 0;
+    return bucket < STAT_BUCKETS ? bucket : STAT_BUCKETS - 1;
+}
+
+/* Records one method call that started at started (ledNow) and finished with status */
+static void statMethodDone(StatMethod method, uint64_t started, QStatus status)
+{
+    LedThreadStats *stats = statThread();
+    uint64_t ns = ledNow() - started;
+    ledTraceSpan(STAT_METHOD_NAMES[method], started, started + ns);
+    if (stats) {
+        statAdd(&stats->calls[method], 1);
+        statAdd(&stats->latencyNs[method], ns);
+        statAdd(&stats->buckets[method][statBucket(ns)], 1);
+        if (ER_OK != status) {
+            statAdd(&stats->errors[method], 1);
+        }
+    }
+}
+
+/* Records one sysfs read or write that started at started */
+static void statSysfs(int write, uint64_t started, int failed)
+{
+    LedThreadStats *stats = statThread();
+    uint64_t ns = ledNow() - started;
+    ledTraceSpan(write ? "attr_write" : "attr_read", started, started + ns);
+    if (stats) {
+        statAdd(write ? &stats->sysfsWrites : &stats->sysfsReads, 1);
+        statAdd(write ? &stats->sysfsWriteNs : &stats->sysfsReadNs, ns);
+        if (failed) {
+            statAdd(&stats->sysfsErrors, 1);
+        }
+    }
+}
+/****** STATS ******/
+
+/****** LED CONTROL ******/
+static const char *LED_DEFAULT_NAME = "beaglebone:green:usr1";
+
+/*
+ * LED attributes are opened once and the descriptors are kept for the life of
+ * the service.  Values are read and written with pread/pwrite at offset 0, which
+ * sysfs treats as a fresh read or store, so no attribute is ever reopened on the
+ * request path.  A descriptor goes stale (ENODEV) when the LED device goes away,
+ * or for delay_on/delay_off whenever the timer trigger is removed; the attribute
+ * is then reopened and the access retried once.
+ */
+typedef enum {
+    LED_ATTR_TRIGGER,
+    LED_ATTR_BRIGHTNESS,
+    LED_ATTR_DELAY_ON,
+    LED_ATTR_DELAY_OFF,
+    LED_ATTR_PATTERN,
+    LED_ATTR_REPEAT,
+    LED_ATTR_SHOT,
+    LED_ATTR_COUNT
+} LedAttr;
+
+static const char *LED_ATTR_NAMES[LED_ATTR_COUNT] = { "trigger", "brightness", "delay_on", "delay_off", "pattern", "repeat", "shot" };
+
+/* LED_TRIGGER_PATTERN covers the kernel pattern and oneshot triggers and the software pattern engine */
+typedef enum {
+    LED_TRIGGER_NONE,
+    LED_TRIGGER_TIMER,
+    LED_TRIGGER_PATTERN,
+    LED_TRIGGER_OTHER
+} LedTrigger;
+
+static const char *LED_TRIGGER_NAMES[] = { "none", "timer", "pattern", "other" };
+
+/* What status reports: brightness, blink frequency and the active trigger */
+typedef struct {
+    double brightness;
+    uint32_t frequency;
+    LedTrigger trigger;
+} LedState;
+
+/* A pattern uploaded by the pattern method: brightness 0..1 held for duration ms, per step */
+#define LED_PATTERN_MAX_STEPS 64
+typedef struct {
+    double brightness;
+    uint32_t duration;
+} LedStep;
+
+typedef struct {
+    size_t numSteps;
+    uint32_t repeat; /* passes to run, 0 for forever */
+    LedStep steps[LED_PATTERN_MAX_STEPS];
+} LedPattern;
+
+typedef enum {
+    LED_ENGINE_PATTERN,
+    LED_ENGINE_ONESHOT,
+    LED_ENGINE_SOFTWARE
+} LedEngine;
+
+static const char *LED_ENGINE_NAMES[] = { "pattern", "oneshot", "software" };
+
+/* The pattern an LED is running; owned by the writer thread */
+typedef struct {
+    LedPattern *pattern;
+    LedEngine engine;
+    size_t step;
+    uint32_t pass;
+    uint64_t deadline; /* CLOCK_MONOTONIC ns of the next step, or of the end of a finite kernel pattern */
+} LedRun;
+
+/*
+ * Each LED keeps a shadow of its state so status never touches sysfs.  The
+ * shadow is published under a seqlock: writers (the writer thread and the
+ * watcher) are serialised by lock, readers retry until they see an even,
+ * unchanged sequence number and never block.
+ *
+ * Outside sysfs (a plain directory standing in for /sys/class/leds) a store
+ * does not replace the file contents, so writes are followed by a truncate.
+ */
+typedef struct LedDevice {
+    char name[NAME_MAX + 1];
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    int fds[LED_ATTR_COUNT];
+    void *backendData;
+    int truncate;
+    int watch;
+    pthread_mutex_t lock;
+    unsigned seq;
+    LedState state;
+    alljoyn_busobject busObj;
+    int dirty;
+    LedState emitted;
+    uint64_t mailbox;
+    uint32_t applied;
+    struct LedDevice *next;
+    unsigned maxBrightness;
+    int kernelPattern;
+    int kernelOneshot;
+    LedPattern *pattern;
+    LedRun run;
+    int softPattern;
+    unsigned selfEvents[LED_ATTR_COUNT]; /* inotify events our own writes have yet to raise; under lock */
+} LedDevice;
+
+static LedDevice *g_leds = NULL;
+static size_t g_ledCount = 0;
+
+/*
+ * Backends: where LED attributes live.  sysfs is the real thing; tmpfs is a
+ * directory laid out like /sys/class/leds (created on first use) and memory
+ * keeps the attributes in the process, optionally slowed down with
+ * --latency-us to model slow hardware.  Everything above readValue and
+ * writeValue is shared, so tmpfs and memory run the same code paths as
+ * sysfs on hosts without LEDs.
+ */
+typedef struct {
+    const char *name;
+    const char *defaultRoot;    /* NULL when the backend has no directory */
+    int watchable;              /* inotify on the LED directories sees outside changes */
+    int (*discover)(const char *root);
+    void (*open)(LedDevice *led);
+    void (*close)(LedDevice *led);
+    int (*read)(LedDevice *led, LedAttr attr, char *buffer, size_t size);
+    int (*write)(LedDevice *led, LedAttr attr, const char *value, size_t len);
+} LedBackend;
+
+/* Picked at build time for binaries meant to run away from real LEDs; --backend overrides it */
+#ifndef LED_DEFAULT_BACKEND
+#define LED_DEFAULT_BACKEND "sysfs"
+#endif
+
+/* LEDs the tmpfs and memory backends create (--leds) */
+static unsigned s_backendLeds = 4;
+
+/* Appends an LED to g_leds; the registry sorts and sets them up afterwards */
+static size_t s_ledCapacity = 0;
+static LedDevice *ledAdd(const char *name, const char *dir)
+{
+    LedDevice *led;
+    if (g_ledCount == s_ledCapacity) {
+        size_t capacity = s_ledCapacity ? s_ledCapacity * 2 : 8;
+        LedDevice *grown = (LedDevice *)realloc(g_leds, capacity * sizeof(LedDevice));
+        if (!grown) {
+            return NULL;
+        }
+        g_leds = grown;
+        s_ledCapacity = capacity;
+    }
+    led = &g_leds[g_ledCount++];
+    memset(led, 0, sizeof(*led));
+    snprintf(led->name, sizeof(led->name), "%s", name);
+    snprintf(led->dir, sizeof(led->dir), "%s", dir);
+    return led;
+}
+
+/* Every directory under root with a brightness attribute is an LED */
+static int fileDiscover(const char *root)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    if ((dir = opendir(root)) == NULL) {
+        printf("Failed to open LED root %s (%s)\n", root, strerror(errno));
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/brightness", root, entry->d_name);
+        if (access(path, F_OK) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
+        if (!ledAdd(entry->d_name, path)) {
+            break;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int ledAttrOpen(LedDevice *led, LedAttr attr)
+{
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", led->dir, LED_ATTR_NAMES[attr]) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        led->fds[attr] = -1;
+        return -1;
+    }
+    led->fds[attr] = open(path, O_RDWR | O_CLOEXEC);
+    return led->fds[attr];
+}
+
+static void ledAttrClose(LedDevice *led, LedAttr attr)
+{
+    if (led->fds[attr] >= 0) {
+        close(led->fds[attr]);
+        led->fds[attr] = -1;
+    }
+}
+
+static void fileOpen(LedDevice *led)
+{
+    struct statfs fs;
+    char path[PATH_MAX], value[32];
+    ssize_t len;
+    int attr, fd;
+    for (attr = 0; attr < LED_ATTR_COUNT; attr++) {
+        /* only trigger and brightness always exist; the rest come and go with their trigger */
+        if (ledAttrOpen(led, (LedAttr)attr) < 0 && attr <= LED_ATTR_BRIGHTNESS) {
+            printf("Failed to open %s/%s (%s)\n", led->dir, LED_ATTR_NAMES[attr], strerror(errno));
+        }
+    }
+    led->truncate = statfs(led->dir, &fs) == 0 && fs.f_type != SYSFS_MAGIC;
+
+    led->maxBrightness = 1;
+    if (snprintf(path, sizeof(path), "%s/max_brightness", led->dir) < (int)sizeof(path) &&
+        (fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0) {
+        if ((len = read(fd, value, sizeof(value) - 1)) > 0) {
+            value[len] = 0;
+            if (atoi(value) > 0) {
+                led->maxBrightness = atoi(value);
+            }
+        }
+        close(fd);
+    }
+}
+
+static void fileClose(LedDevice *led)
+{
+    int attr;
+    for (attr = 0; attr < LED_ATTR_COUNT; attr++) {
+        ledAttrClose(led, (LedAttr)attr);
+    }
+}
+
+static int fileWrite(LedDevice *led, LedAttr attr, const char *value, size_t len)
+{
+    int attempt;
+    for (attempt = 0; attempt < 2; attempt++) {
+        if (led->fds[attr] < 0 && ledAttrOpen(led, attr) < 0) {
+            return -1;
+        }
+        if (pwrite(led->fds[attr], value, len, 0) == (ssize_t)len) {
+            if (led->truncate && ftruncate(led->fds[attr], len) != 0) {
+                return -1;
+            }
+            return 0;
+        }
+        if (errno != ENODEV) {
+            return -1;
+        }
+        ledAttrClose(led, attr);
+    }
+    return -1;
+}
+
+static int fileRead(LedDevice *led, LedAttr attr, char *buffer, size_t size)
+{
+    ssize_t len;
+    int attempt;
+    for (attempt = 0; attempt < 2; attempt++) {
+        if (led->fds[attr] < 0 && ledAttrOpen(led, attr) < 0) {
+            return -1;
+        }
+        if ((len = pread(led->fds[attr], buffer, size - 1, 0)) >= 0) {
+            buffer[len] = 0;
+            return (int)len;
+        }
+        if (errno != ENODEV) {
+            return -1;
+        }
+        ledAttrClose(led, attr);
+    }
+    return -1;
+}
+
+/* Files a fresh tmpfs LED starts with; only none and timer are offered, as on an LED without pattern support */
+static const char *TMPFS_LED_FILES[][2] = {
+    { "trigger", "[none] timer\n" },
+    { "brightness", "0\n" },
+    { "max_brightness", "255\n" },
+    { "delay_on", "500\n" },
+    { "delay_off", "500\n" },
+};
+
+/* Like sysfs, but creates root and s_backendLeds LEDs in it when it holds none */
+static int tmpfsDiscover(const char *root)
+{
+    char path[PATH_MAX];
+    unsigned l;
+    size_t f;
+
+    if (mkdir(root, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create LED root %s (%s)\n", root, strerror(errno));
+        return -1;
+    }
+    if (fileDiscover(root) != 0 || g_ledCount > 0) {
+        return g_ledCount > 0 ? 0 : -1;
+    }
+    for (l = 0; l < s_backendLeds; l++) {
+        snprintf(path, sizeof(path), "%s/tmpfs:green:usr%u", root, l);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        for (f = 0; f < sizeof(TMPFS_LED_FILES) / sizeof(TMPFS_LED_FILES[0]); f++) {
+            FILE *fp;
+            snprintf(path, sizeof(path), "%s/tmpfs:green:usr%u/%s", root, l, TMPFS_LED_FILES[f][0]);
+            if ((fp = fopen(path, "w")) == NULL) {
+                return -1;
+            }
+            fputs(TMPFS_LED_FILES[f][1], fp);
+            fclose(fp);
+        }
+    }
+    printf("Created %u LEDs under %s\n", s_backendLeds, root);
+    return fileDiscover(root);
+}
+
+/*
+ * In-memory attributes.  trigger reads back as the list of triggers with the
+ * active one in brackets, as in sysfs, and only accepts names from the list.
+ */
+#define MEMORY_VALUE_SIZE 1024
+typedef struct {
+    char values[LED_ATTR_COUNT][MEMORY_VALUE_SIZE];
+} MemoryLed;
+
+static const char *MEMORY_TRIGGERS[] = { "none", "timer" };
+static pthread_mutex_t s_memoryLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t s_memoryWriteLatencyNs = 0;
+static uint64_t s_memoryReadLatencyNs = 0;
+
+static void memoryDelay(uint64_t ns)
+{
+    struct timespec ts;
+    if (ns) {
+        ts.tv_sec = ns / 1000000000ull;
+        ts.tv_nsec = ns % 1000000000ull;
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+}
+
+static int memoryDiscover(const char *root)
+{
+    char name[NAME_MAX + 1];
+    unsigned l;
+    for (l = 0; l < s_backendLeds; l++) {
+        snprintf(name, sizeof(name), "mem:green:usr%u", l);
+        if (!ledAdd(name, "memory")) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void memoryOpen(LedDevice *led)
+{
+    MemoryLed *memory = (MemoryLed *)calloc(1, sizeof(MemoryLed));
+    led->backendData = memory;
+    led->maxBrightness = 255;
+    if (memory) {
+        strcpy(memory->values[LED_ATTR_TRIGGER], "none");
+        strcpy(memory->values[LED_ATTR_BRIGHTNESS], "0");
+        strcpy(memory->values[LED_ATTR_DELAY_ON], "500");
+        strcpy(memory->values[LED_ATTR_DELAY_OFF], "500");
+    }
+}
+
+static void memoryClose(LedDevice *led)
+{
+    free(led->backendData);
+    led->backendData = NULL;
+}
+
+static int memoryWrite(LedDevice *led, LedAttr attr, const char *value, size_t len)
+{
+    MemoryLed *memory = (MemoryLed *)led->backendData;
+    size_t t;
+    int result = -1;
+
+    memoryDelay(s_memoryWriteLatencyNs);
+    if (!memory || len >= MEMORY_VALUE_SIZE) {
+        return -1;
+    }
+    pthread_mutex_lock(&s_memoryLock);
+    if (attr == LED_ATTR_TRIGGER) {
+        for (t = 0; t < sizeof(MEMORY_TRIGGERS) / sizeof(MEMORY_TRIGGERS[0]); t++) {
+            if (strlen(MEMORY_TRIGGERS[t]) == len && strncmp(MEMORY_TRIGGERS[t], value, len) == 0) {
+                result = 0;
+            }
+        }
+    } else {
+        result = 0;
+    }
+    if (result == 0) {
+        memcpy(memory->values[attr], value, len);
+        memory->values[attr][len] = 0;
+    }
+    pthread_mutex_unlock(&s_memoryLock);
+    return result;
+}
+
+static int memoryRead(LedDevice *led, LedAttr attr, char *buffer, size_t size)
+{
+    MemoryLed *memory = (MemoryLed *)led->backendData;
+    size_t t, len = 0;
+
+    memoryDelay(s_memoryReadLatencyNs);
+    if (!memory || size == 0) {
+        return -1;
+    }
+    buffer[0] = 0;
+    pthread_mutex_lock(&s_memoryLock);
+    if (attr == LED_ATTR_TRIGGER) {
+        for (t = 0; t < sizeof(MEMORY_TRIGGERS) / sizeof(MEMORY_TRIGGERS[0]); t++) {
+            int active = strcmp(MEMORY_TRIGGERS[t], memory->values[attr]) == 0;
+            len += snprintf(buffer + len, len < size ? size - len : 0, active ? "%s[%s]" : "%s%s", t ? " " : "", MEMORY_TRIGGERS[t]);
+        }
+    } else {
+        len = snprintf(buffer, size, "%s", memory->values[attr]);
+    }
+    pthread_mutex_unlock(&s_memoryLock);
+    return (int)(len < size ? len : size - 1);
+}
+
+static const LedBackend LED_BACKENDS[] = {
+    { "sysfs", "/sys/class/leds", 1, fileDiscover, fileOpen, fileClose, fileRead, fileWrite },
+    { "tmpfs", "/dev/shm/led_service", 1, tmpfsDiscover, fileOpen, fileClose, fileRead, fileWrite },
+    { "memory", NULL, 0, memoryDiscover, memoryOpen, memoryClose, memoryRead, memoryWrite },
+};
+
+static const LedBackend *s_backend = NULL;
+
+/* Selects the backend by name; returns -1 for an unknown one */
+static int ledSelectBackend(const char *name)
+{
+    size_t b;
+    for (b = 0; b < sizeof(LED_BACKENDS) / sizeof(LED_BACKENDS[0]); b++) {
+        if (strcmp(LED_BACKENDS[b].name, name) == 0) {
+            s_backend = &LED_BACKENDS[b];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int readValue(LedDevice *led, LedAttr attr, char *buffer, size_t size);
+
+/* True when the trigger attribute lists name among the available triggers */
+static int ledTriggerAvailable(LedDevice *led, const char *name)
+{
+    char triggers[4096];
+    char *word, *save;
+    if (readValue(led, LED_ATTR_TRIGGER, triggers, sizeof(triggers)) <= 0) {
+        return 0;
+    }
+    for (word = strtok_r(triggers, " []\n", &save); word; word = strtok_r(NULL, " []\n", &save)) {
+        if (strcmp(word, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void ledOpen(LedDevice *led)
+{
+    s_backend->open(led);
+    led->kernelPattern = ledTriggerAvailable(led, "pattern");
+    led->kernelOneshot = ledTriggerAvailable(led, "oneshot");
+}
+
+void ledClose(LedDevice *led)
+{
+    s_backend->close(led);
+}
+
+int writeValue(LedDevice *led, LedAttr attr, const char *value)
+{
+    uint64_t started = ledNow();
+    int result = s_backend->write(led, attr, value, strlen(value));
+    statSysfs(1, started, result != 0);
+    return result;
+}
+
+#define BUFFER_SIZE 1024
+/* Reads an attribute into buffer (NUL terminated); returns the length or -1 */
+int readValue(LedDevice *led, LedAttr attr, char *buffer, size_t size)
+{
+    uint64_t started = ledNow();
+    int result = s_backend->read(led, attr, buffer, size);
+    statSysfs(0, started, result < 0);
+    return result;
+}
+
+int isLedOn(LedDevice *led) {
+    int result = 0;
+    char value[BUFFER_SIZE];
+    if(readValue(led, LED_ATTR_BRIGHTNESS, value, sizeof(value)) > 0 && atoi(value) > 0) {
+        result = 1;
+    }
+    return result;
+}
+
+/*
+ * The trigger attribute lists every trigger with the active one in brackets.
+ * A plain file holds just the last trigger written to it.
+ */
+LedTrigger activeTrigger(LedDevice *led) {
+    LedTrigger result = LED_TRIGGER_OTHER;
+    char trigger[BUFFER_SIZE];
+    if(readValue(led, LED_ATTR_TRIGGER, trigger, sizeof(trigger)) > 0) {
+        char *start = strchr(trigger, '[');
+        char *end = strchr(trigger, ']');
+        if(start && end && end > start) {
+            start++;
+            *end = 0;
+        } else {
+            start = trigger;
+            start[strcspn(start, " \n")] = 0;
+        }
+        if(strcmp(start, "timer") == 0) {
+            result = LED_TRIGGER_TIMER;
+        } else if(strcmp(start, "pattern") == 0 || strcmp(start, "oneshot") == 0) {
+            result = LED_TRIGGER_PATTERN;
+        } else if(strcmp(start, "none") == 0) {
+            result = LED_TRIGGER_NONE;
+        }
+    }
+    return result;
+}
+
+int isBlinking(LedDevice *led) {
+    return activeTrigger(led) == LED_TRIGGER_TIMER;
+}
+
+int blinkFrequency(LedDevice *led) {
+    int result = 0;
+    char frequency[BUFFER_SIZE];
+    if(readValue(led, LED_ATTR_DELAY_ON, frequency, sizeof(frequency)) > 0) {
+        result = atoi(frequency);
+    }
+    return result;
+}
+
+static void ledNotify(LedDevice *led);
+
+/* Called with led->lock held */
+static void ledPublishState(LedDevice *led, const LedState *state)
+{
+    unsigned seq = __atomic_load_n(&led->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&led->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&led->state.brightness, (double *)&state->brightness, __ATOMIC_RELAXED);
+    __atomic_store_n(&led->state.frequency, state->frequency, __ATOMIC_RELAXED);
+    __atomic_store_n(&led->state.trigger, state->trigger, __ATOMIC_RELAXED);
+    __atomic_store_n(&led->seq, seq + 2, __ATOMIC_RELEASE);
+    ledNotify(led);
+}
+
+/* Lock-free snapshot of the shadow state */
+void ledReadState(LedDevice *led, LedState *state)
+{
+    unsigned seq;
+    do {
+        while ((seq = __atomic_load_n(&led->seq, __ATOMIC_ACQUIRE)) & 1) {
+            /* writer in progress */
+        }
+        __atomic_load(&led->state.brightness, &state->brightness, __ATOMIC_RELAXED);
+        state->frequency = __atomic_load_n(&led->state.frequency, __ATOMIC_RELAXED);
+        state->trigger = __atomic_load_n(&led->state.trigger, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&led->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/* Rebuilds the shadow from sysfs; used at startup and when the LED changes behind our back */
+void ledResync(LedDevice *led)
+{
+    LedState state = { 0.0, 0, LED_TRIGGER_NONE };
+    if (__atomic_load_n(&led->softPattern, __ATOMIC_ACQUIRE)) {
+        /* sysfs only shows the current step of a software pattern */
+        return;
+    }
+    pthread_mutex_lock(&led->lock);
+    state.trigger = activeTrigger(led);
+    if(state.trigger == LED_TRIGGER_TIMER) {
+        state.brightness = 1.0;
+        state.frequency = blinkFrequency(led);
+    } else if(isLedOn(led)) {
+        state.brightness = 1.0;
+    }
+    ledPublishState(led, &state);
+    pthread_mutex_unlock(&led->lock);
+}
+
+/*
+ * Writes go through a diff against the shadow state: only attributes whose
+ * value changes are written, in an order the LED class requires.  trigger
+ * goes first, because switching it turns the LED off and, for timer,
+ * recreates delay_on/delay_off with kernel defaults, so everything after a
+ * trigger change is rewritten.  Skipping the trigger write also keeps
+ * repeated identical flash calls from restarting the blink timer.
+ *
+ * --force-writes turns the diff off for setups where something outside the
+ * service changes the LEDs and --watch is not an option.
+ */
+static int s_forceWrites = 0;
+static uint64_t s_attrWrites[LED_ATTR_COUNT];
+static uint64_t s_attrSkips[LED_ATTR_COUNT];
+
+static int ledWriteIf(LedDevice *led, LedAttr attr, int needed, const char *value)
+{
+    if (!needed) {
+        __atomic_fetch_add(&s_attrSkips[attr], 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_fetch_add(&s_attrWrites[attr], 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&led->watch, __ATOMIC_RELAXED) >= 0) {
+        /* the watcher skips these; a trailing truncate is a second IN_MODIFY */
+        led->selfEvents[attr] += led->truncate ? 2 : 1;
+    }
+    return writeValue(led, attr, value);
+}
+
+/* Moves the LED from its shadow state to target; called with led->lock held, returns nonzero on a failed write */
+static int ledApplyState(LedDevice *led, const LedState *target)
+{
+    const LedState *current = &led->state;
+    int force = s_forceWrites || current->trigger != target->trigger;
+    int failed = 0;
+    char frequencyStr[81];
+
+    failed |= ledWriteIf(led, LED_ATTR_TRIGGER, force, LED_TRIGGER_NAMES[target->trigger]);
+    failed |= ledWriteIf(led, LED_ATTR_BRIGHTNESS, force || current->brightness != target->brightness, target->brightness > 0.0 ? "1" : "0");
+    if (target->trigger == LED_TRIGGER_TIMER) {
+        int needed = force || current->frequency != target->frequency;
+        snprintf(frequencyStr, 80, "%u", target->frequency);
+        failed |= ledWriteIf(led, LED_ATTR_DELAY_ON, needed, frequencyStr);
+        failed |= ledWriteIf(led, LED_ATTR_DELAY_OFF, needed, frequencyStr);
+    }
+    return failed;
+}
+
+void ledPrintWriteCounters(void)
+{
+    int attr;
+    printf("sysfs writes:");
+    for (attr = 0; attr < LED_ATTR_COUNT; attr++) {
+        printf(" %s %llu (%llu skipped)", LED_ATTR_NAMES[attr],
+               (unsigned long long)__atomic_load_n(&s_attrWrites[attr], __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&s_attrSkips[attr], __ATOMIC_RELAXED));
+    }
+    printf("\n");
+}
+
+/* Writes state to the LED and publishes it; falls back to a resync when a write fails */
+static void ledWrite(LedDevice *led, const LedState *state)
+{
+    pthread_mutex_lock(&led->lock);
+    if(ledApplyState(led, state)) {
+        pthread_mutex_unlock(&led->lock);
+        ledResync(led);
+        return;
+    }
+    ledPublishState(led, state);
+    pthread_mutex_unlock(&led->lock);
+}
+
+/*
+ * LED writes run on a dedicated writer thread so slow sysfs I/O never holds
+ * up AllJoyn's dispatch thread.  Each LED has a one-slot mailbox holding the
+ * latest requested state, packed into one word so handlers can replace it
+ * with a compare-and-swap:
+ *
+ *     bit 63 full | bit 62 on | bits 60-61 trigger | bits 32-59 ticket | bits 0-31 frequency
+ *
+ * A handler that finds the mailbox already full has just overwritten a
+ * command the writer never saw (counted as coalesced); otherwise it pushes
+ * the LED onto a lock-free stack that the writer drains in one exchange.
+ * Tickets grow with every store into the mailbox, and the writer records
+ * the ticket of each state it applies, so --sync-writes handlers can wait
+ * until their command, or a later one that replaced it, reached the LED.
+ */
+#define LED_MAIL_FULL      (1ull << 63)
+#define LED_MAIL_ON        (1ull << 62)
+#define LED_MAIL_TICKET(w) ((uint32_t)((w) >> 32) & 0x0fffffffu)
+
+static int s_syncWrites = 0;
+static LedDevice *s_writeQueue = NULL;
+static uint64_t s_coalesced = 0;
+static int s_writerFd = -1;
+static int s_writerStop = 0;
+static pthread_t s_writerThread;
+static pthread_mutex_t s_ackLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_ackCond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t ledPack(const LedState *state, uint32_t ticket)
+{
+    return LED_MAIL_FULL | (state->brightness > 0.0 ? LED_MAIL_ON : 0) | ((uint64_t)state->trigger << 60) |
+           ((uint64_t)(ticket & 0x0fffffffu) << 32) | state->frequency;
+}
+
+static void ledUnpack(uint64_t word, LedState *state)
+{
+    state->brightness = (word & LED_MAIL_ON) ? 1.0 : 0.0;
+    state->trigger = (LedTrigger)((word >> 60) & 3);
+    state->frequency = (uint32_t)word;
+}
+
+/* True once the writer has applied ticket or a later one (28-bit wrapping compare) */
+static int ledAcked(LedDevice *led, uint32_t ticket)
+{
+    uint32_t applied = __atomic_load_n(&led->applied, __ATOMIC_ACQUIRE);
+    return ((applied - ticket) & 0x0fffffffu) < 0x08000000u;
+}
+
+/*
+ * Patterns run on the writer thread too.  The kernel pattern trigger takes the
+ * whole sequence, oneshot covers a single on/off blink, and anything else is
+ * stepped in software from a timerfd armed for the earliest step due across
+ * all LEDs.  Steps are scheduled on absolute deadlines so lateness does not
+ * accumulate; how late each step is written is kept as a jitter measure.
+ */
+static int s_timerFd = -1;
+static uint64_t s_stepCount = 0;
+static uint64_t s_stepLateSumNs = 0;
+static uint64_t s_stepLateMaxNs = 0;
+
+/* Scales a 0..1 brightness to the LED's range; anything above 0 stays visibly on */
+static unsigned ledLevel(const LedDevice *led, double brightness)
+{
+    unsigned level;
+    if (brightness <= 0.0) {
+        return 0;
+    }
+    if (brightness >= 1.0) {
+        return led->maxBrightness;
+    }
+    level = (unsigned)(brightness * led->maxBrightness + 0.5);
+    return level ? level : 1;
+}
+
+static LedEngine ledPatternEngine(const LedDevice *led, const LedPattern *pattern)
+{
+    if (led->kernelPattern) {
+        return LED_ENGINE_PATTERN;
+    }
+    /* oneshot blinks at the kernel's blink brightness, so only a full-on step can use it */
+    if (led->kernelOneshot && pattern->repeat == 1 && pattern->numSteps == 2 &&
+        pattern->steps[0].brightness >= 1.0 && pattern->steps[1].brightness <= 0.0) {
+        return LED_ENGINE_ONESHOT;
+    }
+    return LED_ENGINE_SOFTWARE;
+}
+
+static uint64_t ledPatternPeriodMs(const LedPattern *pattern)
+{
+    uint64_t period = 0;
+    size_t i;
+    for (i = 0; i < pattern->numSteps; i++) {
+        period += pattern->steps[i].duration;
+    }
+    return period;
+}
+
+/* Forgets the running pattern; the LED keeps its output until the next write */
+static void ledStopPattern(LedDevice *led)
+{
+    __atomic_store_n(&led->softPattern, 0, __ATOMIC_RELEASE);
+    free(led->run.pattern);
+    led->run.pattern = NULL;
+}
+
+/* Starts the pattern waiting in the LED's slot */
+static void ledStartPattern(LedDevice *led)
+{
+    LedPattern *pattern = __atomic_exchange_n(&led->pattern, NULL, __ATOMIC_ACQ_REL);
+    LedState state = { 0.0, 0, LED_TRIGGER_PATTERN };
+    char value[LED_PATTERN_MAX_STEPS * 40];
+    size_t i, len = 0;
+    int failed = 0;
+
+    if (!pattern) {
+        /* a later pattern took this slot and is already running */
+        return;
+    }
+    ledStopPattern(led);
+    for (i = 0; i < pattern->numSteps; i++) {
+        if (pattern->steps[i].brightness > state.brightness) {
+            state.brightness = pattern->steps[i].brightness;
+        }
+    }
+
+    led->run.engine = ledPatternEngine(led, pattern);
+    pthread_mutex_lock(&led->lock);
+    switch (led->run.engine) {
+    case LED_ENGINE_PATTERN:
+        /* "level duration level 0" holds each level instead of ramping to the next */
+        for (i = 0; i < pattern->numSteps; i++) {
+            unsigned level = ledLevel(led, pattern->steps[i].brightness);
+            len += snprintf(value + len, sizeof(value) - len, "%u %u %u 0 ", level, pattern->steps[i].duration, level);
+        }
+        failed |= ledWriteIf(led, LED_ATTR_TRIGGER, 1, "pattern");
+        failed |= ledWriteIf(led, LED_ATTR_PATTERN, 1, value);
+        snprintf(value, sizeof(value), "%d", pattern->repeat ? (int)pattern->repeat : -1);
+        failed |= ledWriteIf(led, LED_ATTR_REPEAT, 1, value);
+        break;
+    case LED_ENGINE_ONESHOT:
+        failed |= ledWriteIf(led, LED_ATTR_TRIGGER, 1, "oneshot");
+        snprintf(value, sizeof(value), "%u", pattern->steps[0].duration);
+        failed |= ledWriteIf(led, LED_ATTR_DELAY_ON, 1, value);
+        snprintf(value, sizeof(value), "%u", pattern->steps[1].duration);
+        failed |= ledWriteIf(led, LED_ATTR_DELAY_OFF, 1, value);
+        failed |= ledWriteIf(led, LED_ATTR_SHOT, 1, "1");
+        break;
+    case LED_ENGINE_SOFTWARE:
+        failed |= ledWriteIf(led, LED_ATTR_TRIGGER, led->state.trigger != LED_TRIGGER_NONE, "none");
+        snprintf(value, sizeof(value), "%u", ledLevel(led, pattern->steps[0].brightness));
+        failed |= ledWriteIf(led, LED_ATTR_BRIGHTNESS, 1, value);
+        break;
+    }
+    if (failed) {
+        pthread_mutex_unlock(&led->lock);
+        free(pattern);
+        ledResync(led);
+        return;
+    }
+    ledPublishState(led, &state);
+    pthread_mutex_unlock(&led->lock);
+
+    led->run.step = 0;
+    led->run.pass = 0;
+    if (led->run.engine == LED_ENGINE_SOFTWARE) {
+        led->run.pattern = pattern;
+        led->run.deadline = ledNow() + pattern->steps[0].duration * 1000000ull;
+        __atomic_store_n(&led->softPattern, 1, __ATOMIC_RELEASE);
+    } else if (pattern->repeat) {
+        /* the kernel leaves the trigger set once it is done; switch it off then */
+        led->run.pattern = pattern;
+        led->run.deadline = ledNow() + ledPatternPeriodMs(pattern) * pattern->repeat * 1000000ull;
+    } else {
+        free(pattern);
+    }
+}
+
+/* Advances a pattern whose deadline has passed; steps missed entirely are skipped */
+static void ledPatternTick(LedDevice *led, uint64_t now)
+{
+    LedRun *run = &led->run;
+    LedPattern *pattern = run->pattern;
+    uint64_t late = now - run->deadline;
+    char value[16];
+
+    if (run->engine != LED_ENGINE_SOFTWARE) {
+        /* end like a software pattern does, or status keeps reporting the finished pattern */
+        LedState off = { 0.0, 0, LED_TRIGGER_NONE };
+        ledStopPattern(led);
+        ledWrite(led, &off);
+        return;
+    }
+    /* only this thread writes them; the stores are atomic for the stats readers */
+    statAdd(&s_stepCount, 1);
+    statAdd(&s_stepLateSumNs, late);
+    if (late > s_stepLateMaxNs) {
+        __atomic_store_n(&s_stepLateMaxNs, late, __ATOMIC_RELAXED);
+    }
+    while (run->deadline <= now) {
+        if (++run->step == pattern->numSteps) {
+            run->step = 0;
+            if (pattern->repeat && ++run->pass == pattern->repeat) {
+                LedState off = { 0.0, 0, LED_TRIGGER_NONE };
+                ledStopPattern(led);
+                ledWrite(led, &off);
+                return;
+            }
+        }
+        run->deadline += pattern->steps[run->step].duration * 1000000ull;
+    }
+    snprintf(value, sizeof(value), "%u", ledLevel(led, pattern->steps[run->step].brightness));
+    pthread_mutex_lock(&led->lock);
+    ledWriteIf(led, LED_ATTR_BRIGHTNESS, 1, value);
+    pthread_mutex_unlock(&led->lock);
+}
+
+/* Runs every pattern step that is due and arms the timer for the next one */
+static void ledRunPatterns(void)
+{
+    struct itimerspec when;
+    uint64_t now = ledNow();
+    uint64_t next = 0;
+    size_t i;
+
+    for (i = 0; i < g_ledCount; i++) {
+        LedDevice *led = &g_leds[i];
+        if (led->run.pattern && led->run.deadline <= now) {
+            ledPatternTick(led, now);
+        }
+        if (led->run.pattern && (next == 0 || led->run.deadline < next)) {
+            next = led->run.deadline;
+        }
+    }
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = next / 1000000000ull;
+    when.it_value.tv_nsec = next % 1000000000ull;
+    timerfd_settime(s_timerFd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+static void *ledWriterThread(void *arg)
+{
+    LedDevice **batch = (LedDevice **)calloc(g_ledCount, sizeof(LedDevice *));
+    struct pollfd fds[2];
+    LedDevice *led;
+    size_t n;
+    uint64_t wakeups;
+
+    fds[0].fd = s_writerFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = s_timerFd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        led = __atomic_exchange_n(&s_writeQueue, NULL, __ATOMIC_ACQUIRE);
+        /* an LED is on the stack at most once while its mailbox is full, so g_ledCount slots suffice */
+        for (n = 0; led && n < g_ledCount; led = led->next) {
+            batch[n++] = led;
+        }
+        /* the stack is newest first; write in arrival order */
+        while (n > 0) {
+            LedState state;
+            uint64_t word;
+            led = batch[--n];
+            word = __atomic_fetch_and(&led->mailbox, ~LED_MAIL_FULL, __ATOMIC_ACQ_REL);
+            if (!(word & LED_MAIL_FULL)) {
+                continue;
+            }
+            ledUnpack(word, &state);
+            if (state.trigger == LED_TRIGGER_PATTERN) {
+                ledStartPattern(led);
+            } else {
+                ledStopPattern(led);
+                ledWrite(led, &state);
+            }
+            __atomic_store_n(&led->applied, LED_MAIL_TICKET(word), __ATOMIC_RELEASE);
+        }
+        if (s_syncWrites) {
+            pthread_mutex_lock(&s_ackLock);
+            pthread_cond_broadcast(&s_ackCond);
+            pthread_mutex_unlock(&s_ackLock);
+        }
+        ledRunPatterns();
+
+        if (__atomic_load_n(&s_writeQueue, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (__atomic_load_n(&s_writerStop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) && read(s_writerFd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) {
+            break;
+        }
+        if ((fds[1].revents & POLLIN) && read(s_timerFd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) {
+            break;
+        }
+    }
+    free(batch);
+    return NULL;
+}
+
+/* Queues state for the LED, replacing any command still waiting; waits for the write with --sync-writes */
+static void ledSubmit(LedDevice *led, const LedState *state)
+{
+    uint64_t old, word;
+    LedDevice *head;
+
+    if (s_writerFd < 0) {
+        /* no writer thread: write inline */
+        ledWrite(led, state);
+        return;
+    }
+    old = __atomic_load_n(&led->mailbox, __ATOMIC_RELAXED);
+    do {
+        word = ledPack(state, LED_MAIL_TICKET(old) + 1);
+    } while (!__atomic_compare_exchange_n(&led->mailbox, &old, word, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (old & LED_MAIL_FULL) {
+        __atomic_fetch_add(&s_coalesced, 1, __ATOMIC_RELAXED);
+    } else {
+        head = __atomic_load_n(&s_writeQueue, __ATOMIC_RELAXED);
+        do {
+            led->next = head;
+        } while (!__atomic_compare_exchange_n(&s_writeQueue, &head, led, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        if (!head) {
+            uint64_t one = 1;
+            if (write(s_writerFd, &one, sizeof(one)) != sizeof(one)) {
+                printf("Failed to wake the LED writer\n");
+            }
+        }
+    }
+
+    if (s_syncWrites) {
+        uint32_t ticket = LED_MAIL_TICKET(word);
+        pthread_mutex_lock(&s_ackLock);
+        while (!ledAcked(led, ticket)) {
+            pthread_cond_wait(&s_ackCond, &s_ackLock);
+        }
+        pthread_mutex_unlock(&s_ackLock);
+    }
+}
+
+int ledStartWriter(void)
+{
+    s_writerFd = eventfd(0, EFD_CLOEXEC);
+    if (s_writerFd < 0) {
+        return -1;
+    }
+    s_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (s_timerFd < 0 || pthread_create(&s_writerThread, NULL, ledWriterThread, NULL) != 0) {
+        if (s_timerFd >= 0) {
+            close(s_timerFd);
+            s_timerFd = -1;
+        }
+        close(s_writerFd);
+        s_writerFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Drains the queue and stops the writer thread */
+void ledStopWriter(void)
+{
+    uint64_t one = 1;
+    size_t i;
+    if (s_writerFd < 0) {
+        return;
+    }
+    __atomic_store_n(&s_writerStop, 1, __ATOMIC_RELEASE);
+    if (write(s_writerFd, &one, sizeof(one)) != sizeof(one)) {
+        printf("Failed to stop the LED writer\n");
+    }
+    pthread_join(s_writerThread, NULL);
+    close(s_writerFd);
+    s_writerFd = -1;
+    close(s_timerFd);
+    s_timerFd = -1;
+    for (i = 0; i < g_ledCount; i++) {
+        ledStopPattern(&g_leds[i]);
+        free(__atomic_exchange_n(&g_leds[i].pattern, NULL, __ATOMIC_ACQ_REL));
+    }
+    printf("LED commands coalesced: %llu\n", (unsigned long long)__atomic_load_n(&s_coalesced, __ATOMIC_RELAXED));
+    if (s_stepCount) {
+        printf("Software pattern steps: %llu, lateness mean %llu us, max %llu us\n", (unsigned long long)s_stepCount,
+               (unsigned long long)(s_stepLateSumNs / s_stepCount / 1000), (unsigned long long)(s_stepLateMaxNs / 1000));
+    }
+}
+
+/* The state enable/disable requests translate to */
+static void ledTargetState(double brightness, uint32_t frequency, LedState *state)
+{
+    state->brightness = brightness > 0.0 ? 1.0 : 0.0;
+    state->frequency = brightness > 0.0 ? frequency : 0;
+    state->trigger = state->frequency ? LED_TRIGGER_TIMER : LED_TRIGGER_NONE;
+}
+
+void enableLed(LedDevice *led, double intensity, int frequency) {
+    LedState state;
+    ledTargetState(1.0, frequency, &state);
+    ledSubmit(led, &state);
+}
+
+void disableLed(LedDevice *led) {
+    LedState state;
+    ledTargetState(0.0, 0, &state);
+    ledSubmit(led, &state);
+}
+
+/* Queues a pattern, replacing one not yet started; the writer thread takes it from the LED's slot */
+void patternLed(LedDevice *led, LedPattern *pattern) {
+    LedState state = { 0.0, 0, LED_TRIGGER_PATTERN };
+    free(__atomic_exchange_n(&led->pattern, pattern, __ATOMIC_ACQ_REL));
+    ledSubmit(led, &state);
+}
+
+/*
+ * Optional watcher (--watch): resyncs the shadow when something outside the
+ * service writes to an LED.  inotify on each LED directory reports writes to
+ * any attribute, including our own, so every write the service makes is
+ * counted in selfEvents under led->lock and the watcher takes one count per
+ * IN_MODIFY on that attribute instead of resyncing.  The kernel queues the
+ * event before the write returns, so once the queue is empty while we hold
+ * the lock any count left over belongs to events inotify merged, and is
+ * dropped.  An event nobody counted just costs a resync.
+ */
+static pthread_t s_watchThread;
+static int s_watchStopFd[2] = { -1, -1 };
+
+/* True when event was raised by one of the service's own writes to led */
+static int ledOwnEvent(LedDevice *led, const struct inotify_event *event)
+{
+    int attr, own = 0;
+    if (!(event->mask & IN_MODIFY) || event->len == 0) {
+        return 0;
+    }
+    for (attr = 0; attr < LED_ATTR_COUNT; attr++) {
+        if (strcmp(event->name, LED_ATTR_NAMES[attr]) == 0) {
+            pthread_mutex_lock(&led->lock);
+            if (led->selfEvents[attr] > 0) {
+                led->selfEvents[attr]--;
+                own = 1;
+            }
+            pthread_mutex_unlock(&led->lock);
+            break;
+        }
+    }
+    return own;
+}
+
+/* Drops counts whose events will never come; see above */
+static void ledDropSelfEvents(LedDevice *leds, int inotifyFd)
+{
+    size_t i;
+    for (i = 0; i < g_ledCount; i++) {
+        int queued = 0;
+        pthread_mutex_lock(&leds[i].lock);
+        if (ioctl(inotifyFd, FIONREAD, &queued) == 0 && queued == 0) {
+            memset(leds[i].selfEvents, 0, sizeof(leds[i].selfEvents));
+        }
+        pthread_mutex_unlock(&leds[i].lock);
+    }
+}
+
+static void *ledWatchThread(void *arg)
+{
+    LedDevice *leds = (LedDevice *)arg;
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    size_t i;
+    int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        printf("inotify_init1 failed (%s)\n", strerror(errno));
+        return NULL;
+    }
+    fds[0].fd = s_watchStopFd[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = inotifyFd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        int missing = 0;
+        for (i = 0; i < g_ledCount; i++) {
+            if (leds[i].watch < 0) {
+                __atomic_store_n(&leds[i].watch, inotify_add_watch(inotifyFd, leds[i].dir, IN_MODIFY | IN_CREATE | IN_DELETE_SELF),
+                                 __ATOMIC_RELAXED);
+                if (leds[i].watch >= 0) {
+                    /* the device (re)appeared */
+                    ledResync(&leds[i]);
+                } else {
+                    missing = 1;
+                }
+            }
+        }
+        /* while a device is gone retry its watch once a second */
+        if (poll(fds, 2, missing ? 1000 : -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            ssize_t len;
+            while ((len = read(inotifyFd, events, sizeof(events))) > 0) {
+                char *p = events;
+                while (p < events + len) {
+                    struct inotify_event *event = (struct inotify_event *)p;
+                    for (i = 0; i < g_ledCount; i++) {
+                        if (leds[i].watch == event->wd) {
+                            if (event->mask & IN_IGNORED) {
+                                __atomic_store_n(&leds[i].watch, -1, __ATOMIC_RELAXED);
+                            } else if (!ledOwnEvent(&leds[i], event)) {
+                                ledResync(&leds[i]);
+                            }
+                            break;
+                        }
+                    }
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+            ledDropSelfEvents(leds, inotifyFd);
+        }
+    }
+    close(inotifyFd);
+    return NULL;
+}
+
+int ledStartWatcher(LedDevice *leds)
+{
+    if (pipe(s_watchStopFd) != 0) {
+        return -1;
+    }
+    if (pthread_create(&s_watchThread, NULL, ledWatchThread, leds) != 0) {
+        close(s_watchStopFd[0]);
+        close(s_watchStopFd[1]);
+        s_watchStopFd[0] = s_watchStopFd[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void ledStopWatcher(void)
+{
+    if (s_watchStopFd[1] >= 0) {
+        if (write(s_watchStopFd[1], "x", 1) != 1) {
+            printf("Failed to stop the LED watcher\n");
+        }
+        pthread_join(s_watchThread, NULL);
+        close(s_watchStopFd[0]);
+        close(s_watchStopFd[1]);
+        s_watchStopFd[0] = s_watchStopFd[1] = -1;
+    }
+}
+/****** LED CONTROL ******/
+
+/****** LED REGISTRY ******/
+/*
+ * Every LED under the root directory gets its own bus object at
+ * OBJECT_PATH/<function>, e.g. /beagle/usr0 for beaglebone:green:usr0, and
+ * OBJECT_PATH itself stays an alias for the default LED.  Method handlers map
+ * the object path back to the LED through an open-addressed hash table.
+ */
+static LedDevice *g_defaultLed = NULL;
+
+typedef struct {
+    const char *path;
+    LedDevice *led;
+} LedSlot;
+
+static LedSlot *s_ledTable = NULL;
+static size_t s_ledTableMask = 0;
+
+static uint32_t ledHash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static void ledTableInsert(const char *path, LedDevice *led)
+{
+    size_t i = ledHash(path) & s_ledTableMask;
+    while (s_ledTable[i].path) {
+        i = (i + 1) & s_ledTableMask;
+    }
+    s_ledTable[i].path = path;
+    s_ledTable[i].led = led;
+}
+
+LedDevice *ledLookup(const char *path)
+{
+    size_t i;
+    if (!path || !s_ledTable) {
+        return NULL;
+    }
+    for (i = ledHash(path) & s_ledTableMask; s_ledTable[i].path; i = (i + 1) & s_ledTableMask) {
+        if (strcmp(s_ledTable[i].path, path) == 0) {
+            return s_ledTable[i].led;
+        }
+    }
+    return NULL;
+}
+
+static int compareLedNames(const void *a, const void *b)
+{
+    return strcmp(((const LedDevice *)a)->name, ((const LedDevice *)b)->name);
+}
+
+/* Object path element for an LED: the part after the last ':' with anything outside [A-Za-z0-9_] replaced */
+static void ledObjectPath(LedDevice *led, int useFullName)
+{
+    const char *label = strrchr(led->name, ':');
+    char *p;
+    label = (label && label[1] && !useFullName) ? label + 1 : led->name;
+    snprintf(led->path, sizeof(led->path), "%s/%s", OBJECT_PATH, label);
+    for (p = led->path + strlen(OBJECT_PATH) + 1; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_') {
+            *p = '_';
+        }
+    }
+}
+
+/* Enumerates the LEDs under root, opens them and builds the path table */
+/* root may be NULL for the backend's default */
+int ledRegistryCreate(const char *root, const char *defaultName)
+{
+    size_t i, j;
+
+    if (!root) {
+        root = s_backend->defaultRoot;
+    }
+    if (s_backend->discover(root) != 0) {
+        return -1;
+    }
+    if (g_ledCount == 0) {
+        printf("No LEDs found under %s\n", root ? root : s_backend->name);
+        return -1;
+    }
+    qsort(g_leds, g_ledCount, sizeof(LedDevice), compareLedNames);
+
+    for (s_ledTableMask = 1; s_ledTableMask < 2 * (g_ledCount + 1); s_ledTableMask <<= 1) {
+    }
+    s_ledTable = (LedSlot *)calloc(s_ledTableMask, sizeof(LedSlot));
+    s_ledTableMask--;
+    if (!s_ledTable) {
+        return -1;
+    }
+
+    for (i = 0; i < g_ledCount; i++) {
+        LedDevice *led = &g_leds[i];
+        for (j = 0; j < LED_ATTR_COUNT; j++) {
+            led->fds[j] = -1;
+        }
+        led->watch = -1;
+        pthread_mutex_init(&led->lock, NULL);
+        ledObjectPath(led, 0);
+        if (ledLookup(led->path)) {
+            /* two LEDs share a function name, fall back to the full name */
+            ledObjectPath(led, 1);
+        }
+        ledTableInsert(led->path, led);
+        ledOpen(led);
+        ledResync(led);
+        if (strcmp(led->name, defaultName) == 0) {
+            g_defaultLed = led;
+        }
+        printf("LED %s at %s\n", led->name, led->path);
+    }
+    if (!g_defaultLed) {
+        g_defaultLed = &g_leds[0];
+    }
+    ledTableInsert(OBJECT_PATH, g_defaultLed);
+    printf("LED %s at %s\n", g_defaultLed->name, OBJECT_PATH);
+    return 0;
+}
+
+void ledRegistryDestroy(void)
+{
+    size_t i;
+    for (i = 0; i < g_ledCount; i++) {
+        ledClose(&g_leds[i]);
+        pthread_mutex_destroy(&g_leds[i].lock);
+    }
+    free(s_ledTable);
+    free(g_leds);
+    s_ledTable = NULL;
+    g_leds = NULL;
+    g_ledCount = 0;
+    s_ledCapacity = 0;
+    g_defaultLed = NULL;
+}
+/****** LED REGISTRY ******/
+
+/****** STATE NOTIFIER ******/
+/*
+ * Sends stateChanged to every joined session when an LED's shadow state
+ * really changes.  Publishing only marks the LED dirty; the notifier thread
+ * compares the shadow with what it last sent and emits at most once per LED
+ * per coalescing window, so a burst of flash calls costs subscribers one
+ * signal carrying the final state.
+ */
+static unsigned s_coalesceMs = 100;
+static alljoyn_interfacedescription_member s_stateChangedMember;
+static pthread_t s_notifyThread;
+static pthread_mutex_t s_notifyLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_notifyCond = PTHREAD_COND_INITIALIZER;
+static int s_notifyPending = 0;
+static int s_notifyRunning = 0;
+static int s_notifyStop = 0;
+
+/* Sessions joined to SERVICE_PORT, the audience for stateChanged */
+static pthread_mutex_t s_sessionLock = PTHREAD_MUTEX_INITIALIZER;
+static alljoyn_sessionid *s_sessions = NULL;
+static size_t s_numSessions = 0;
+static size_t s_maxSessions = 0;
+/* Joins accepted under --max-sessions whose SessionJoined has not come yet */
+static size_t s_reservedSessions = 0;
+static uint64_t s_reservedAt = 0;
+
+static void sessionAdd(alljoyn_sessionid id)
+{
+    pthread_mutex_lock(&s_sessionLock);
+    if (s_reservedSessions > 0) {
+        s_reservedSessions--;
+    }
+    if (s_numSessions == s_maxSessions) {
+        size_t capacity = s_maxSessions ? s_maxSessions * 2 : 8;
+        alljoyn_sessionid *grown = (alljoyn_sessionid *)realloc(s_sessions, capacity * sizeof(alljoyn_sessionid));
+        if (grown) {
+            s_sessions = grown;
+            s_maxSessions = capacity;
+        }
+    }
+    if (s_numSessions < s_maxSessions) {
+        s_sessions[s_numSessions++] = id;
+    }
+    pthread_mutex_unlock(&s_sessionLock);
+}
+
+static void sessionRemove(alljoyn_sessionid id)
+{
+    size_t i;
+    pthread_mutex_lock(&s_sessionLock);
+    for (i = 0; i < s_numSessions; i++) {
+        if (s_sessions[i] == id) {
+            s_sessions[i] = s_sessions[--s_numSessions];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_sessionLock);
+}
+
+/* Called from ledPublishState; only the first change since the last pass wakes the notifier */
+static void ledNotify(LedDevice *led)
+{
+    if (__atomic_exchange_n(&led->dirty, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    pthread_mutex_lock(&s_notifyLock);
+    s_notifyPending = 1;
+    pthread_cond_signal(&s_notifyCond);
+    pthread_mutex_unlock(&s_notifyLock);
+}
+
+/*
+ * Copies the session list into s_emitSessions, which only the notifier
+ * thread uses, so signals go out without s_sessionLock held and a slow send
+ * cannot stall joins, session loss or stats.  Returns the number copied.
+ */
+static alljoyn_sessionid *s_emitSessions = NULL;
+static size_t s_emitCapacity = 0;
+
+static size_t sessionSnapshot(void)
+{
+    size_t count;
+    pthread_mutex_lock(&s_sessionLock);
+    if (s_numSessions > s_emitCapacity) {
+        alljoyn_sessionid *grown = (alljoyn_sessionid *)realloc(s_emitSessions, s_maxSessions * sizeof(alljoyn_sessionid));
+        if (grown) {
+            s_emitSessions = grown;
+            s_emitCapacity = s_maxSessions;
+        }
+    }
+    count = s_numSessions < s_emitCapacity ? s_numSessions : s_emitCapacity;
+    if (count > 0) {
+        memcpy(s_emitSessions, s_sessions, count * sizeof(alljoyn_sessionid));
+    }
+    pthread_mutex_unlock(&s_sessionLock);
+    return count;
+}
+
+/* Sends PropertiesChanged for the properties that differ between previous and state */
+static void ledEmitProperties(alljoyn_busobject busObj, const LedState *previous, const LedState *state, alljoyn_sessionid session)
+{
+    alljoyn_msgarg value = alljoyn_msgarg_create();
+    if (state->brightness != previous->brightness && ER_OK == alljoyn_msgarg_set(value, "d", state->brightness)) {
+        alljoyn_busobject_emitpropertychanged(busObj, INTERFACE_NAME, "Brightness", value, session);
+    }
+    alljoyn_msgarg_clear(value);
+    if (state->frequency != previous->frequency && ER_OK == alljoyn_msgarg_set(value, "u", state->frequency)) {
+        alljoyn_busobject_emitpropertychanged(busObj, INTERFACE_NAME, "Frequency", value, session);
+    }
+    alljoyn_msgarg_clear(value);
+    if (state->trigger != previous->trigger && ER_OK == alljoyn_msgarg_set(value, "s", LED_TRIGGER_NAMES[state->trigger])) {
+        alljoyn_busobject_emitpropertychanged(busObj, INTERFACE_NAME, "Trigger", value, session);
+    }
+    alljoyn_msgarg_destroy(value);
+}
+
+static void ledEmitState(LedDevice *led, const LedState *previous, const LedState *state)
+{
+    QStatus status;
+    alljoyn_msgarg args;
+    size_t numArgs = 4;
+    size_t i;
+    const char *id = led->path + strlen(OBJECT_PATH) + 1;
+
+    args = alljoyn_msgarg_array_create(numArgs);
+    status = alljoyn_msgarg_array_set(args, &numArgs, "sdus", id, state->brightness, state->frequency, LED_TRIGGER_NAMES[state->trigger]);
+    if (ER_OK != status) {
+        printf("stateChanged: Arg assignment failed: %s\n", QCC_StatusText(status));
+    } else {
+        /* a session lost meanwhile just fails its send */
+        size_t numSessions = sessionSnapshot();
+        for (i = 0; i < numSessions; i++) {
+            status = alljoyn_busobject_signal(led->busObj, NULL, s_emitSessions[i], s_stateChangedMember, args, numArgs, 0, 0);
+            if (ER_OK != status) {
+                printf("stateChanged: Failed to signal session %u (%s)\n", s_emitSessions[i], QCC_StatusText(status));
+            }
+            /* keep clients' property caches current, including those of proxies on the alias */
+            ledEmitProperties(led->busObj, previous, state, s_emitSessions[i]);
+            if (led == g_defaultLed && s_aliasObj) {
+                ledEmitProperties(s_aliasObj, previous, state, s_emitSessions[i]);
+            }
+        }
+    }
+    alljoyn_msgarg_destroy(args);
+}
+
+static void *ledNotifyThread(void *arg)
+{
+    size_t i;
+    pthread_mutex_lock(&s_notifyLock);
+    while (!s_notifyStop) {
+        struct timespec until;
+        if (!s_notifyPending) {
+            pthread_cond_wait(&s_notifyCond, &s_notifyLock);
+            continue;
+        }
+        s_notifyPending = 0;
+        pthread_mutex_unlock(&s_notifyLock);
+
+        for (i = 0; i < g_ledCount; i++) {
+            LedDevice *led = &g_leds[i];
+            LedState state;
+            if (!__atomic_exchange_n(&led->dirty, 0, __ATOMIC_ACQ_REL)) {
+                continue;
+            }
+            ledReadState(led, &state);
+            if (state.brightness != led->emitted.brightness || state.frequency != led->emitted.frequency ||
+                state.trigger != led->emitted.trigger) {
+                LedState previous = led->emitted;
+                led->emitted = state;
+                ledEmitState(led, &previous, &state);
+            }
+        }
+
+        /* changes during the window are folded into the next pass */
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += s_coalesceMs / 1000;
+        until.tv_nsec += (long)(s_coalesceMs % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&s_notifyLock);
+        while (!s_notifyStop && pthread_cond_timedwait(&s_notifyCond, &s_notifyLock, &until) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&s_notifyLock);
+    return NULL;
+}
+
+/* Starts emitting stateChanged; the LEDs' current state is the baseline */
+int ledStartNotifier(alljoyn_interfacedescription_member member)
+{
+    size_t i;
+    s_stateChangedMember = member;
+    for (i = 0; i < g_ledCount; i++) {
+        ledReadState(&g_leds[i], &g_leds[i].emitted);
+        __atomic_store_n(&g_leds[i].dirty, 0, __ATOMIC_RELEASE);
+    }
+    if (pthread_create(&s_notifyThread, NULL, ledNotifyThread, NULL) != 0) {
+        return -1;
+    }
+    s_notifyRunning = 1;
+    return 0;
+}
+
+void ledStopNotifier(void)
+{
+    if (s_notifyRunning) {
+        pthread_mutex_lock(&s_notifyLock);
+        s_notifyStop = 1;
+        pthread_cond_signal(&s_notifyCond);
+        pthread_mutex_unlock(&s_notifyLock);
+        pthread_join(s_notifyThread, NULL);
+        s_notifyRunning = 0;
+    }
+    free(s_emitSessions);
+    s_emitSessions = NULL;
+    s_emitCapacity = 0;
+}
+
+/* Drops the session list; only once the bus is destroyed can no session callback still add to it */
+void ledFreeSessions(void)
+{
+    pthread_mutex_lock(&s_sessionLock);
+    free(s_sessions);
+    s_sessions = NULL;
+    s_numSessions = s_maxSessions = 0;
+    s_reservedSessions = 0;
+    pthread_mutex_unlock(&s_sessionLock);
+}
+/****** STATE NOTIFIER ******/
+
+/****** GROUP COMMANDS ******/
+/*
+ * groupCommand is a sessionless signal, so one emission from led_client
+ * broadcast reaches every service on the bus without a session join.  A
+ * service applies it to its default LED when it was started with --group for
+ * that group, or when the group is "*": brightness 0 turns the LED off,
+ * frequency 0 turns it on and anything else makes it flash.  Applied signals
+ * are counted as the "group" method in stats.
+ */
+#define LED_MAX_GROUPS 16
+static const char *s_groups[LED_MAX_GROUPS];
+static size_t s_numGroups = 0;
+static alljoyn_interfacedescription_member s_groupMember;
+static int s_groupRunning = 0;
+static const char *GROUP_MATCH_RULE = "type='signal',interface='org.alljoyn.sample.ledcontroller',member='groupCommand',sessionless='t'";
+
+static int ledInGroup(const char *group)
+{
+    size_t i;
+    if (strcmp(group, "*") == 0) {
+        return 1;
+    }
+    for (i = 0; i < s_numGroups; i++) {
+        if (strcmp(s_groups[i], group) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void group_command(const alljoyn_interfacedescription_member* member, const char* srcPath, alljoyn_message msg)
+{
+    uint64_t started = ledNow();
+    char *group = NULL;
+    double brightness = 0.0;
+    uint32_t frequency = 0;
+
+    if (ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "s", &group) ||
+        ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 1), "d", &brightness) ||
+        ER_OK != alljoyn_msgarg_get(alljoyn_message_getarg(msg, 2), "u", &frequency)) {
+        statMethodDone(STAT_GROUP, started, ER_INVALID_DATA);
+        return;
+    }
+    if (!g_defaultLed || !ledInGroup(group)) {
+        return;
+    }
+    if (brightness > 0.0) {
+        enableLed(g_defaultLed, brightness, frequency);
+    } else {
+        disableLed(g_defaultLed);
+    }
+    statMethodDone(STAT_GROUP, started, ER_OK);
+}
+
+/* Subscribes to groupCommand; the bus has to be connected for the match rule */
+QStatus ledStartGroups(alljoyn_interfacedescription_member member)
+{
+    QStatus status;
+    s_groupMember = member;
+    status = alljoyn_busattachment_registersignalhandler(g_msgBus, group_command, member, NULL);
+    if (ER_OK == status) {
+        status = alljoyn_busattachment_addmatch(g_msgBus, GROUP_MATCH_RULE);
+        if (ER_OK != status) {
+            alljoyn_busattachment_unregistersignalhandler(g_msgBus, group_command, member, NULL);
+        }
+    }
+    s_groupRunning = ER_OK == status;
+    return status;
+}
+
+void ledStopGroups(void)
+{
+    if (s_groupRunning) {
+        alljoyn_busattachment_removematch(g_msgBus, GROUP_MATCH_RULE);
+        alljoyn_busattachment_unregistersignalhandler(g_msgBus, group_command, s_groupMember, NULL);
+        s_groupRunning = 0;
+    }
+}
+/****** GROUP COMMANDS ******/
+
+/****** ADMISSION ******/
+/*
+ * Limits on what joiners may use, all off by default:
+ *   --max-sessions  joins beyond this many live sessions are refused
+ *   --rate          token bucket per joiner (sender unique name) on method calls
+ *   --global-rate   token bucket shared by every caller
+ * A call over either rate is answered ER_BUSY straight away rather than
+ * queued.  stats is exempt so the counters stay readable under load, and
+ * property get/set cannot be limited since AllJoyn does not say who is asking.
+ */
+typedef struct {
+    double perNs;  /* 0 when the limit is off */
+    double burst;
+} AdmitRate;
+
+typedef struct {
+    char joiner[64];
+    double tokens;
+    uint64_t updated;
+} AdmitBucket;
+
+#define ADMIT_MAX_JOINERS 256
+static size_t s_sessionLimit = 0;
+static AdmitRate s_joinerRate = { 0, 0 };
+static AdmitRate s_globalRate = { 0, 0 };
+static pthread_mutex_t s_admitLock = PTHREAD_MUTEX_INITIALIZER;
+static AdmitBucket s_joinerBuckets[ADMIT_MAX_JOINERS];
+static AdmitBucket s_globalBucket;
+static uint64_t s_throttledJoiner = 0;
+static uint64_t s_throttledGlobal = 0;
+static uint64_t s_sessionsRefused = 0;
+
+/* Parses <calls per second>[:<burst>]; the burst defaults to one second's worth */
+static int admitParseRate(const char *text, AdmitRate *rate)
+{
+    char *end;
+    double perSec = strtod(text, &end);
+    double burst = perSec;
+    if (end == text || perSec <= 0.0) {
+        return -1;
+    }
+    if (*end == ':') {
+        burst = strtod(end + 1, &end);
+    }
+    if (*end || burst < 1.0) {
+        return -1;
+    }
+    rate->perNs = perSec / 1e9;
+    rate->burst = burst;
+    return 0;
+}
+
+/* Refills bucket, starting it full on first use, and takes a token if there is one */
+static int admitTake(AdmitBucket *bucket, const AdmitRate *rate, uint64_t now)
+{
+    if (bucket->updated == 0) {
+        bucket->tokens = rate->burst;
+    } else {
+        bucket->tokens += (now - bucket->updated) * rate->perNs;
+        if (bucket->tokens > rate->burst) {
+            bucket->tokens = rate->burst;
+        }
+    }
+    bucket->updated = now;
+    if (bucket->tokens < 1.0) {
+        return 0;
+    }
+    bucket->tokens -= 1.0;
+    return 1;
+}
+
+/*
+ * Finds joiner's bucket.  A bucket that has refilled completely is the same as
+ * a new one, so when joiner has none such a slot is reused; if every slot is
+ * in use the call is only held to the global rate.
+ */
+static AdmitBucket *admitBucket(const char *joiner, uint64_t now)
+{
+    AdmitBucket *spare = NULL;
+    size_t i;
+    for (i = 0; i < ADMIT_MAX_JOINERS; i++) {
+        AdmitBucket *bucket = &s_joinerBuckets[i];
+        if (strcmp(bucket->joiner, joiner) == 0) {
+            return bucket;
+        }
+        if (!spare && (bucket->updated == 0 ||
+                       bucket->tokens + (now - bucket->updated) * s_joinerRate.perNs >= s_joinerRate.burst)) {
+            spare = bucket;
+        }
+    }
+    if (spare) {
+        snprintf(spare->joiner, sizeof(spare->joiner), "%s", joiner);
+        spare->updated = 0;
+    }
+    return spare;
+}
+
+/* ER_OK when a call from caller is within the rates, ER_BUSY when it has to be refused */
+static QStatus ledAdmitCaller(const char *caller)
+{
+    AdmitBucket *bucket = NULL;
+    uint64_t now;
+    QStatus status = ER_OK;
+
+    if (s_joinerRate.perNs == 0 && s_globalRate.perNs == 0) {
+        return ER_OK;
+    }
+    now = ledNow();
+    pthread_mutex_lock(&s_admitLock);
+    if (s_joinerRate.perNs > 0) {
+        bucket = admitBucket(caller, now);
+        if (bucket && !admitTake(bucket, &s_joinerRate, now)) {
+            s_throttledJoiner++;
+            status = ER_BUSY;
+        }
+    }
+    if (ER_OK == status && s_globalRate.perNs > 0 && !admitTake(&s_globalBucket, &s_globalRate, now)) {
+        /* the joiner's token goes back; it was not the joiner that ran out */
+        if (bucket) {
+            bucket->tokens += 1.0;
+        }
+        s_throttledGlobal++;
+        status = ER_BUSY;
+    }
+    pthread_mutex_unlock(&s_admitLock);
+    return status;
+}
+
+/* The same for the call in msg, whose sender is the joiner */
+static QStatus ledAdmit(alljoyn_message msg)
+{
+    const char *sender;
+    if (s_joinerRate.perNs == 0 && s_globalRate.perNs == 0) {
+        return ER_OK;
+    }
+    sender = alljoyn_message_getsender(msg);
+    return ledAdmitCaller(sender ? sender : "");
+}
+
+/* A reservation whose join has not completed in this long is taken to have failed */
+#define SESSION_RESERVE_NS (10 * 1000000000ull)
+
+/*
+ * Whether another session fits under --max-sessions, counting joins accepted
+ * but not yet joined; if so a slot is reserved, which session_joined turns
+ * into the session itself.
+ */
+static int ledAdmitSession(void)
+{
+    uint64_t now;
+    int admit;
+    if (s_sessionLimit == 0) {
+        return 1;
+    }
+    now = ledNow();
+    pthread_mutex_lock(&s_sessionLock);
+    if (s_reservedSessions > 0 && now - s_reservedAt > SESSION_RESERVE_NS) {
+        s_reservedSessions = 0;
+    }
+    admit = s_numSessions + s_reservedSessions < s_sessionLimit;
+    if (admit) {
+        s_reservedSessions++;
+        s_reservedAt = now;
+    }
+    pthread_mutex_unlock(&s_sessionLock);
+    if (!admit) {
+        __atomic_fetch_add(&s_sessionsRefused, 1, __ATOMIC_RELAXED);
+    }
+    return admit;
+}
+/****** ADMISSION ******/
+
+/****** RECORDER ******/
+/*
+ * --record <path>: every method call is appended to path in the led_record.h
+ * format, for led_replay.  A handler encodes its call into a stack buffer
+ * once it has replied and copies it into the active half of a double buffer;
+ * the recorder thread swaps the halves and writes out the full one, so no
+ * handler ever waits on the disk.  If the active half fills before the
+ * thread gets to it the record is dropped and counted instead.
+ */
+#define RECORD_BUFFER_SIZE (256 * 1024)
+#define RECORD_FLUSH_MS 100
+
+static const char *s_recordPath = NULL;
+static int s_recordFd = -1;
+static uint64_t s_recordStart;
+static uint8_t *s_recordBuffers[2];
+static int s_recordActive = 0;
+static size_t s_recordUsed = 0;
+static pthread_t s_recordThread;
+static pthread_mutex_t s_recordLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_recordCond = PTHREAD_COND_INITIALIZER;
+static int s_recordStop = 0;
+static uint64_t s_recordCalls = 0;
+static uint64_t s_recordDropped = 0;
+
+static void ledRecordAppend(const uint8_t *record, size_t size)
+{
+    pthread_mutex_lock(&s_recordLock);
+    if (s_recordUsed + size > RECORD_BUFFER_SIZE) {
+        s_recordDropped++;
+    } else {
+        memcpy(s_recordBuffers[s_recordActive] + s_recordUsed, record, size);
+        s_recordUsed += size;
+        s_recordCalls++;
+        /* wake the writer early so a burst does not fill the rest of the half */
+        if (s_recordUsed >= RECORD_BUFFER_SIZE / 2) {
+            pthread_cond_signal(&s_recordCond);
+        }
+    }
+    pthread_mutex_unlock(&s_recordLock);
+}
+
+/* The method's arguments as led_record.h lays them out; 0 if msg does not carry them */
+static int ledRecordArgs(LedRecordBuffer *b, StatMethod method, alljoyn_message msg)
+{
+    double brightness;
+    uint32_t frequency, repeat;
+    alljoyn_msgarg entries;
+    size_t numEntries, i;
+
+    switch (method) {
+    case STAT_FLASH:
+        if (alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "d", &brightness) != ER_OK ||
+            alljoyn_msgarg_get(alljoyn_message_getarg(msg, 1), "u", &frequency) != ER_OK) {
+            return 0;
+        }
+        ledRecordPutDouble(b, brightness);
+        ledRecordPutUint(b, frequency, 4);
+        break;
+    case STAT_ON:
+        if (alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "d", &brightness) != ER_OK) {
+            return 0;
+        }
+        ledRecordPutDouble(b, brightness);
+        break;
+    case STAT_APPLY:
+        if (alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "a(sdu)", &numEntries, &entries) != ER_OK) {
+            return 0;
+        }
+        ledRecordPutUint(b, numEntries, 4);
+        for (i = 0; i < numEntries && !b->overflow; i++) {
+            char *id;
+            if (alljoyn_msgarg_get(alljoyn_msgarg_array_element(entries, i), "(sdu)", &id, &brightness, &frequency) != ER_OK) {
+                return 0;
+            }
+            ledRecordPutString(b, id);
+            ledRecordPutDouble(b, brightness);
+            ledRecordPutUint(b, frequency, 4);
+        }
+        break;
+    case STAT_PATTERN:
+        if (alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "a(du)", &numEntries, &entries) != ER_OK ||
+            alljoyn_msgarg_get(alljoyn_message_getarg(msg, 1), "u", &repeat) != ER_OK) {
+            return 0;
+        }
+        ledRecordPutUint(b, repeat, 4);
+        ledRecordPutUint(b, numEntries, 4);
+        for (i = 0; i < numEntries && !b->overflow; i++) {
+            if (alljoyn_msgarg_get(alljoyn_msgarg_array_element(entries, i), "(du)", &brightness, &frequency) != ER_OK) {
+                return 0;
+            }
+            ledRecordPutDouble(b, brightness);
+            ledRecordPutUint(b, frequency, 4);
+        }
+        break;
+    default:
+        break;
+    }
+    return !b->overflow;
+}
+
+/* Logs a method call that arrived at started (ledNow) and was answered with status */
+static void ledRecordCall(alljoyn_busobject bus, alljoyn_message msg, StatMethod method, uint64_t started, QStatus status)
+{
+    uint8_t record[LED_RECORD_MAX_SIZE];
+    LedRecordBuffer b = { record, sizeof(record), 0, 0 };
+    uint64_t latencyUs = (ledNow() - started) / 1000;
+    size_t flagsAt, argsAt;
+
+    ledRecordPutUint(&b, 0, 4);
+    ledRecordPutUint(&b, started > s_recordStart ? started - s_recordStart : 0, 8);
+    ledRecordPutUint(&b, latencyUs > UINT32_MAX ? UINT32_MAX : latencyUs, 4);
+    ledRecordPutUint(&b, (uint16_t)status, 2);
+    ledRecordPutUint(&b, method, 1);
+    flagsAt = b.used;
+    ledRecordPutUint(&b, 0, 1);
+    ledRecordPutString(&b, alljoyn_busobject_getpath(bus));
+    ledRecordPutString(&b, alljoyn_message_getsender(msg));
+    argsAt = b.used;
+    if (!ledRecordArgs(&b, method, msg)) {
+        b.used = argsAt;
+        b.overflow = 0;
+        record[flagsAt] = LED_RECORD_NO_ARGS;
+    }
+    argsAt = b.used;
+    b.used = 0;
+    ledRecordPutUint(&b, argsAt, 4);
+    ledRecordAppend(record, argsAt);
+}
+
+/* Writes out the full half every RECORD_FLUSH_MS, or sooner once it is half full, and the rest on the way out */
+static void *ledRecordThread(void *arg)
+{
+    int stop = 0;
+
+    pthread_mutex_lock(&s_recordLock);
+    while (!stop) {
+        uint8_t *full;
+        size_t size;
+        if (!s_recordStop && s_recordUsed < RECORD_BUFFER_SIZE / 2) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += RECORD_FLUSH_MS * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&s_recordCond, &s_recordLock, &until);
+        }
+        stop = s_recordStop;
+        full = s_recordBuffers[s_recordActive];
+        size = s_recordUsed;
+        s_recordActive ^= 1;
+        s_recordUsed = 0;
+        pthread_mutex_unlock(&s_recordLock);
+
+        while (size > 0) {
+            ssize_t n = write(s_recordFd, full, size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                printf("Failed to write the recording to %s: %s\n", s_recordPath, strerror(errno));
+                break;
+            }
+            full += n;
+            size -= (size_t)n;
+        }
+        pthread_mutex_lock(&s_recordLock);
+    }
+    pthread_mutex_unlock(&s_recordLock);
+    return NULL;
+}
+
+int ledStartRecorder(void)
+{
+    if (!s_recordPath) {
+        return 0;
+    }
+    s_recordBuffers[0] = (uint8_t *)malloc(RECORD_BUFFER_SIZE);
+    s_recordBuffers[1] = (uint8_t *)malloc(RECORD_BUFFER_SIZE);
+    if (s_recordBuffers[0] && s_recordBuffers[1]) {
+        s_recordFd = open(s_recordPath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if (s_recordFd >= 0 && write(s_recordFd, LED_RECORD_MAGIC, LED_RECORD_MAGIC_SIZE) == LED_RECORD_MAGIC_SIZE) {
+        s_recordStart = ledNow();
+        if (pthread_create(&s_recordThread, NULL, ledRecordThread, NULL) == 0) {
+            return 0;
+        }
+    }
+    if (s_recordFd >= 0) {
+        close(s_recordFd);
+        s_recordFd = -1;
+    }
+    free(s_recordBuffers[0]);
+    free(s_recordBuffers[1]);
+    s_recordBuffers[0] = s_recordBuffers[1] = NULL;
+    return -1;
+}
+
+/* Flushes what is buffered and closes the recording; no handler may run any more */
+void ledStopRecorder(void)
+{
+    if (s_recordFd < 0) {
+        return;
+    }
+    pthread_mutex_lock(&s_recordLock);
+    s_recordStop = 1;
+    pthread_cond_signal(&s_recordCond);
+    pthread_mutex_unlock(&s_recordLock);
+    pthread_join(s_recordThread, NULL);
+    close(s_recordFd);
+    s_recordFd = -1;
+    free(s_recordBuffers[0]);
+    free(s_recordBuffers[1]);
+    s_recordBuffers[0] = s_recordBuffers[1] = NULL;
+    printf("Recorded %llu calls to %s, dropped %llu\n", (unsigned long long)s_recordCalls, s_recordPath, (unsigned long long)s_recordDropped);
+}
+/****** RECORDER ******/
+
+/****** LOCAL SOCKET ******/
+/*
+ * --local-socket <path>: a SOCK_SEQPACKET socket taking the led_local.h
+ * requests, for callers on the same board that do not need the router in
+ * the middle.  One thread polls the listener and every connection and runs
+ * each request straight into the same LED functions the bus handlers use;
+ * those only queue work for the writer, so one thread keeps up.
+ *
+ * The service usually runs as root, so the socket is owner-only unless
+ * --local-mode opens it up, e.g. 0660 after a chgrp for an "leds" group.
+ */
+#define LOCAL_MAX_CLIENTS 32
+
+static const char *s_localPath = NULL;
+static mode_t s_localMode = 0600;
+static int s_localFd = -1;
+static int s_localStopFd[2] = { -1, -1 };
+static pthread_t s_localThread;
+static uint64_t s_localCalls = 0;
+static uint64_t s_localClients = 0;
+
+/* Runs request for caller, counting it like the bus method of the same name */
+static void ledLocalDispatch(const LedLocalRequest *request, const char *caller, LedLocalReply *reply)
+{
+    static const StatMethod LOCAL_STAT_METHODS[LED_LOCAL_METHOD_COUNT] = { STAT_FLASH, STAT_ON, STAT_OFF, STAT_STATUS };
+    uint64_t started = ledNow();
+    QStatus status = ER_OK;
+    LedDevice *led = g_defaultLed;
+    LedState state;
+
+    memset(reply, 0, sizeof(*reply));
+    reply->seq = request->seq;
+    if (request->method >= LED_LOCAL_METHOD_COUNT) {
+        reply->status = ER_BUS_OBJECT_NO_SUCH_MEMBER;
+        return;
+    }
+    if (request->led[0]) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%.*s", OBJECT_PATH, (int)sizeof(request->led), request->led);
+        led = ledLookup(path);
+    }
+    if (!led) {
+        status = ER_BUS_NO_SUCH_OBJECT;
+    } else if (ledAdmitCaller(caller) != ER_OK) {
+        status = ER_BUSY;
+    } else {
+        switch (request->method) {
+        case LED_LOCAL_FLASH:
+            enableLed(led, request->brightness, request->frequency);
+            reply->brightness = request->brightness;
+            reply->frequency = request->frequency;
+            break;
+        case LED_LOCAL_ON:
+            enableLed(led, request->brightness, 0);
+            reply->brightness = request->brightness;
+            break;
+        case LED_LOCAL_OFF:
+            disableLed(led);
+            break;
+        case LED_LOCAL_STATUS:
+            ledReadState(led, &state);
+            reply->brightness = state.brightness;
+            reply->frequency = state.frequency;
+            break;
+        }
+    }
+    reply->status = status;
+    statMethodDone(LOCAL_STAT_METHODS[request->method], started, status);
+    __atomic_fetch_add(&s_localCalls, 1, __ATOMIC_RELAXED);
+}
+
+/* Answers one request on fd; returns -1 when the connection is done with */
+static int ledLocalServe(int fd, const char *caller)
+{
+    LedLocalRequest request;
+    LedLocalReply reply;
+    ssize_t n = recv(fd, &request, sizeof(request), MSG_DONTWAIT);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+    if (n != (ssize_t)sizeof(request)) {
+        /* closed, or not speaking led_local.h */
+        return -1;
+    }
+    ledLocalDispatch(&request, caller, &reply);
+    /* a caller that does not read its replies loses the connection rather than stalling the others */
+    return send(fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)sizeof(reply) ? 0 : -1;
+}
+
+static void *ledLocalThread(void *arg)
+{
+    struct pollfd fds[2 + LOCAL_MAX_CLIENTS];
+    char callers[LOCAL_MAX_CLIENTS][24];
+    unsigned serial = 0;
+    nfds_t numFds = 2, i;
+
+    fds[0].fd = s_localStopFd[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = s_localFd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, numFds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        for (i = 2; i < numFds; i++) {
+            if (fds[i].revents && ledLocalServe(fds[i].fd, callers[i - 2]) != 0) {
+                close(fds[i].fd);
+                numFds--;
+                fds[i] = fds[numFds];
+                memcpy(callers[i - 2], callers[numFds - 2], sizeof(callers[0]));
+                i--;
+                __atomic_store_n(&s_localClients, numFds - 2, __ATOMIC_RELAXED);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(s_localFd, NULL, NULL);
+            if (fd >= 0 && numFds == 2 + LOCAL_MAX_CLIENTS) {
+                close(fd);
+            } else if (fd >= 0) {
+                fds[numFds].fd = fd;
+                fds[numFds].events = POLLIN;
+                fds[numFds].revents = 0;
+                /* each connection is a joiner of its own for --rate */
+                snprintf(callers[numFds - 2], sizeof(callers[0]), "local:%u", serial++);
+                numFds++;
+                __atomic_store_n(&s_localClients, numFds - 2, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    for (i = 2; i < numFds; i++) {
+        close(fds[i].fd);
+    }
+    __atomic_store_n(&s_localClients, 0, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Listens on s_localPath, replacing a socket left behind by an earlier run */
+int ledStartLocal(void)
+{
+    struct sockaddr_un addr;
+
+    if (!s_localPath) {
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(s_localPath) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, s_localPath);
+    unlink(s_localPath);
+    s_localFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    /* nobody can connect before listen, so the mode is in place before anyone could */
+    if (s_localFd < 0 || bind(s_localFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(s_localPath, s_localMode) != 0 ||
+        listen(s_localFd, 16) != 0 || pipe(s_localStopFd) != 0) {
+        goto fail;
+    }
+    if (pthread_create(&s_localThread, NULL, ledLocalThread, NULL) != 0) {
+        close(s_localStopFd[0]);
+        close(s_localStopFd[1]);
+        s_localStopFd[0] = s_localStopFd[1] = -1;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    printf("Local socket %s: %s\n", s_localPath, strerror(errno));
+    if (s_localFd >= 0) {
+        close(s_localFd);
+        s_localFd = -1;
+        unlink(s_localPath);
+    }
+    return -1;
+}
+
+void ledStopLocal(void)
+{
+    if (s_localStopFd[1] >= 0) {
+        if (write(s_localStopFd[1], "x", 1) != 1) {
+            printf("Failed to stop the local socket\n");
+        }
+        pthread_join(s_localThread, NULL);
+        close(s_localStopFd[0]);
+        close(s_localStopFd[1]);
+        s_localStopFd[0] = s_localStopFd[1] = -1;
+    }
+    if (s_localFd >= 0) {
+        close(s_localFd);
+        s_localFd = -1;
+        unlink(s_localPath);
+    }
+}
+/****** LOCAL SOCKET ******/
+
+/****** STATS REPORT ******/
+/* --stats-file: where and how often the Prometheus text dump is written */
+static const char *s_statsFile = NULL;
+static unsigned s_statsIntervalSec = 10;
+static pthread_t s_statsThread;
+static pthread_mutex_t s_statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_statsCond = PTHREAD_COND_INITIALIZER;
+static int s_statsRunning = 0;
+static int s_statsStop = 0;
+
+/* Sums every thread's block into total */
+static void statCollect(LedThreadStats *total)
+{
+    LedThreadStats *stats;
+    int m, b;
+    memset(total, 0, sizeof(*total));
+    for (stats = __atomic_load_n(&s_threadStats, __ATOMIC_ACQUIRE); stats; stats = stats->next) {
+        for (m = 0; m < STAT_METHOD_COUNT; m++) {
+            total->calls[m] += __atomic_load_n(&stats->calls[m], __ATOMIC_RELAXED);
+            total->errors[m] += __atomic_load_n(&stats->errors[m], __ATOMIC_RELAXED);
+            total->latencyNs[m] += __atomic_load_n(&stats->latencyNs[m], __ATOMIC_RELAXED);
+            for (b = 0; b < STAT_BUCKETS; b++) {
+                total->buckets[m][b] += __atomic_load_n(&stats->buckets[m][b], __ATOMIC_RELAXED);
+            }
+        }
+        total->sysfsReads += __atomic_load_n(&stats->sysfsReads, __ATOMIC_RELAXED);
+        total->sysfsReadNs += __atomic_load_n(&stats->sysfsReadNs, __ATOMIC_RELAXED);
+        total->sysfsWrites += __atomic_load_n(&stats->sysfsWrites, __ATOMIC_RELAXED);
+        total->sysfsWriteNs += __atomic_load_n(&stats->sysfsWriteNs, __ATOMIC_RELAXED);
+        total->sysfsErrors += __atomic_load_n(&stats->sysfsErrors, __ATOMIC_RELAXED);
+    }
+}
+
+/* Upper bound in us of the bucket holding quantile q; an estimate within a factor of two */
+static uint64_t statQuantileUs(const uint64_t *buckets, double q)
+{
+    uint64_t count = 0, seen = 0;
+    int b;
+    for (b = 0; b < STAT_BUCKETS; b++) {
+        count += buckets[b];
+    }
+    for (b = 0; b < STAT_BUCKETS && count; b++) {
+        seen += buckets[b];
+        if (seen >= q * count) {
+            return 1ull << b;
+        }
+    }
+    return 0;
+}
+
+static uint64_t statSkippedWrites(void)
+{
+    uint64_t skipped = 0;
+    int attr;
+    for (attr = 0; attr < LED_ATTR_COUNT; attr++) {
+        skipped += __atomic_load_n(&s_attrSkips[attr], __ATOMIC_RELAXED);
+    }
+    return skipped;
+}
+
+static uint64_t statActiveSessions(void)
+{
+    uint64_t active;
+    pthread_mutex_lock(&s_sessionLock);
+    active = s_numSessions;
+    pthread_mutex_unlock(&s_sessionLock);
+    return active;
+}
 
-/* Static BusListener */
-static alljoyn_buslistener g_busListener = NULL;
+/* Resident set size in KiB, read without allocating so a soak test can watch it */
+static uint64_t statRssKb(void)
+{
+    char buffer[64];
+    unsigned long pages = 0;
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    ssize_t n = fd >= 0 ? read(fd, buffer, sizeof(buffer) - 1) : -1;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    buffer[n] = 0;
+    if (sscanf(buffer, "%*s %lu", &pages) != 1) {
+        return 0;
+    }
+    return (uint64_t)pages * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+}
 
-/*constants*/
-static const char* INTERFACE_NAME = "org.alljoyn.sample.ledcontroller";
-static const char* OBJECT_NAME = "org.alljoyn.sample.ledcontroller.beagle";
-static const char* OBJECT_PATH = "/beagle";
-static const alljoyn_sessionport SERVICE_PORT = 42;
+/* Bytes malloc has handed out and not had back, over all arenas */
+static uint64_t statHeapBytes(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return (uint64_t)info.uordblks + (uint64_t)info.hblkhd;
+}
 
-static volatile sig_atomic_t g_interrupt = QCC_FALSE;
+/* The flat name/value list the stats method replies with; returns the number of entries */
+#define STAT_MAX_ENTRIES 96
+#define STAT_KEY_SIZE 32
+static size_t statEntries(char keys[][STAT_KEY_SIZE], uint64_t *values)
+{
+    LedThreadStats total;
+    size_t n = 0;
+    int m;
 
-/****** LED CONTROL ******/
-static const char *LED_TRIGGER_FILE = "/sys/class/leds/beaglebone:green:usr1/trigger";
-static const char *LED_BRIGHTNESS_FILE = "/sys/class/leds/beaglebone:green:usr1/brightness";
-static const char *LED_DELAY_ON_FILE = "/sys/class/leds/beaglebone:green:usr1/delay_on";
-static const char *LED_DELAY_OFF_FILE = "/sys/class/leds/beaglebone:green:usr1/delay_off";
+    statCollect(&total);
+#define STAT_ENTRY(value, ...) \
+    do { snprintf(keys[n], STAT_KEY_SIZE, __VA_ARGS__); values[n++] = (value); } while (0)
+    for (m = 0; m < STAT_METHOD_COUNT; m++) {
+        STAT_ENTRY(total.calls[m], "%s.calls", STAT_METHOD_NAMES[m]);
+        STAT_ENTRY(total.errors[m], "%s.errors", STAT_METHOD_NAMES[m]);
+        STAT_ENTRY(total.latencyNs[m] / 1000, "%s.total_us", STAT_METHOD_NAMES[m]);
+        STAT_ENTRY(statQuantileUs(total.buckets[m], 0.50), "%s.p50_us", STAT_METHOD_NAMES[m]);
+        STAT_ENTRY(statQuantileUs(total.buckets[m], 0.99), "%s.p99_us", STAT_METHOD_NAMES[m]);
+    }
+    STAT_ENTRY(total.sysfsReads, "sysfs.reads");
+    STAT_ENTRY(total.sysfsReadNs / 1000, "sysfs.read_us");
+    STAT_ENTRY(total.sysfsWrites, "sysfs.writes");
+    STAT_ENTRY(total.sysfsWriteNs / 1000, "sysfs.write_us");
+    STAT_ENTRY(total.sysfsErrors, "sysfs.errors");
+    STAT_ENTRY(statSkippedWrites(), "sysfs.skipped");
+    STAT_ENTRY(__atomic_load_n(&s_coalesced, __ATOMIC_RELAXED), "writer.coalesced");
+    STAT_ENTRY(__atomic_load_n(&s_stepCount, __ATOMIC_RELAXED), "pattern.steps");
+    STAT_ENTRY(__atomic_load_n(&s_stepLateSumNs, __ATOMIC_RELAXED) / 1000, "pattern.late_us");
+    STAT_ENTRY(__atomic_load_n(&s_stepLateMaxNs, __ATOMIC_RELAXED) / 1000, "pattern.late_max_us");
+    STAT_ENTRY(__atomic_load_n(&s_sessionsAccepted, __ATOMIC_RELAXED), "sessions.accepted");
+    STAT_ENTRY(__atomic_load_n(&s_sessionsRejected, __ATOMIC_RELAXED), "sessions.rejected");
+    STAT_ENTRY(statActiveSessions(), "sessions.active");
+    STAT_ENTRY(__atomic_load_n(&s_sessionsRefused, __ATOMIC_RELAXED), "sessions.refused_full");
+    STAT_ENTRY(__atomic_load_n(&s_throttledJoiner, __ATOMIC_RELAXED), "throttled.joiner");
+    STAT_ENTRY(__atomic_load_n(&s_throttledGlobal, __ATOMIC_RELAXED), "throttled.global");
+    STAT_ENTRY(__atomic_load_n(&s_recordCalls, __ATOMIC_RELAXED), "record.calls");
+    STAT_ENTRY(__atomic_load_n(&s_recordDropped, __ATOMIC_RELAXED), "record.dropped");
+    STAT_ENTRY(__atomic_load_n(&s_localCalls, __ATOMIC_RELAXED), "local.calls");
+    STAT_ENTRY(__atomic_load_n(&s_localClients, __ATOMIC_RELAXED), "local.clients");
+    STAT_ENTRY(statRssKb(), "memory.rss_kb");
+    STAT_ENTRY(statHeapBytes(), "memory.heap_bytes");
+#undef STAT_ENTRY
+    return n;
+}
 
-void writeValue(const char *file, char *value) {
-    FILE *f = NULL;
-    if((f = fopen(file, "w+")) != NULL) {
-        fwrite(value, sizeof(char), strlen(value), f);
-        fclose(f);
+/* Writes the Prometheus text exposition to path, replacing it atomically */
+static int statWritePrometheus(const char *path)
+{
+    char tmp[PATH_MAX];
+    LedThreadStats total;
+    FILE *f;
+    int m, b;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((f = fopen(tmp, "w")) == NULL) {
+        return -1;
+    }
+    statCollect(&total);
+    fprintf(f, "# HELP led_method_calls_total Method calls handled.\n# TYPE led_method_calls_total counter\n");
+    for (m = 0; m < STAT_METHOD_COUNT; m++) {
+        fprintf(f, "led_method_calls_total{method=\"%s\"} %llu\n", STAT_METHOD_NAMES[m], (unsigned long long)total.calls[m]);
+    }
+    fprintf(f, "# HELP led_method_errors_total Method calls answered with an error.\n# TYPE led_method_errors_total counter\n");
+    for (m = 0; m < STAT_METHOD_COUNT; m++) {
+        fprintf(f, "led_method_errors_total{method=\"%s\"} %llu\n", STAT_METHOD_NAMES[m], (unsigned long long)total.errors[m]);
     }
+    fprintf(f, "# HELP led_method_duration_seconds Time spent in the method handler.\n# TYPE led_method_duration_seconds histogram\n");
+    for (m = 0; m < STAT_METHOD_COUNT; m++) {
+        uint64_t cumulative = 0;
+        for (b = 0; b < STAT_BUCKETS - 1; b++) {
+            cumulative += total.buckets[m][b];
+            fprintf(f, "led_method_duration_seconds_bucket{method=\"%s\",le=\"%g\"} %llu\n",
+                    STAT_METHOD_NAMES[m], (double)(1ull << b) / 1e6, (unsigned long long)cumulative);
+        }
+        fprintf(f, "led_method_duration_seconds_bucket{method=\"%s\",le=\"+Inf\"} %llu\n", STAT_METHOD_NAMES[m], (unsigned long long)total.calls[m]);
+        fprintf(f, "led_method_duration_seconds_sum{method=\"%s\"} %.9f\n", STAT_METHOD_NAMES[m], total.latencyNs[m] / 1e9);
+        fprintf(f, "led_method_duration_seconds_count{method=\"%s\"} %llu\n", STAT_METHOD_NAMES[m], (unsigned long long)total.calls[m]);
+    }
+    fprintf(f, "# HELP led_sysfs_ops_total LED attribute reads and writes.\n# TYPE led_sysfs_ops_total counter\n");
+    fprintf(f, "led_sysfs_ops_total{op=\"read\"} %llu\n", (unsigned long long)total.sysfsReads);
+    fprintf(f, "led_sysfs_ops_total{op=\"write\"} %llu\n", (unsigned long long)total.sysfsWrites);
+    fprintf(f, "# HELP led_sysfs_seconds_total Time spent in LED attribute reads and writes.\n# TYPE led_sysfs_seconds_total counter\n");
+    fprintf(f, "led_sysfs_seconds_total{op=\"read\"} %.9f\n", total.sysfsReadNs / 1e9);
+    fprintf(f, "led_sysfs_seconds_total{op=\"write\"} %.9f\n", total.sysfsWriteNs / 1e9);
+    fprintf(f, "# TYPE led_sysfs_errors_total counter\nled_sysfs_errors_total %llu\n", (unsigned long long)total.sysfsErrors);
+    fprintf(f, "# TYPE led_sysfs_writes_skipped_total counter\nled_sysfs_writes_skipped_total %llu\n", (unsigned long long)statSkippedWrites());
+    fprintf(f, "# TYPE led_writer_coalesced_total counter\nled_writer_coalesced_total %llu\n",
+            (unsigned long long)__atomic_load_n(&s_coalesced, __ATOMIC_RELAXED));
+    fprintf(f, "# TYPE led_pattern_steps_total counter\nled_pattern_steps_total %llu\n",
+            (unsigned long long)__atomic_load_n(&s_stepCount, __ATOMIC_RELAXED));
+    fprintf(f, "# TYPE led_pattern_late_seconds_total counter\nled_pattern_late_seconds_total %.9f\n",
+            __atomic_load_n(&s_stepLateSumNs, __ATOMIC_RELAXED) / 1e9);
+    fprintf(f, "# TYPE led_pattern_late_max_seconds gauge\nled_pattern_late_max_seconds %.9f\n",
+            __atomic_load_n(&s_stepLateMaxNs, __ATOMIC_RELAXED) / 1e9);
+    fprintf(f, "# TYPE led_sessions_accepted_total counter\nled_sessions_accepted_total %llu\n",
+            (unsigned long long)__atomic_load_n(&s_sessionsAccepted, __ATOMIC_RELAXED));
+    fprintf(f, "# TYPE led_sessions_rejected_total counter\nled_sessions_rejected_total %llu\n",
+            (unsigned long long)__atomic_load_n(&s_sessionsRejected, __ATOMIC_RELAXED));
+    fprintf(f, "# TYPE led_sessions gauge\nled_sessions %llu\n", (unsigned long long)statActiveSessions());
+    fprintf(f, "# TYPE led_sessions_refused_total counter\nled_sessions_refused_total %llu\n",
+            (unsigned long long)__atomic_load_n(&s_sessionsRefused, __ATOMIC_RELAXED));
+    fprintf(f, "# HELP led_calls_throttled_total Method calls refused with ER_BUSY by a rate limit.\n# TYPE led_calls_throttled_total counter\n");
+    fprintf(f, "led_calls_throttled_total{limit=\"joiner\"} %llu\n", (unsigned long long)__atomic_load_n(&s_throttledJoiner, __ATOMIC_RELAXED));
+    fprintf(f, "led_calls_throttled_total{limit=\"global\"} %llu\n", (unsigned long long)__atomic_load_n(&s_throttledGlobal, __ATOMIC_RELAXED));
+    fprintf(f, "# HELP led_record_calls_total Method calls written to the --record file, or dropped because its buffer was full.\n# TYPE led_record_calls_total counter\n");
+    fprintf(f, "led_record_calls_total{result=\"recorded\"} %llu\n", (unsigned long long)__atomic_load_n(&s_recordCalls, __ATOMIC_RELAXED));
+    fprintf(f, "led_record_calls_total{result=\"dropped\"} %llu\n", (unsigned long long)__atomic_load_n(&s_recordDropped, __ATOMIC_RELAXED));
+    fprintf(f, "# HELP led_local_calls_total Method calls that came in over --local-socket instead of the bus.\n# TYPE led_local_calls_total counter\n");
+    fprintf(f, "led_local_calls_total %llu\n", (unsigned long long)__atomic_load_n(&s_localCalls, __ATOMIC_RELAXED));
+    fprintf(f, "# TYPE led_local_clients gauge\nled_local_clients %llu\n", (unsigned long long)__atomic_load_n(&s_localClients, __ATOMIC_RELAXED));
+    fprintf(f, "# TYPE led_memory_rss_bytes gauge\nled_memory_rss_bytes %llu\n", (unsigned long long)statRssKb() * 1024);
+    fprintf(f, "# HELP led_memory_heap_bytes Bytes allocated with malloc and not yet freed.\n# TYPE led_memory_heap_bytes gauge\nled_memory_heap_bytes %llu\n",
+            (unsigned long long)statHeapBytes());
+    if (fclose(f) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return rename(tmp, path);
 }
 
-#define BUFFER_SIZE 1024
-char *readFile(const char *file) {
-    FILE *f = NULL;
-    char *buffer = NULL;
-    if((f = fopen(file, "r")) != NULL) {
-        buffer = (char *)calloc(BUFFER_SIZE, sizeof(char));
-        fread(buffer, sizeof(char), BUFFER_SIZE-1, f);
-        fclose(f);
+/* Rewrites s_statsFile every s_statsIntervalSec, and once more on the way out */
+static void *ledStatsThread(void *arg)
+{
+    pthread_mutex_lock(&s_statsLock);
+    while (!s_statsStop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += s_statsIntervalSec;
+        pthread_cond_timedwait(&s_statsCond, &s_statsLock, &until);
+        pthread_mutex_unlock(&s_statsLock);
+        if (statWritePrometheus(s_statsFile) != 0) {
+            printf("Failed to write stats to %s: %s\n", s_statsFile, strerror(errno));
+        }
+        pthread_mutex_lock(&s_statsLock);
     }
-    return buffer;
+    pthread_mutex_unlock(&s_statsLock);
+    return NULL;
 }
 
-void enableLed(double intensity, int frequency) {
-    char frequencyStr[81];
-    if(frequency == 0) {
-        // solid LED
-        writeValue(LED_TRIGGER_FILE, (char*)"none");
-        writeValue(LED_BRIGHTNESS_FILE, (char*)"1");
-    } else {
-        snprintf(frequencyStr, 80, "%d", frequency);
-        writeValue(LED_TRIGGER_FILE, (char*)"timer");
-        writeValue(LED_BRIGHTNESS_FILE, (char*)"1");
-        writeValue(LED_DELAY_ON_FILE, frequencyStr);
-        writeValue(LED_DELAY_OFF_FILE, frequencyStr);
+int ledStartStats(void)
+{
+    if (!s_statsFile) {
+        return 0;
+    }
+    if (pthread_create(&s_statsThread, NULL, ledStatsThread, NULL) != 0) {
+        return -1;
     }
+    s_statsRunning = 1;
+    return 0;
 }
 
-void disableLed(void) {
-    writeValue(LED_TRIGGER_FILE, (char*)"none");
-    writeValue(LED_BRIGHTNESS_FILE, (char*)"0");
+/* Stops the dump thread after a final write and frees the per-thread blocks; no handler may run any more */
+void ledStopStats(void)
+{
+    LedThreadStats *stats = s_threadStats;
+    if (s_statsRunning) {
+        pthread_mutex_lock(&s_statsLock);
+        s_statsStop = 1;
+        pthread_cond_signal(&s_statsCond);
+        pthread_mutex_unlock(&s_statsLock);
+        pthread_join(s_statsThread, NULL);
+        s_statsRunning = 0;
+    }
+    s_threadStats = NULL;
+    t_stats = NULL;
+    /* threads that outlive the blocks must not touch them on exit */
+    if (s_statsKeyCreated) {
+        pthread_key_delete(s_statsKey);
+        s_statsKeyCreated = 0;
+    }
+    while (stats) {
+        LedThreadStats *next = stats->next;
+        free(stats);
+        stats = next;
+    }
 }
+/****** STATS REPORT ******/
 
-int isLedOn(void) {
-    int result = 0;
-    char *led = readFile(LED_BRIGHTNESS_FILE);
-    if(led && led[0] == '1') {
-        result = 1;
+static void SigIntHandler(int sig)
+{
+    g_interrupt = QCC_TRUE;
+}
+
+/*
+ * SIGINT and SIGTERM are blocked before any thread starts, so every thread
+ * inherits the mask and they are only ever delivered through this signalfd.
+ * Returns -1 if that is not possible; SigIntHandler is installed instead.
+ */
+static int ledBlockSignals(sigset_t *set)
+{
+    int fd;
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, set, NULL) != 0) {
+        return -1;
     }
-    return result;
+    fd = signalfd(-1, set, SFD_CLOEXEC);
+    if (fd < 0) {
+        pthread_sigmask(SIG_UNBLOCK, set, NULL);
+    }
+    return fd;
 }
 
-int isBlinking(void) {
-    int result = 0;
-    char *trigger = readFile(LED_TRIGGER_FILE);
-    if(trigger) {
-        char *start = strchr(trigger, '[');
-        char *end = strchr(trigger, ']');
-        int len = (end - start - 1);
-        start++;
-        *end = 0;
-        if(len == 5 && (strcmp(start, "timer") == 0)) {
-            result = 1;
+/* Blocks until SIGINT or SIGTERM arrives */
+static void waitForSignal(int signalFd, const sigset_t *set)
+{
+    struct signalfd_siginfo info;
+    ssize_t n;
+    int sig = 0;
+    if (signalFd < 0) {
+        /* no signalfd: sleep in sigsuspend with SIGINT blocked outside it, so the flag check cannot race the handler */
+        sigset_t old;
+        pthread_sigmask(SIG_BLOCK, set, &old);
+        while (g_interrupt == QCC_FALSE) {
+            sigsuspend(&old);
         }
-        free(trigger);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        return;
     }
-    return result;
+    for (;;) {
+        n = read(signalFd, &info, sizeof(info));
+        if (n == (ssize_t)sizeof(info)) {
+            printf("Caught signal %u, shutting down\n", info.ssi_signo);
+            break;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        /* the signals are still blocked in every thread, so they can be taken straight off the pending set */
+        if (n < 0) {
+            printf("Failed to read the signalfd (%s), waiting with sigwait\n", strerror(errno));
+        } else {
+            printf("Short read of %zd bytes from the signalfd, waiting with sigwait\n", n);
+        }
+        if (sigwait(set, &sig) == 0) {
+            printf("Caught signal %d, shutting down\n", sig);
+        }
+        break;
+    }
+    g_interrupt = QCC_TRUE;
 }
 
-int blinkFrequency(void) {
-    int result = 0;
-    char *frequency = readFile(LED_DELAY_ON_FILE);
-    if(frequency) {
-        result = atoi(frequency);
+/*
+ * OBJECT_NAME.<suffix>, so several services can share a bus and clients find
+ * them all by prefix.  Bus name elements only take [A-Za-z0-9_] and may not
+ * start with a digit; anything else in suffix becomes '_'.
+ */
+static const char *ledSuffixedName(const char *suffix)
+{
+    static char name[256];
+    size_t len = strlen(OBJECT_NAME);
+    size_t i;
+
+    memcpy(name, OBJECT_NAME, len);
+    name[len++] = '.';
+    if (isdigit((unsigned char)*suffix)) {
+        name[len++] = '_';
     }
-    return result;
+    for (i = 0; suffix[i] && len < sizeof(name) - 1; i++) {
+        name[len++] = isalnum((unsigned char)suffix[i]) ? suffix[i] : '_';
+    }
+    name[len] = 0;
+    return name;
 }
-/****** LED CONTROL ******/
 
-static void SigIntHandler(int sig)
+void usage(char *cmd)
 {
-    g_interrupt = QCC_TRUE;
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "   --backend <name>       where LED attributes live: sysfs, tmpfs or memory (default %s)\n", LED_DEFAULT_BACKEND);
+    fprintf(stderr, "   --led-root <dir>       directory holding the LED devices (default %s for sysfs, %s for tmpfs)\n",
+            LED_BACKENDS[0].defaultRoot, LED_BACKENDS[1].defaultRoot);
+    fprintf(stderr, "   --leds <n>             LEDs the tmpfs (into an empty root) and memory backends create (default %u)\n", s_backendLeds);
+    fprintf(stderr, "   --latency-us <w>[:<r>] memory backend: delay each attribute write, and read, by this much\n");
+    fprintf(stderr, "   --default-led <name>   LED served at %s (default %s)\n", OBJECT_PATH, LED_DEFAULT_NAME);
+    fprintf(stderr, "   --watch                resync LED state when it is changed outside the service\n");
+    fprintf(stderr, "   --name <bus name>      well-known name to request and advertise (default %s)\n", OBJECT_NAME);
+    fprintf(stderr, "   --suffix <s>           advertise %s.<s> instead, e.g. the board's hostname, for led_client --all\n", OBJECT_NAME);
+    fprintf(stderr, "   --group <name>         apply groupCommand broadcasts for this group to the default LED; repeatable (up to %d)\n", LED_MAX_GROUPS);
+    fprintf(stderr, "   --max-sessions <n>     refuse joins while n sessions are open (default unlimited)\n");
+    fprintf(stderr, "   --rate <r>[:<burst>]   method calls per second each joiner may make; calls over it get ER_BUSY\n");
+    fprintf(stderr, "   --global-rate <r>[:<burst>]  the same limit for all joiners together (default unlimited)\n");
+    fprintf(stderr, "   --sync-writes          reply only after the LED has been written instead of once the command is queued\n");
+    fprintf(stderr, "   --force-writes         write every attribute on each change instead of only the ones that differ\n");
+    fprintf(stderr, "   --coalesce-ms <ms>     minimum interval between stateChanged signals per LED (default %u)\n", s_coalesceMs);
+    fprintf(stderr, "   --stats-file <path>    write the counters in Prometheus text format to path\n");
+    fprintf(stderr, "   --stats-interval <s>   how often --stats-file is rewritten (default %u)\n", s_statsIntervalSec);
+    fprintf(stderr, "   --local-socket <path>  also take flash, on, off and status from callers on this board over a\n");
+    fprintf(stderr, "                          SOCK_SEQPACKET socket at path, bypassing the router (led_client --local)\n");
+    fprintf(stderr, "   --local-mode <octal>   permissions of the --local-socket (default 0600, owner only)\n");
+    fprintf(stderr, "   --record <path>        log every method call to path for led_replay\n");
+    fprintf(stderr, "   --trace <path>         write startup phases and each call as Chrome trace JSON (also LED_TRACE);\n");
+    fprintf(stderr, "                          %%p in path becomes the process id\n");
+    exit(1);
 }
 
 /* ObjectRegistered callback */
@@ -155,7 +2910,7 @@ void busobject_object_registered(const void* context)
 /* NameOwnerChanged callback */
 void name_owner_changed(const void* context, const char* busName, const char* previousOwner, const char* newOwner)
 {
-    if (newOwner && (0 == strcmp(busName, OBJECT_NAME))) {
+    if (newOwner && (0 == strcmp(busName, g_serviceName))) {
         printf("name_owner_changed: name=%s, oldOwner=%s, newOwner=%s\n",
                busName,
                previousOwner ? previousOwner : "<none>",
@@ -170,21 +2925,82 @@ QCC_BOOL accept_session_joiner(const void* context, alljoyn_sessionport sessionP
     QCC_BOOL ret = QCC_FALSE;
     if (sessionPort != SERVICE_PORT) {
         printf("Rejecting join attempt on unexpected session port %d\n", sessionPort);
+        __atomic_fetch_add(&s_sessionsRejected, 1, __ATOMIC_RELAXED);
+    } else if (!ledAdmitSession()) {
+        printf("Rejecting join session request from %s: %zu sessions already\n", joiner, s_sessionLimit);
+        __atomic_fetch_add(&s_sessionsRejected, 1, __ATOMIC_RELAXED);
     } else {
         printf("Accepting join session request from %s (opts.proximity=%x, opts.traffic=%x, opts.transports=%x)\n",
                joiner, alljoyn_sessionopts_get_proximity(opts), alljoyn_sessionopts_get_traffic(opts), alljoyn_sessionopts_get_transports(opts));
         ret = QCC_TRUE;
+        __atomic_fetch_add(&s_sessionsAccepted, 1, __ATOMIC_RELAXED);
     }
     return ret;
 }
 
+/* SessionLost callback for sessions joined to this service */
+void host_session_lost(const void* context, alljoyn_sessionid sessionId, alljoyn_sessionlostreason reason)
+{
+    printf("Session %u lost (reason=%d)\n", sessionId, reason);
+    sessionRemove(sessionId);
+}
+
+/* SessionJoined callback: the new session starts receiving stateChanged */
+void session_joined(const void* context, alljoyn_sessionport sessionPort, alljoyn_sessionid id, const char* joiner)
+{
+    alljoyn_busattachment_setsessionlistener(g_msgBus, id, s_hostSessionListener);
+    sessionAdd(id);
+}
+
+/* Counts a method call that has been answered and, with --record, logs it */
+static void methodDone(alljoyn_busobject bus, alljoyn_message msg, StatMethod method, uint64_t started, QStatus status)
+{
+    statMethodDone(method, started, status);
+    if (s_recordFd >= 0) {
+        ledRecordCall(bus, msg, method, started, status);
+    }
+}
+
+/* Answers msg with an error and counts the call as failed */
+static void methodError(alljoyn_busobject bus, alljoyn_message msg, StatMethod method, uint64_t started, QStatus status)
+{
+    alljoyn_busobject_methodreply_status(bus, msg, status);
+    methodDone(bus, msg, method, started, status);
+}
+
+/*
+ * The (brightness, frequency) reply of flash, on, off and status.  Each
+ * dispatch thread keeps one array and refills it for every reply, so the
+ * handlers do not allocate once warm; the key frees it with its thread.
+ */
+static pthread_key_t s_replyKey;
+static pthread_once_t s_replyOnce = PTHREAD_ONCE_INIT;
+
+static void replyArgsFree(void *args)
+{
+    alljoyn_msgarg_destroy((alljoyn_msgarg)args);
+}
+
+static void replyKeyCreate(void)
+{
+    pthread_key_create(&s_replyKey, replyArgsFree);
+}
+
 /* Exposed concatinate method */
 static int getReturnStatus(alljoyn_msgarg *outArg, double brightness, uint32_t frequency) 
 {
     QStatus status;
-    size_t numArgs;
-    *outArg = alljoyn_msgarg_array_create(2);
-    numArgs = 2;
+    size_t numArgs = 2;
+    size_t i;
+    pthread_once(&s_replyOnce, replyKeyCreate);
+    *outArg = (alljoyn_msgarg)pthread_getspecific(s_replyKey);
+    if (!*outArg) {
+        *outArg = alljoyn_msgarg_array_create(numArgs);
+        pthread_setspecific(s_replyKey, *outArg);
+    }
+    for (i = 0; i < numArgs; i++) {
+        alljoyn_msgarg_clear(alljoyn_msgarg_array_element(*outArg, i));
+    }
     status = alljoyn_msgarg_array_set(*outArg, &numArgs, "du", brightness, frequency);
     if (ER_OK != status) {
         printf("Arg assignment failed: %s\n", QCC_StatusText(status));
@@ -195,10 +3011,21 @@ static int getReturnStatus(alljoyn_msgarg *outArg, double brightness, uint32_t f
 
 void flash_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
 {
+    uint64_t started = ledNow();
     QStatus status;
     alljoyn_msgarg outArg;
     double brightness;
     uint32_t frequency;
+    LedDevice *led = ledLookup(alljoyn_busobject_getpath(bus));
+
+    if (!led) {
+        methodError(bus, msg, STAT_FLASH, started, ER_BUS_NO_SUCH_OBJECT);
+        return;
+    }
+    if (ledAdmit(msg) != ER_OK) {
+        methodError(bus, msg, STAT_FLASH, started, ER_BUSY);
+        return;
+    }
 
     /* set the device to flash */
     status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "d", &brightness);
@@ -210,9 +3037,10 @@ void flash_method(alljoyn_busobject bus, const alljoyn_interfacedescription_memb
         printf("Ping: Error reading alljoyn_message\n");
     }
 
-    enableLed(brightness, frequency);
+    enableLed(led, brightness, frequency);
     
     if(getReturnStatus(&outArg, brightness, frequency) != 0) {
+        status = ER_FAIL;
         printf("Ping: Error sending reply\n");
     } else {
     	status = alljoyn_busobject_methodreply_args(bus, msg, outArg, 2);
@@ -220,14 +3048,25 @@ void flash_method(alljoyn_busobject bus, const alljoyn_interfacedescription_memb
         	printf("Ping: Error sending reply\n");
     	}
     }
-    alljoyn_msgarg_destroy(outArg);
+    methodDone(bus, msg, STAT_FLASH, started, status);
 }
 
 void on_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
 {
+    uint64_t started = ledNow();
     QStatus status;
     alljoyn_msgarg outArg;
     double brightness;
+    LedDevice *led = ledLookup(alljoyn_busobject_getpath(bus));
+
+    if (!led) {
+        methodError(bus, msg, STAT_ON, started, ER_BUS_NO_SUCH_OBJECT);
+        return;
+    }
+    if (ledAdmit(msg) != ER_OK) {
+        methodError(bus, msg, STAT_ON, started, ER_BUSY);
+        return;
+    }
 
     /* set the device to flash */
     status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "d", &brightness);
@@ -235,9 +3074,10 @@ void on_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member*
         printf("Ping: Error reading alljoyn_message\n");
     }
 
-    enableLed(brightness, 0);
+    enableLed(led, brightness, 0);
 
     if(getReturnStatus(&outArg, brightness, 0) != 0) {
+        status = ER_FAIL;
         printf("Ping: Error sending reply\n");
     } else {
     	status = alljoyn_busobject_methodreply_args(bus, msg, outArg, 2);
@@ -245,17 +3085,29 @@ void on_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member*
         	printf("Ping: Error sending reply\n");
     	}
     }
-    alljoyn_msgarg_destroy(outArg);
+    methodDone(bus, msg, STAT_ON, started, status);
 }
 
 void off_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
 {
+    uint64_t started = ledNow();
     QStatus status;
     alljoyn_msgarg outArg;
+    LedDevice *led = ledLookup(alljoyn_busobject_getpath(bus));
+
+    if (!led) {
+        methodError(bus, msg, STAT_OFF, started, ER_BUS_NO_SUCH_OBJECT);
+        return;
+    }
+    if (ledAdmit(msg) != ER_OK) {
+        methodError(bus, msg, STAT_OFF, started, ER_BUSY);
+        return;
+    }
 
-    disableLed();
+    disableLed(led);
 
     if(getReturnStatus(&outArg, 0, 0.0) != 0) {
+        status = ER_FAIL;
         printf("Ping: Error sending reply\n");
     } else {
     	status = alljoyn_busobject_methodreply_args(bus, msg, outArg, 2);
@@ -263,26 +3115,30 @@ void off_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member
         	printf("Ping: Error sending reply\n");
     	}
     }
-    alljoyn_msgarg_destroy(outArg);
+    methodDone(bus, msg, STAT_OFF, started, status);
 }
 
 void status_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
 {
+    uint64_t started = ledNow();
     QStatus status;
     alljoyn_msgarg outArg;
-    double brightness = 0.0;
-    uint32_t frequency = 0;
+    LedState state;
+    LedDevice *led = ledLookup(alljoyn_busobject_getpath(bus));
 
-    if(isBlinking()) {
-        brightness = 1.0;
-        frequency = blinkFrequency();
-    } else {
-        if(isLedOn()) {
-            brightness = 1.0;
-        }
+    if (!led) {
+        methodError(bus, msg, STAT_STATUS, started, ER_BUS_NO_SUCH_OBJECT);
+        return;
     }
-    
-    if(getReturnStatus(&outArg, brightness, frequency) != 0) {
+    if (ledAdmit(msg) != ER_OK) {
+        methodError(bus, msg, STAT_STATUS, started, ER_BUSY);
+        return;
+    }
+
+    ledReadState(led, &state);
+
+    if(getReturnStatus(&outArg, state.brightness, state.frequency) != 0) {
+        status = ER_FAIL;
         printf("Ping: Error sending reply\n");
     } else {
     	status = alljoyn_busobject_methodreply_args(bus, msg, outArg, 2);
@@ -290,7 +3146,275 @@ void status_method(alljoyn_busobject bus, const alljoyn_interfacedescription_mem
         	printf("Ping: Error sending reply\n");
     	}
     }
+    methodDone(bus, msg, STAT_STATUS, started, status);
+}
+
+/*
+ * Property Get: answered from the published state, so it never touches
+ * sysfs.  context is the LedDevice the object serves.
+ */
+QStatus led_property_get(const void* context, const char* ifcName, const char* propName, alljoyn_msgarg val)
+{
+    uint64_t started = ledNow();
+    LedDevice *led = (LedDevice *)context;
+    QStatus status = ER_BUS_NO_SUCH_PROPERTY;
+    LedState state;
+
+    if (led && strcmp(ifcName, INTERFACE_NAME) == 0) {
+        ledReadState(led, &state);
+        if (strcmp(propName, "Brightness") == 0) {
+            status = alljoyn_msgarg_set(val, "d", state.brightness);
+        } else if (strcmp(propName, "Frequency") == 0) {
+            status = alljoyn_msgarg_set(val, "u", state.frequency);
+        } else if (strcmp(propName, "Trigger") == 0) {
+            status = alljoyn_msgarg_set(val, "s", LED_TRIGGER_NAMES[state.trigger]);
+        }
+    }
+    statMethodDone(STAT_GET, started, status);
+    return status;
+}
+
+/*
+ * Property Set: Brightness 0 turns the LED off and anything else turns it on
+ * with the current frequency; Frequency keeps the current brightness, turning
+ * an LED that is off on at full brightness.  Trigger is read-only.
+ */
+QStatus led_property_set(const void* context, const char* ifcName, const char* propName, alljoyn_msgarg val)
+{
+    uint64_t started = ledNow();
+    LedDevice *led = (LedDevice *)context;
+    QStatus status = ER_BUS_NO_SUCH_PROPERTY;
+    LedState state;
+
+    if (led && strcmp(ifcName, INTERFACE_NAME) == 0) {
+        ledReadState(led, &state);
+        if (strcmp(propName, "Brightness") == 0) {
+            double brightness;
+            status = alljoyn_msgarg_get(val, "d", &brightness);
+            if (ER_OK == status && brightness <= 0.0) {
+                disableLed(led);
+            } else if (ER_OK == status) {
+                enableLed(led, brightness, state.frequency);
+            }
+        } else if (strcmp(propName, "Frequency") == 0) {
+            uint32_t frequency;
+            status = alljoyn_msgarg_get(val, "u", &frequency);
+            if (ER_OK == status) {
+                enableLed(led, state.brightness > 0.0 ? state.brightness : 1.0, frequency);
+            }
+        } else if (strcmp(propName, "Trigger") == 0) {
+            status = ER_BUS_PROPERTY_ACCESS_DENIED;
+        }
+    }
+    statMethodDone(STAT_SET, started, status);
+    return status;
+}
+
+/*
+ * Runs a sequence of (brightness, duration ms) steps on the LED, repeat times
+ * or forever for 0.  Replies with the engine running it and the length of
+ * one pass in ms.
+ */
+void pattern_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
+{
+    uint64_t started = ledNow();
+    QStatus status;
+    alljoyn_msgarg steps;
+    alljoyn_msgarg outArg;
+    size_t numSteps = 0;
+    size_t numArgs = 2;
+    uint32_t repeat = 0;
+    LedPattern *pattern;
+    LedEngine engine;
+    size_t i;
+    LedDevice *led = ledLookup(alljoyn_busobject_getpath(bus));
+
+    if (!led) {
+        methodError(bus, msg, STAT_PATTERN, started, ER_BUS_NO_SUCH_OBJECT);
+        return;
+    }
+    if (ledAdmit(msg) != ER_OK) {
+        methodError(bus, msg, STAT_PATTERN, started, ER_BUSY);
+        return;
+    }
+    if (s_writerFd < 0) {
+        /* software patterns are stepped by the writer thread */
+        methodError(bus, msg, STAT_PATTERN, started, ER_FAIL);
+        return;
+    }
+
+    status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "a(du)", &numSteps, &steps);
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 1), "u", &repeat);
+    }
+    if (ER_OK == status && (numSteps == 0 || numSteps > LED_PATTERN_MAX_STEPS)) {
+        status = ER_BAD_ARG_1;
+    }
+    if (ER_OK != status) {
+        printf("Pattern: Error reading alljoyn_message\n");
+        methodError(bus, msg, STAT_PATTERN, started, status);
+        return;
+    }
+
+    pattern = (LedPattern *)calloc(1, sizeof(LedPattern));
+    if (!pattern) {
+        methodError(bus, msg, STAT_PATTERN, started, ER_OUT_OF_MEMORY);
+        return;
+    }
+    pattern->numSteps = numSteps;
+    pattern->repeat = repeat;
+    for (i = 0; i < numSteps && ER_OK == status; i++) {
+        LedStep *step = &pattern->steps[i];
+        status = alljoyn_msgarg_get(alljoyn_msgarg_array_element(steps, i), "(du)", &step->brightness, &step->duration);
+    }
+    if (ER_OK == status && ledPatternPeriodMs(pattern) == 0) {
+        /* nothing would ever advance it */
+        status = ER_BAD_ARG_1;
+    }
+    if (ER_OK != status) {
+        free(pattern);
+        methodError(bus, msg, STAT_PATTERN, started, status);
+        return;
+    }
+
+    /* the reply is built first so a caller is never left with a running pattern and no answer */
+    engine = ledPatternEngine(led, pattern);
+    outArg = alljoyn_msgarg_array_create(numArgs);
+    status = alljoyn_msgarg_array_set(outArg, &numArgs, "su", LED_ENGINE_NAMES[engine], (uint32_t)ledPatternPeriodMs(pattern));
+    if (ER_OK != status) {
+        printf("Pattern: Error building reply (%s)\n", QCC_StatusText(status));
+        free(pattern);
+        alljoyn_msgarg_destroy(outArg);
+        methodError(bus, msg, STAT_PATTERN, started, status);
+        return;
+    }
+    patternLed(led, pattern);
+    status = alljoyn_busobject_methodreply_args(bus, msg, outArg, numArgs);
+    if (ER_OK != status) {
+        printf("Pattern: Error sending reply\n");
+    }
+    alljoyn_msgarg_destroy(outArg);
+    methodDone(bus, msg, STAT_PATTERN, started, status);
+}
+
+/*
+ * Answers with the service-wide counters as name/value pairs; the object it
+ * is called on does not matter.
+ */
+void stats_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
+{
+    uint64_t started = ledNow();
+    QStatus status = ER_OK;
+    char keys[STAT_MAX_ENTRIES][STAT_KEY_SIZE];
+    uint64_t values[STAT_MAX_ENTRIES];
+    size_t numEntries = statEntries(keys, values);
+    alljoyn_msgarg entries = alljoyn_msgarg_array_create(numEntries);
+    alljoyn_msgarg outArg = alljoyn_msgarg_create();
+    size_t i;
+
+    for (i = 0; i < numEntries && ER_OK == status; i++) {
+        status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(entries, i), "{st}", keys[i], values[i]);
+    }
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_set(outArg, "a{st}", numEntries, entries);
+    }
+    if (ER_OK != status) {
+        printf("Stats: Error building reply (%s)\n", QCC_StatusText(status));
+        methodError(bus, msg, STAT_STATS, started, status);
+    } else {
+        status = alljoyn_busobject_methodreply_args(bus, msg, outArg, 1);
+        if (ER_OK != status) {
+            printf("Stats: Error sending reply\n");
+        }
+        methodDone(bus, msg, STAT_STATS, started, status);
+    }
     alljoyn_msgarg_destroy(outArg);
+    alljoyn_msgarg_destroy(entries);
+}
+
+/*
+ * Applies a batch of (led, brightness, frequency) changes in one call: a
+ * brightness of 0 turns the LED off, a frequency of 0 makes it solid and
+ * anything else flashes it.  Each entry is answered with its status and the
+ * state the LED ended up in.
+ */
+void apply_method(alljoyn_busobject bus, const alljoyn_interfacedescription_member* member, alljoyn_message msg)
+{
+    uint64_t started = ledNow();
+    QStatus status;
+    alljoyn_msgarg entries;
+    alljoyn_msgarg results = NULL;
+    alljoyn_msgarg outArg = NULL;
+    size_t numEntries = 0;
+    size_t i;
+
+    if (ledAdmit(msg) != ER_OK) {
+        methodError(bus, msg, STAT_APPLY, started, ER_BUSY);
+        return;
+    }
+    status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "a(sdu)", &numEntries, &entries);
+    if (ER_OK != status) {
+        printf("Apply: Error reading alljoyn_message\n");
+        methodError(bus, msg, STAT_APPLY, started, status);
+        return;
+    }
+
+    results = alljoyn_msgarg_array_create(numEntries);
+    for (i = 0; i < numEntries && ER_OK == status; i++) {
+        char *id = NULL;
+        char path[PATH_MAX];
+        double brightness = 0.0;
+        uint32_t frequency = 0;
+        QStatus entryStatus = ER_OK;
+        LedState state = { 0.0, 0, LED_TRIGGER_NONE };
+        LedDevice *led;
+
+        status = alljoyn_msgarg_get(alljoyn_msgarg_array_element(entries, i), "(sdu)", &id, &brightness, &frequency);
+        if (ER_OK != status) {
+            break;
+        }
+        if (id[0] == 0) {
+            led = g_defaultLed;
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", OBJECT_PATH, id);
+            led = ledLookup(path);
+        }
+        if (!led) {
+            entryStatus = ER_BUS_NO_SUCH_OBJECT;
+        } else {
+            if (brightness <= 0.0) {
+                disableLed(led);
+            } else {
+                enableLed(led, brightness, frequency);
+            }
+            if (s_syncWrites) {
+                ledReadState(led, &state);
+            } else {
+                /* still queued: answer with what was accepted */
+                ledTargetState(brightness, frequency, &state);
+            }
+        }
+        status = alljoyn_msgarg_set(alljoyn_msgarg_array_element(results, i), "(sudu)", id, (uint32_t)entryStatus, state.brightness, state.frequency);
+    }
+
+    if (ER_OK == status) {
+        outArg = alljoyn_msgarg_create();
+        status = alljoyn_msgarg_set(outArg, "a(sudu)", numEntries, results);
+    }
+    if (ER_OK != status) {
+        printf("Apply: Error building reply (%s)\n", QCC_StatusText(status));
+        methodError(bus, msg, STAT_APPLY, started, status);
+    } else {
+        status = alljoyn_busobject_methodreply_args(bus, msg, outArg, 1);
+        if (ER_OK != status) {
+            printf("Apply: Error sending reply\n");
+        }
+        methodDone(bus, msg, STAT_APPLY, started, status);
+    }
+    if (outArg) {
+        alljoyn_msgarg_destroy(outArg);
+    }
+    alljoyn_msgarg_destroy(results);
 }
 
 /** Main entry point */
@@ -298,46 +3422,159 @@ int main(int argc, char** argv, char** envArg)
 {
     QStatus status = ER_OK;
     char* connectArgs = "unix:abstract=alljoyn";
-    alljoyn_interfacedescription testIntf = NULL;
     alljoyn_busobject_callbacks busObjCbs = {
-        NULL,
-        NULL,
+        &led_property_get,
+        &led_property_set,
         &busobject_object_registered,
         NULL
     };
-    alljoyn_busobject testObj;
+    alljoyn_busobject testObj = NULL;
     alljoyn_interfacedescription exampleIntf;
-    alljoyn_interfacedescription_member flash_member, on_member, off_member, status_member;
+    alljoyn_interfacedescription_member flash_member, on_member, off_member, status_member, apply_member, pattern_member, stats_member;
     QCC_BOOL foundMember = QCC_FALSE;
     alljoyn_busobject_methodentry methodEntries[] = {
         { &flash_member, flash_method },
         { &on_member, on_method },
         { &off_member, off_method },
         { &status_member, status_method },
+        { &apply_member, apply_method },
+        { &pattern_member, pattern_method },
+        { &stats_member, stats_method },
     };
     alljoyn_sessionportlistener_callbacks spl_cbs = {
         accept_session_joiner,
+        session_joined
+    };
+    alljoyn_sessionlistener_callbacks sessionCallbacks = {
+        host_session_lost,
+        NULL,
         NULL
     };
+    alljoyn_interfacedescription_member state_changed_member, group_member;
     alljoyn_sessionopts opts;
+    sigset_t signals;
+    int signalFd;
+    const char *ledRoot = NULL;
+    const char *backend = LED_DEFAULT_BACKEND;
+    const char *defaultLed = LED_DEFAULT_NAME;
+    const char *tracePath = NULL;
+    int watch = 0;
+    int i;
+    size_t l;
+    uint64_t started = ledNow(), phase;
+
+    g_serviceName = OBJECT_NAME;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        } else if (strcmp(argv[i], "--led-root") == 0 && i + 1 < argc) {
+            ledRoot = argv[++i];
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            backend = argv[++i];
+        } else if (strcmp(argv[i], "--leds") == 0 && i + 1 < argc) {
+            s_backendLeds = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc) {
+            char *end;
+            s_memoryWriteLatencyNs = strtoull(argv[++i], &end, 10) * 1000;
+            s_memoryReadLatencyNs = *end == ':' ? strtoull(end + 1, NULL, 10) * 1000 : 0;
+        } else if (strcmp(argv[i], "--default-led") == 0 && i + 1 < argc) {
+            defaultLed = argv[++i];
+        } else if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            g_serviceName = argv[++i];
+        } else if (strcmp(argv[i], "--suffix") == 0 && i + 1 < argc && argv[i + 1][0]) {
+            g_serviceName = ledSuffixedName(argv[++i]);
+        } else if (strcmp(argv[i], "--max-sessions") == 0 && i + 1 < argc) {
+            s_sessionLimit = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (admitParseRate(argv[++i], &s_joinerRate) != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--global-rate") == 0 && i + 1 < argc) {
+            if (admitParseRate(argv[++i], &s_globalRate) != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--group") == 0 && i + 1 < argc && s_numGroups < LED_MAX_GROUPS) {
+            s_groups[s_numGroups++] = argv[++i];
+        } else if (strcmp(argv[i], "--sync-writes") == 0) {
+            s_syncWrites = 1;
+        } else if (strcmp(argv[i], "--force-writes") == 0) {
+            s_forceWrites = 1;
+        } else if (strcmp(argv[i], "--coalesce-ms") == 0 && i + 1 < argc) {
+            s_coalesceMs = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+            s_statsFile = argv[++i];
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            s_statsIntervalSec = (unsigned)strtoul(argv[++i], NULL, 10);
+            if (s_statsIntervalSec == 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--local-socket") == 0 && i + 1 < argc) {
+            s_localPath = argv[++i];
+        } else if (strcmp(argv[i], "--local-mode") == 0 && i + 1 < argc) {
+            char *end;
+            s_localMode = (mode_t)strtoul(argv[++i], &end, 8);
+            if (*end || s_localMode & ~0777u) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            s_recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (ledSelectBackend(backend) != 0) {
+        fprintf(stderr, "Unknown backend %s\n", backend);
+        usage(argv[0]);
+    }
+
+    if (ledTraceOpen(tracePath, "led_service") != 0) {
+        fprintf(stderr, "Failed to create the trace file\n");
+    }
 
     printf("AllJoyn Library version: %s\n", alljoyn_getversion());
     printf("AllJoyn Library build info: %s\n", alljoyn_getbuildinfo());
 
-    /* Install SIGINT handler */
-    signal(SIGINT, SigIntHandler);
+    /* Take SIGINT and SIGTERM through a signalfd; this has to happen before the first thread is created */
+    signalFd = ledBlockSignals(&signals);
+    if (signalFd < 0) {
+        signal(SIGINT, SigIntHandler);
+        signal(SIGTERM, SigIntHandler);
+    }
+
+    /* Find the LEDs and open their attributes; they stay open until shutdown */
+    phase = ledTraceBegin();
+    if (ledRegistryCreate(ledRoot, defaultLed) != 0) {
+        return 1;
+    }
+    if (ledStartWriter() != 0) {
+        printf("Failed to start the LED writer, writing from the method handlers\n");
+    }
+    if (watch && !s_backend->watchable) {
+        printf("Nothing outside the service can change %s LEDs, ignoring --watch\n", s_backend->name);
+    } else if (watch && ledStartWatcher(g_leds) != 0) {
+        printf("Failed to start the LED watcher\n");
+    }
+    if (ledStartStats() != 0) {
+        printf("Failed to start the stats dump to %s\n", s_statsFile);
+    }
+    if (ledStartRecorder() != 0) {
+        printf("Failed to start recording to %s\n", s_recordPath);
+    }
+    if (ledStartLocal() != 0) {
+        printf("Failed to open the local socket, serving the bus only\n");
+    }
+    ledTraceEnd("led_setup", phase);
 
     /* Create message bus */
+    phase = ledTraceBegin();
     g_msgBus = alljoyn_busattachment_create("ledApp", QCC_TRUE);
 
     /* Add org.alljoyn.Bus.method_sample interface */
-    status = alljoyn_busattachment_createinterface(g_msgBus, INTERFACE_NAME, &testIntf);
+    status = createLedInterface(g_msgBus);
     if (status == ER_OK) {
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "flash", "du",  "du", "brightnessIn,frequencyIn,brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "on", "d",  "du", "brightnessIn,brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "off", NULL,  "du", "brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_addmember(testIntf, ALLJOYN_MESSAGE_METHOD_CALL, "status", NULL,  "du", "brightnessOut,frequencyOut", 0);
-        alljoyn_interfacedescription_activate(testIntf);
         printf("Interface Created.\n");
     } else {
         printf("Failed to create interface 'org.alljoyn.Bus.method_sample'\n");
@@ -359,12 +3596,19 @@ int main(int argc, char** argv, char** envArg)
         g_busListener = alljoyn_buslistener_create(&callbacks, NULL);
         alljoyn_busattachment_registerbuslistener(g_msgBus, g_busListener);
     }
+    ledTraceEnd("bus_create", phase);
 
-    /* Set up bus object */
-    testObj = alljoyn_busobject_create(OBJECT_PATH, QCC_FALSE, &busObjCbs, NULL);
+    /* Set up bus objects: OBJECT_PATH for the default LED plus one per LED, all sharing the interface */
+    phase = ledTraceBegin();
     exampleIntf = alljoyn_busattachment_getinterface(g_msgBus, INTERFACE_NAME);
     assert(exampleIntf);
+    testObj = alljoyn_busobject_create(OBJECT_PATH, QCC_FALSE, &busObjCbs, g_defaultLed);
     alljoyn_busobject_addinterface(testObj, exampleIntf);
+    s_aliasObj = testObj;
+    for (l = 0; l < g_ledCount; l++) {
+        g_leds[l].busObj = alljoyn_busobject_create(g_leds[l].path, QCC_FALSE, &busObjCbs, &g_leds[l]);
+        alljoyn_busobject_addinterface(g_leds[l].busObj, exampleIntf);
+    }
 
     /* Check for members */
     foundMember = alljoyn_interfacedescription_getmember(exampleIntf, "flash", &flash_member);
@@ -387,22 +3631,62 @@ int main(int argc, char** argv, char** envArg)
     if (!foundMember) {
         printf("Failed to get status member of interface\n");
     }
+    foundMember = alljoyn_interfacedescription_getmember(exampleIntf, "apply", &apply_member);
+    assert(foundMember == QCC_TRUE);
+    if (!foundMember) {
+        printf("Failed to get apply member of interface\n");
+    }
+    foundMember = alljoyn_interfacedescription_getmember(exampleIntf, "pattern", &pattern_member);
+    assert(foundMember == QCC_TRUE);
+    if (!foundMember) {
+        printf("Failed to get pattern member of interface\n");
+    }
+    foundMember = alljoyn_interfacedescription_getmember(exampleIntf, "stats", &stats_member);
+    assert(foundMember == QCC_TRUE);
+    if (!foundMember) {
+        printf("Failed to get stats member of interface\n");
+    }
+    foundMember = alljoyn_interfacedescription_getmember(exampleIntf, "stateChanged", &state_changed_member);
+    assert(foundMember == QCC_TRUE);
+    if (!foundMember) {
+        printf("Failed to get stateChanged member of interface\n");
+    } else if (ledStartNotifier(state_changed_member) != 0) {
+        printf("Failed to start the state notifier\n");
+    }
+    foundMember = alljoyn_interfacedescription_getmember(exampleIntf, "groupCommand", &group_member);
+    assert(foundMember == QCC_TRUE);
+    if (!foundMember) {
+        printf("Failed to get groupCommand member of interface\n");
+    }
 
     status = alljoyn_busobject_addmethodhandlers(testObj, methodEntries, sizeof(methodEntries) / sizeof(methodEntries[0]));
+    for (l = 0; l < g_ledCount && ER_OK == status; l++) {
+        status = alljoyn_busobject_addmethodhandlers(g_leds[l].busObj, methodEntries, sizeof(methodEntries) / sizeof(methodEntries[0]));
+    }
     if (ER_OK != status) {
         printf("Failed to register method handlers for BasicSampleObject");
     }
+    ledTraceEnd("bus_objects", phase);
 
     /* Start the msg bus */
+    phase = ledTraceBegin();
     status = alljoyn_busattachment_start(g_msgBus);
+    ledTraceEnd("bus_start", phase);
     if (ER_OK == status) {
         printf("alljoyn_busattachment started.\n");
         /* Register  local objects and connect to the daemon */
+        phase = ledTraceBegin();
         status = alljoyn_busattachment_registerbusobject(g_msgBus, testObj);
+        for (l = 0; l < g_ledCount && ER_OK == status; l++) {
+            status = alljoyn_busattachment_registerbusobject(g_msgBus, g_leds[l].busObj);
+        }
+        ledTraceEnd("register_objects", phase);
 
         /* Create the client-side endpoint */
         if (ER_OK == status) {
+            phase = ledTraceBegin();
             status = alljoyn_busattachment_connect(g_msgBus, connectArgs);
+            ledTraceEnd("connect", phase);
             if (ER_OK != status) {
                 printf("alljoyn_busattachment_connect(\"%s\") failed\n", connectArgs);
             } else {
@@ -424,20 +3708,26 @@ int main(int argc, char** argv, char** envArg)
     /* Request name */
     if (ER_OK == status) {
         uint32_t flags = DBUS_NAME_FLAG_REPLACE_EXISTING | DBUS_NAME_FLAG_DO_NOT_QUEUE;
-        QStatus status = alljoyn_busattachment_requestname(g_msgBus, OBJECT_NAME, flags);
+        QStatus status;
+        phase = ledTraceBegin();
+        status = alljoyn_busattachment_requestname(g_msgBus, g_serviceName, flags);
+        ledTraceEnd("request_name", phase);
         if (ER_OK != status) {
-            printf("alljoyn_busattachment_requestname(%s) failed (status=%s)\n", OBJECT_NAME, QCC_StatusText(status));
+            printf("alljoyn_busattachment_requestname(%s) failed (status=%s)\n", g_serviceName, QCC_StatusText(status));
         }
     }
 
     /* Create session port listener */
     s_sessionPortListener = alljoyn_sessionportlistener_create(&spl_cbs, NULL);
+    s_hostSessionListener = alljoyn_sessionlistener_create(&sessionCallbacks, NULL);
 
     /* Create session */
     opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
     if (ER_OK == status) {
         alljoyn_sessionport sp = SERVICE_PORT;
+        phase = ledTraceBegin();
         status = alljoyn_busattachment_bindsessionport(g_msgBus, &sp, opts, s_sessionPortListener);
+        ledTraceEnd("bind_session_port", phase);
         if (ER_OK != status) {
             printf("alljoyn_busattachment_bindsessionport failed (%s)\n", QCC_StatusText(status));
         }
@@ -445,32 +3735,46 @@ int main(int argc, char** argv, char** envArg)
 
     /* Advertise name */
     if (ER_OK == status) {
-        status = alljoyn_busattachment_advertisename(g_msgBus, OBJECT_NAME, alljoyn_sessionopts_get_transports(opts));
+        phase = ledTraceBegin();
+        status = alljoyn_busattachment_advertisename(g_msgBus, g_serviceName, alljoyn_sessionopts_get_transports(opts));
+        ledTraceEnd("advertise", phase);
         if (status != ER_OK) {
-            printf("Failed to advertise name %s (%s)\n", OBJECT_NAME, QCC_StatusText(status));
+            printf("Failed to advertise name %s (%s)\n", g_serviceName, QCC_StatusText(status));
         }
     }
 
-    if (ER_OK == status) {
-        while (g_interrupt == QCC_FALSE) {
-#ifdef _WIN32
-            Sleep(100);
-#else
-            usleep(100 * 1000);
-#endif
+    /* Take groupCommand broadcasts */
+    if (ER_OK == status && foundMember) {
+        QStatus groupStatus = ledStartGroups(group_member);
+        if (ER_OK != groupStatus) {
+            printf("Failed to subscribe to groupCommand (%s)\n", QCC_StatusText(groupStatus));
         }
     }
 
+    /* startup covers everything from main() until the service is advertised */
+    ledTraceSpan("startup", started, ledNow());
+    if (ER_OK == status) {
+        phase = ledTraceBegin();
+        waitForSignal(signalFd, &signals);
+        ledTraceEnd("serve", phase);
+    }
+    phase = ledTraceBegin();
+
     /* Deallocate sessionopts */
     if (opts) {
         alljoyn_sessionopts_destroy(opts);
     }
+    ledStopLocal();
+    /* No more signals once the bus goes away */
+    ledStopGroups();
+    ledStopNotifier();
     /* Deallocate bus */
     if (g_msgBus) {
         alljoyn_busattachment deleteMe = g_msgBus;
         g_msgBus = NULL;
         alljoyn_busattachment_destroy(deleteMe);
     }
+    ledFreeSessions();
 
     /* Deallocate bus listener */
     if (g_busListener) {
@@ -481,11 +3785,31 @@ int main(int argc, char** argv, char** envArg)
     if (s_sessionPortListener) {
         alljoyn_sessionportlistener_destroy(s_sessionPortListener);
     }
+    if (s_hostSessionListener) {
+        alljoyn_sessionlistener_destroy(s_hostSessionListener);
+    }
 
-    /* Deallocate the bus object */
+    /* Deallocate the bus objects */
     if (testObj) {
         alljoyn_busobject_destroy(testObj);
     }
+    for (l = 0; l < g_ledCount; l++) {
+        if (g_leds[l].busObj) {
+            alljoyn_busobject_destroy(g_leds[l].busObj);
+        }
+    }
+
+    ledStopWriter();
+    ledStopWatcher();
+    ledPrintWriteCounters();
+    ledRegistryDestroy();
+    ledStopRecorder();
+    ledStopStats();
+    if (signalFd >= 0) {
+        close(signalFd);
+    }
+    ledTraceEnd("shutdown", phase);
+    ledTraceClose();
 
     return (int) status;
 }
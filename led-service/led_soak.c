@@ -0,0 +1,463 @@
+/**
+ * @file
+ * @brief Soak test: millions of calls against led_service, failing if its
+ * memory grows.
+ *
+ * Cycles flash, on, off and status on the default LED from --concurrency
+ * threads.  After --warmup calls (so thread-local buffers, the stats blocks
+ * and the allocator's arenas are in place) it reads memory.rss_kb and
+ * memory.heap_bytes from the service's stats, then samples them again after
+ * each of --samples equal slices of --calls.  The run fails if the last
+ * sample is more than the slack above the baseline, or if any call failed.
+ *
+ * heap_bytes is what malloc has outstanding, so a leak of a few bytes per
+ * call shows there long before it moves RSS by a page.
+ *
+ * With --service the tool starts the service itself with --backend memory,
+ * so no board or LED hardware is needed; without it, it joins the running
+ * service named by --name.
+ *
+ * The result is a single JSON object on stdout; progress goes to stderr.
+ * The exit status is 0 for a pass and 1 otherwise.
+ *
+ * Build: gcc -o led_soak led_soak.c -lalljoyn_c -lpthread
+ * Run:   ./led_soak --service ./led_service --calls 5000000 --concurrency 4
+ *        npm run soak    (after npm install, against the led_service_memory target)
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include <qcc/platform.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <alljoyn_c/DBusStdDefines.h>
+#include <alljoyn_c/BusAttachment.h>
+#include <alljoyn_c/MsgArg.h>
+#include <alljoyn_c/InterfaceDescription.h>
+#include <alljoyn_c/Status.h>
+
+#include "led_interface.h"
+
+/* Largest --samples */
+#define SOAK_MAX_SAMPLES 1000
+
+/* Settings from the command line */
+static const char *s_serviceName = NULL;
+static const char *s_servicePath = NULL;
+static uint64_t s_calls = 2000000;
+static uint64_t s_warmup = 20000;
+static int s_concurrency = 4;
+static int s_samples = 10;
+static uint64_t s_rssSlackKb = 256;
+static uint64_t s_heapSlack = 64 * 1024;
+static uint32_t s_timeoutMs = 5000;
+
+static pid_t s_servicePid = -1;
+
+static alljoyn_busattachment s_bus = NULL;
+static alljoyn_buslistener s_listener = NULL;
+static alljoyn_sessionid s_sessionId = 0;
+static alljoyn_proxybusobject s_proxy = NULL;
+
+static pthread_mutex_t s_foundLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_foundCond = PTHREAD_COND_INITIALIZER;
+static int s_found = 0;
+
+/* Calls are numbered; workers take numbers until they reach s_target */
+static uint64_t s_next = 0;
+static uint64_t s_target = 0;
+static uint64_t s_failed = 0;
+
+/* The service's memory after a given number of calls */
+typedef struct {
+    uint64_t calls;
+    uint64_t rssKb;
+    uint64_t heapBytes;
+} SoakSample;
+
+static SoakSample s_sampled[SOAK_MAX_SAMPLES + 1];
+static int s_numSampled = 0;
+
+static volatile sig_atomic_t g_interrupt = QCC_FALSE;
+
+static void SigIntHandler(int sig)
+{
+    g_interrupt = QCC_TRUE;
+}
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/****** SERVICE ******/
+
+/* Starts s_servicePath on the memory backend, so any host can run the soak */
+static int startService(void)
+{
+    s_servicePid = fork();
+    if (s_servicePid < 0) {
+        fprintf(stderr, "fork: %s\n", strerror(errno));
+        return -1;
+    }
+    if (s_servicePid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+        execl(s_servicePath, s_servicePath, "--backend", "memory", "--name", s_serviceName, (char *)NULL);
+        fprintf(stderr, "exec %s: %s\n", s_servicePath, strerror(errno));
+        _exit(127);
+    }
+    return 0;
+}
+
+static void stopService(void)
+{
+    int i;
+    if (s_servicePid <= 0) {
+        return;
+    }
+    kill(s_servicePid, SIGINT);
+    for (i = 0; i < 50; i++) {
+        if (waitpid(s_servicePid, NULL, WNOHANG) == s_servicePid) {
+            s_servicePid = -1;
+            return;
+        }
+        usleep(100 * 1000);
+    }
+    kill(s_servicePid, SIGKILL);
+    waitpid(s_servicePid, NULL, 0);
+    s_servicePid = -1;
+}
+/****** SERVICE ******/
+
+/****** CALLS ******/
+
+/* FoundAdvertisedName callback */
+static void found_advertised_name(const void* context, const char* name, alljoyn_transportmask transport, const char* namePrefix)
+{
+    if (strcmp(name, s_serviceName) == 0) {
+        pthread_mutex_lock(&s_foundLock);
+        s_found = 1;
+        pthread_cond_broadcast(&s_foundCond);
+        pthread_mutex_unlock(&s_foundLock);
+    }
+}
+
+/* Connects, waits up to 10 s for the service's advertisement, joins it and makes the proxy */
+static QStatus soakConnect(void)
+{
+    alljoyn_buslistener_callbacks callbacks = {
+        NULL,
+        NULL,
+        &found_advertised_name,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+    };
+    alljoyn_sessionopts opts;
+    QStatus status;
+    int i;
+
+    s_bus = alljoyn_busattachment_create("ledSoak", QCC_TRUE);
+    status = createLedInterface(s_bus);
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_start(s_bus);
+    }
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_connect(s_bus, "unix:abstract=alljoyn");
+    }
+    if (status == ER_OK) {
+        s_listener = alljoyn_buslistener_create(&callbacks, NULL);
+        alljoyn_busattachment_registerbuslistener(s_bus, s_listener);
+        status = alljoyn_busattachment_findadvertisedname(s_bus, s_serviceName);
+    }
+    if (status != ER_OK) {
+        return status;
+    }
+
+    pthread_mutex_lock(&s_foundLock);
+    for (i = 0; i < 100 && !s_found && !g_interrupt; i++) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&s_foundCond, &s_foundLock, &ts);
+    }
+    pthread_mutex_unlock(&s_foundLock);
+    if (!s_found) {
+        return ER_TIMEOUT;
+    }
+
+    opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+    status = alljoyn_busattachment_joinsession(s_bus, s_serviceName, SERVICE_PORT, NULL, &s_sessionId, opts);
+    alljoyn_sessionopts_destroy(opts);
+    if (status != ER_OK) {
+        s_sessionId = 0;
+        return status;
+    }
+    s_proxy = alljoyn_proxybusobject_create(s_bus, s_serviceName, OBJECT_PATH, s_sessionId);
+    return alljoyn_proxybusobject_addinterface(s_proxy, alljoyn_busattachment_getinterface(s_bus, INTERFACE_NAME));
+}
+
+static void soakDisconnect(void)
+{
+    if (s_proxy) {
+        alljoyn_proxybusobject_destroy(s_proxy);
+        s_proxy = NULL;
+    }
+    if (s_bus) {
+        if (s_sessionId) {
+            alljoyn_busattachment_leavesession(s_bus, s_sessionId);
+        }
+        alljoyn_busattachment_stop(s_bus);
+        alljoyn_busattachment_join(s_bus);
+        alljoyn_busattachment_destroy(s_bus);
+        s_bus = NULL;
+    }
+    if (s_listener) {
+        alljoyn_buslistener_destroy(s_listener);
+        s_listener = NULL;
+    }
+}
+
+/* Takes call numbers until s_target, cycling flash, on, off and status */
+static void *soakThread(void *arg)
+{
+    static const char *METHODS[] = { "flash", "on", "off", "status" };
+    alljoyn_msgarg flashArgs = alljoyn_msgarg_array_create(2);
+    alljoyn_msgarg onArgs = alljoyn_msgarg_array_create(1);
+    alljoyn_message reply = alljoyn_message_create(s_bus);
+    size_t numFlash = 2, numOn = 1;
+
+    if (ER_OK != alljoyn_msgarg_array_set(flashArgs, &numFlash, "du", 1.0, 200) ||
+        ER_OK != alljoyn_msgarg_array_set(onArgs, &numOn, "d", 1.0)) {
+        __atomic_store_n(&g_interrupt, QCC_TRUE, __ATOMIC_RELAXED);
+    }
+    while (!g_interrupt) {
+        uint64_t i = __atomic_fetch_add(&s_next, 1, __ATOMIC_RELAXED);
+        int m = (int)(i % 4);
+        QStatus status;
+        if (i >= __atomic_load_n(&s_target, __ATOMIC_RELAXED)) {
+            break;
+        }
+        status = alljoyn_proxybusobject_methodcall(s_proxy, INTERFACE_NAME, METHODS[m], m == 0 ? flashArgs : m == 1 ? onArgs : NULL,
+                                                   m == 0 ? numFlash : m == 1 ? numOn : 0, reply, s_timeoutMs, 0);
+        if (ER_OK != status) {
+            __atomic_fetch_add(&s_failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    alljoyn_message_destroy(reply);
+    alljoyn_msgarg_destroy(onArgs);
+    alljoyn_msgarg_destroy(flashArgs);
+    return NULL;
+}
+
+/* Runs calls up to number target on s_concurrency threads; returns -1 if none could start */
+static int soakRun(uint64_t target)
+{
+    pthread_t threads[64];
+    int started, i;
+
+    __atomic_store_n(&s_target, target, __ATOMIC_RELAXED);
+    for (started = 0; started < s_concurrency; started++) {
+        if (pthread_create(&threads[started], NULL, soakThread, NULL) != 0) {
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    /* workers overshoot by one number each on the way out */
+    __atomic_store_n(&s_next, target, __ATOMIC_RELAXED);
+    return started > 0 ? 0 : -1;
+}
+
+/* Reads the service's memory counters into sample */
+static QStatus soakSample(SoakSample *sample)
+{
+    alljoyn_message reply = alljoyn_message_create(s_bus);
+    alljoyn_msgarg entries;
+    size_t numEntries = 0;
+    size_t i;
+    int seen = 0;
+    QStatus status = alljoyn_proxybusobject_methodcall(s_proxy, INTERFACE_NAME, "stats", NULL, 0, reply, s_timeoutMs, 0);
+    if (ER_OK == status) {
+        status = alljoyn_msgarg_get(alljoyn_message_getarg(reply, 0), "a{st}", &numEntries, &entries);
+    }
+    for (i = 0; i < numEntries && ER_OK == status; i++) {
+        char *name;
+        uint64_t value;
+        status = alljoyn_msgarg_get(alljoyn_msgarg_array_element(entries, i), "{st}", &name, &value);
+        if (ER_OK == status && strcmp(name, "memory.rss_kb") == 0) {
+            sample->rssKb = value;
+            seen++;
+        } else if (ER_OK == status && strcmp(name, "memory.heap_bytes") == 0) {
+            sample->heapBytes = value;
+            seen++;
+        }
+    }
+    alljoyn_message_destroy(reply);
+    if (ER_OK == status && seen != 2) {
+        /* a service from before the memory counters */
+        status = ER_BUS_NO_SUCH_PROPERTY;
+    }
+    sample->calls = __atomic_load_n(&s_next, __ATOMIC_RELAXED);
+    return status;
+}
+/****** CALLS ******/
+
+/* Prints "name": { "baseline": .., "final": .., "max": .., "growth": .., "slack": .. } */
+static void printGrowth(const char *name, uint64_t baseline, uint64_t final, uint64_t max, uint64_t slack)
+{
+    printf("\"%s\": { \"baseline\": %llu, \"final\": %llu, \"max\": %llu, \"growth\": %lld, \"slack\": %llu }", name,
+           (unsigned long long)baseline, (unsigned long long)final, (unsigned long long)max,
+           (long long)final - (long long)baseline, (unsigned long long)slack);
+}
+
+static void usage(const char *cmd)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "   --service <path>      start this led_service on the memory backend (default: join a running one)\n");
+    fprintf(stderr, "   --name <bus name>     service to soak (default %s)\n", OBJECT_NAME);
+    fprintf(stderr, "   --calls <n>           calls to make after the warmup (default %llu)\n", (unsigned long long)s_calls);
+    fprintf(stderr, "   --warmup <n>          calls before the baseline sample (default %llu)\n", (unsigned long long)s_warmup);
+    fprintf(stderr, "   --concurrency <n>     calls outstanding at most, up to 64 (default %d)\n", s_concurrency);
+    fprintf(stderr, "   --samples <n>         memory samples after the baseline (default %d)\n", s_samples);
+    fprintf(stderr, "   --rss-slack <KiB>     RSS growth allowed (default %llu)\n", (unsigned long long)s_rssSlackKb);
+    fprintf(stderr, "   --heap-slack <bytes>  heap growth allowed (default %llu)\n", (unsigned long long)s_heapSlack);
+    fprintf(stderr, "   --timeout <ms>        per-call timeout (default %u)\n", s_timeoutMs);
+    exit(1);
+}
+
+/** Main entry point */
+int main(int argc, char** argv)
+{
+    const SoakSample *baseline, *final;
+    uint64_t maxRss = 0, maxHeap = 0, started, elapsed;
+    int ret = 1;
+    int i, pass;
+    QStatus status;
+
+    s_serviceName = OBJECT_NAME;
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "--service") == 0) {
+            s_servicePath = argv[++i];
+        } else if (strcmp(argv[i], "--name") == 0) {
+            s_serviceName = argv[++i];
+        } else if (strcmp(argv[i], "--calls") == 0) {
+            s_calls = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            s_warmup = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--concurrency") == 0) {
+            s_concurrency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--samples") == 0) {
+            s_samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rss-slack") == 0) {
+            s_rssSlackKb = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--heap-slack") == 0) {
+            s_heapSlack = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--timeout") == 0) {
+            s_timeoutMs = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (s_calls == 0 || s_concurrency < 1 || s_concurrency > 64 || s_samples < 1 || s_samples > SOAK_MAX_SAMPLES || s_timeoutMs == 0) {
+        usage(argv[0]);
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    if (s_servicePath && startService() != 0) {
+        return 1;
+    }
+    status = soakConnect();
+    if (status != ER_OK) {
+        fprintf(stderr, "Failed to join %s (%s)\n", s_serviceName, QCC_StatusText(status));
+        goto cleanup;
+    }
+
+    fprintf(stderr, "Warming up with %llu calls\n", (unsigned long long)s_warmup);
+    if (soakRun(s_warmup) != 0 || (status = soakSample(&s_sampled[s_numSampled++])) != ER_OK) {
+        fprintf(stderr, "Failed to sample %s's memory (%s)\n", s_serviceName, QCC_StatusText(status));
+        goto cleanup;
+    }
+    started = nowNs();
+    for (i = 1; i <= s_samples && !g_interrupt; i++) {
+        SoakSample *sample = &s_sampled[s_numSampled];
+        if (soakRun(s_warmup + s_calls * i / s_samples) != 0 || soakSample(sample) != ER_OK) {
+            break;
+        }
+        s_numSampled++;
+        fprintf(stderr, "%llu calls: rss %llu KiB, heap %llu bytes\n", (unsigned long long)sample->calls,
+                (unsigned long long)sample->rssKb, (unsigned long long)sample->heapBytes);
+    }
+    elapsed = nowNs() - started;
+
+    baseline = &s_sampled[0];
+    final = &s_sampled[s_numSampled - 1];
+    for (i = 0; i < s_numSampled; i++) {
+        maxRss = s_sampled[i].rssKb > maxRss ? s_sampled[i].rssKb : maxRss;
+        maxHeap = s_sampled[i].heapBytes > maxHeap ? s_sampled[i].heapBytes : maxHeap;
+    }
+    /* an interrupted or broken-off run proves nothing either way */
+    pass = s_numSampled == s_samples + 1 && s_failed == 0 &&
+           final->rssKb <= baseline->rssKb + s_rssSlackKb && final->heapBytes <= baseline->heapBytes + s_heapSlack;
+
+    printf("{ \"service\": \"%s\", \"calls\": %llu, \"warmup\": %llu, \"concurrency\": %d, \"failed\": %llu, \"duration_s\": %.3f, \"calls_per_s\": %.1f,\n",
+           s_serviceName, (unsigned long long)(final->calls - baseline->calls), (unsigned long long)s_warmup, s_concurrency,
+           (unsigned long long)s_failed, elapsed / 1e9, elapsed ? (final->calls - baseline->calls) / (elapsed / 1e9) : 0.0);
+    printf("  ");
+    printGrowth("rss_kb", baseline->rssKb, final->rssKb, maxRss, s_rssSlackKb);
+    printf(",\n  ");
+    printGrowth("heap_bytes", baseline->heapBytes, final->heapBytes, maxHeap, s_heapSlack);
+    printf(",\n  \"samples\": [");
+    for (i = 0; i < s_numSampled; i++) {
+        printf("%s\n    { \"calls\": %llu, \"rss_kb\": %llu, \"heap_bytes\": %llu }", i ? "," : "",
+               (unsigned long long)s_sampled[i].calls, (unsigned long long)s_sampled[i].rssKb, (unsigned long long)s_sampled[i].heapBytes);
+    }
+    printf(" ],\n  \"result\": \"%s\" }\n", pass ? "pass" : "fail");
+    ret = pass ? 0 : 1;
+
+cleanup:
+    soakDisconnect();
+    stopService();
+    return ret;
+}
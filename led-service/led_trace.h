@@ -0,0 +1,131 @@
+/**
+ * @file
+ * @brief Phase tracing for led_service and led_client in Chrome trace-event format.
+ *
+ * Turned on with --trace <path> or LED_TRACE=<path>; "%p" in the path is
+ * replaced by the process id so repeated runs do not overwrite each other.
+ * Load a file in chrome://tracing or Perfetto, or aggregate many of them
+ * with trace_summary.js.
+ *
+ *     uint64_t begin = ledTraceBegin();
+ *     status = alljoyn_busattachment_connect(bus, spec);
+ *     ledTraceEnd("connect", begin);
+ *
+ * Each pair becomes one complete ("X") event on the calling thread.  Times
+ * are CLOCK_MONOTONIC, which is system wide, so client and service traces
+ * taken on the same host line up when loaded together.  With tracing off
+ * ledTraceBegin returns 0 and ledTraceEnd returns straight away.
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef LED_TRACE_H
+#define LED_TRACE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static FILE *s_traceFile = NULL;
+static pthread_mutex_t s_traceLock = PTHREAD_MUTEX_INITIALIZER;
+static const char *s_traceProcess = "";
+
+static inline uint64_t ledTraceNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Starts tracing to path, or to $LED_TRACE when path is NULL; neither set
+ * leaves tracing off.  process names the events' category and the process
+ * track.  Returns -1 if the file cannot be created.
+ */
+static inline int ledTraceOpen(const char *path, const char *process)
+{
+    char expanded[PATH_MAX];
+    size_t len = 0;
+
+    if (!path) {
+        path = getenv("LED_TRACE");
+    }
+    if (!path || !path[0]) {
+        return 0;
+    }
+    for (; *path && len < sizeof(expanded) - 16; path++) {
+        if (path[0] == '%' && path[1] == 'p') {
+            len += snprintf(expanded + len, sizeof(expanded) - len, "%d", (int)getpid());
+            path++;
+        } else {
+            expanded[len++] = *path;
+        }
+    }
+    expanded[len] = 0;
+    if ((s_traceFile = fopen(expanded, "w")) == NULL) {
+        return -1;
+    }
+    s_traceProcess = process;
+    fprintf(s_traceFile, "[\n{ \"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": { \"name\": \"%s\" } }",
+            (int)getpid(), process);
+    return 0;
+}
+
+static inline uint64_t ledTraceBegin(void)
+{
+    return s_traceFile ? ledTraceNow() : 0;
+}
+
+/* Records name as running from begin to end, both ledTraceNow() times */
+static inline void ledTraceSpan(const char *name, uint64_t begin, uint64_t end)
+{
+    if (!s_traceFile || !begin) {
+        return;
+    }
+    pthread_mutex_lock(&s_traceLock);
+    if (s_traceFile) {
+        fprintf(s_traceFile, ",\n{ \"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %ld }",
+                name, s_traceProcess, begin / 1e3, (end - begin) / 1e3, (int)getpid(), (long)syscall(SYS_gettid));
+    }
+    pthread_mutex_unlock(&s_traceLock);
+}
+
+static inline void ledTraceEnd(const char *name, uint64_t begin)
+{
+    if (s_traceFile && begin) {
+        ledTraceSpan(name, begin, ledTraceNow());
+    }
+}
+
+/* Terminates the JSON array; events recorded after this are dropped */
+static inline void ledTraceClose(void)
+{
+    pthread_mutex_lock(&s_traceLock);
+    if (s_traceFile) {
+        fprintf(s_traceFile, "\n]\n");
+        fclose(s_traceFile);
+        s_traceFile = NULL;
+    }
+    pthread_mutex_unlock(&s_traceLock);
+}
+
+#endif /* LED_TRACE_H */
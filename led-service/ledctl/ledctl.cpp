@@ -0,0 +1,337 @@
+/**
+ * @file
+ * @brief ledctl::Client implementation: awaitable wrappers around the AllJoyn
+ * C API's asynchronous join and method calls.
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include "ledctl.h"
+
+#include <cstring>
+#include <thread>
+
+#include <alljoyn_c/BusObject.h>
+#include <alljoyn_c/InterfaceDescription.h>
+
+#include "led_interface.h"
+
+namespace ledctl {
+
+const char* const DEFAULT_PREFIX = OBJECT_NAME;
+
+namespace {
+
+/* Fire-and-forget coroutine used by Client::spawn; frees itself when done */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return { }; }
+        std::suspend_never initial_suspend() noexcept { return { }; }
+        std::suspend_never final_suspend() noexcept { return { }; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+Detached drive(Task<void> task, size_t* active)
+{
+    co_await std::move(task);
+    --*active;
+}
+
+/*
+ * Errors raised by the local router (timeouts included) arrive as
+ * org.alljoyn.Bus.ErStatus replies carrying the QStatus as a uint16.
+ */
+QStatus replyStatus(alljoyn_message reply)
+{
+    char description[256];
+    size_t size = sizeof(description);
+    const char* name;
+    uint16_t code;
+
+    if (alljoyn_message_gettype(reply) == ALLJOYN_MESSAGE_METHOD_RET) {
+        return ER_OK;
+    }
+    name = alljoyn_message_geterrorname(reply, description, &size);
+    if (name && std::strcmp(name, "org.alljoyn.Bus.ErStatus") == 0 &&
+        alljoyn_msgarg_get(alljoyn_message_getarg(reply, 1), "q", &code) == ER_OK) {
+        return static_cast<QStatus>(code);
+    }
+    return ER_BUS_REPLY_IS_ERROR_MESSAGE;
+}
+
+/* Awaits one alljoyn_proxybusobject_methodcall_async with a "du" reply */
+struct CallAwaiter {
+    Client& client;
+    alljoyn_proxybusobject proxy;
+    const char* method;
+    alljoyn_msgarg args;
+    size_t numArgs;
+    uint32_t timeout;
+    Result<LedState> result;
+    std::coroutine_handle<> handle;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        QStatus status;
+        handle = h;
+        status = alljoyn_proxybusobject_methodcall_async(proxy, INTERFACE_NAME, method, &CallAwaiter::reply, args, numArgs, this, timeout, 0);
+        if (status != ER_OK) {
+            /* never sent: resume right away with the error */
+            result.status = status;
+            return false;
+        }
+        return true;
+    }
+
+    Result<LedState> await_resume() { return result; }
+
+    /* ReplyHandler callback, runs on an AllJoyn thread */
+    static void reply(alljoyn_message msg, void* context)
+    {
+        CallAwaiter* self = static_cast<CallAwaiter*>(context);
+        QStatus status = replyStatus(msg);
+        if (status == ER_OK) {
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 0), "d", &self->result.value.brightness);
+        }
+        if (status == ER_OK) {
+            status = alljoyn_msgarg_get(alljoyn_message_getarg(msg, 1), "u", &self->result.value.frequency);
+        }
+        self->result.status = status;
+        self->client.post(self->handle);
+    }
+};
+
+/* Awaits alljoyn_busattachment_joinsessionasync */
+struct JoinAwaiter {
+    Client& client;
+    const std::string& name;
+    QStatus status;
+    alljoyn_sessionid sessionId;
+    std::coroutine_handle<> handle;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        alljoyn_sessionopts opts = alljoyn_sessionopts_create(ALLJOYN_TRAFFIC_TYPE_MESSAGES, QCC_FALSE, ALLJOYN_PROXIMITY_ANY, ALLJOYN_TRANSPORT_ANY);
+        handle = h;
+        status = alljoyn_busattachment_joinsessionasync(client.bus(), name.c_str(), SERVICE_PORT, NULL, opts, &JoinAwaiter::joined, this);
+        alljoyn_sessionopts_destroy(opts);
+        return status == ER_OK;
+    }
+
+    void await_resume() { }
+
+    /* JoinSession callback, runs on an AllJoyn thread */
+    static void joined(QStatus result, alljoyn_sessionid id, const alljoyn_sessionopts, void* context)
+    {
+        JoinAwaiter* self = static_cast<JoinAwaiter*>(context);
+        self->status = result;
+        self->sessionId = id;
+        self->client.post(self->handle);
+    }
+};
+
+}
+
+Session::Session(Client& owner, std::string name, alljoyn_sessionid id) :
+    client(owner), busName(std::move(name)), sessionId(id)
+{
+}
+
+Session::~Session()
+{
+    for (auto& entry : proxies) {
+        alljoyn_proxybusobject_destroy(entry.second);
+    }
+    alljoyn_busattachment_leavesession(client.bus(), sessionId);
+}
+
+alljoyn_proxybusobject Session::proxy(const std::string& led)
+{
+    auto it = proxies.find(led);
+    if (it == proxies.end()) {
+        std::string path = led.empty() ? std::string(OBJECT_PATH) : std::string(OBJECT_PATH) + "/" + led;
+        alljoyn_proxybusobject obj = alljoyn_proxybusobject_create(client.bus(), busName.c_str(), path.c_str(), sessionId);
+        alljoyn_proxybusobject_addinterface(obj, alljoyn_busattachment_getinterface(client.bus(), INTERFACE_NAME));
+        it = proxies.emplace(led, obj).first;
+    }
+    return it->second;
+}
+
+Task<Result<LedState> > Session::call(const char* method, alljoyn_msgarg args, size_t numArgs, std::chrono::milliseconds deadline, std::string led)
+{
+    CallAwaiter awaiter{ client, proxy(led), method, args, numArgs, static_cast<uint32_t>(deadline.count()), { }, { } };
+    Result<LedState> result = co_await awaiter;
+    if (args) {
+        alljoyn_msgarg_destroy(args);
+    }
+    co_return result;
+}
+
+Task<Result<LedState> > Session::flash(double brightness, uint32_t frequency, std::chrono::milliseconds deadline, const std::string& led)
+{
+    size_t numArgs = 2;
+    alljoyn_msgarg args = alljoyn_msgarg_array_create(numArgs);
+    alljoyn_msgarg_array_set(args, &numArgs, "du", brightness, frequency);
+    return call("flash", args, numArgs, deadline, led);
+}
+
+Task<Result<LedState> > Session::on(double brightness, std::chrono::milliseconds deadline, const std::string& led)
+{
+    size_t numArgs = 1;
+    alljoyn_msgarg args = alljoyn_msgarg_array_create(numArgs);
+    alljoyn_msgarg_array_set(args, &numArgs, "d", brightness);
+    return call("on", args, numArgs, deadline, led);
+}
+
+Task<Result<LedState> > Session::off(std::chrono::milliseconds deadline, const std::string& led)
+{
+    return call("off", NULL, 0, deadline, led);
+}
+
+Task<Result<LedState> > Session::status(std::chrono::milliseconds deadline, const std::string& led)
+{
+    return call("status", NULL, 0, deadline, led);
+}
+
+Client::Client() : msgBus(NULL), busListener(NULL), active(0)
+{
+}
+
+Client::~Client()
+{
+    sessions.clear();
+    if (msgBus) {
+        alljoyn_busattachment_stop(msgBus);
+        alljoyn_busattachment_join(msgBus);
+        alljoyn_busattachment_destroy(msgBus);
+    }
+    if (busListener) {
+        alljoyn_buslistener_destroy(busListener);
+    }
+}
+
+QStatus Client::start(const char* connectSpec)
+{
+    alljoyn_buslistener_callbacks callbacks = {
+        NULL,
+        NULL,
+        &Client::found_advertised_name,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL
+    };
+    QStatus status;
+
+    msgBus = alljoyn_busattachment_create("ledctl", QCC_TRUE);
+    status = createLedInterface(msgBus);
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_start(msgBus);
+    }
+    if (status == ER_OK) {
+        status = alljoyn_busattachment_connect(msgBus, connectSpec);
+    }
+    if (status == ER_OK) {
+        busListener = alljoyn_buslistener_create(&callbacks, this);
+        alljoyn_busattachment_registerbuslistener(msgBus, busListener);
+    }
+    return status;
+}
+
+/* FoundAdvertisedName callback: accepts the prefix itself or prefix.<suffix> */
+void Client::found_advertised_name(const void* context, const char* name, alljoyn_transportmask, const char*)
+{
+    Client* self = const_cast<Client*>(static_cast<const Client*>(context));
+    std::lock_guard<std::mutex> guard(self->lock);
+    const std::string& prefix = self->findPrefix;
+    if (prefix.empty() || std::strncmp(name, prefix.c_str(), prefix.size()) != 0 ||
+        (name[prefix.size()] != '\0' && name[prefix.size()] != '.')) {
+        return;
+    }
+    for (const std::string& known : self->found) {
+        if (known == name) {
+            return;
+        }
+    }
+    self->found.push_back(name);
+}
+
+std::vector<std::string> Client::discover(const std::string& prefix, std::chrono::milliseconds window)
+{
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        findPrefix = prefix;
+        found.clear();
+    }
+    if (alljoyn_busattachment_findadvertisedname(msgBus, prefix.c_str()) != ER_OK) {
+        return names;
+    }
+    std::this_thread::sleep_for(window);
+    alljoyn_busattachment_cancelfindadvertisedname(msgBus, prefix.c_str());
+    std::lock_guard<std::mutex> guard(lock);
+    findPrefix.clear();
+    names.swap(found);
+    return names;
+}
+
+Task<Result<Session*> > Client::join(std::string busName)
+{
+    JoinAwaiter awaiter{ *this, busName, ER_FAIL, 0, { } };
+    co_await awaiter;
+    if (awaiter.status != ER_OK) {
+        co_return Result<Session*>{ awaiter.status, NULL };
+    }
+    sessions.push_back(std::make_unique<Session>(*this, busName, awaiter.sessionId));
+    co_return Result<Session*>{ ER_OK, sessions.back().get() };
+}
+
+void Client::spawn(Task<void> task)
+{
+    ++active;
+    drive(std::move(task), &active);
+}
+
+void Client::post(std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    runnable.push_back(handle);
+    ready.notify_one();
+}
+
+void Client::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (active > 0) {
+        std::deque<std::coroutine_handle<> > batch;
+        ready.wait(guard, [this] { return !runnable.empty(); });
+        batch.swap(runnable);
+        guard.unlock();
+        for (std::coroutine_handle<> handle : batch) {
+            handle.resume();
+        }
+        guard.lock();
+    }
+}
+
+}
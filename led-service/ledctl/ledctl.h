@@ -0,0 +1,273 @@
+/**
+ * @file
+ * @brief ledctl: a C++20 coroutine client for the AllJoyn LED service.
+ *
+ * led_client.c makes one blocking alljoyn_proxybusobject_methodcall at a time.
+ * ledctl wraps alljoyn_proxybusobject_methodcall_async in awaitable tasks so a
+ * single thread can keep hundreds of calls in flight across many services:
+ *
+ *     ledctl::Client client;
+ *     client.start();
+ *     for (auto& name : client.discover(ledctl::DEFAULT_PREFIX, 1000ms)) {
+ *         client.spawn(blink(client, name));
+ *     }
+ *     client.run();
+ *
+ * Coroutines are only ever resumed on the thread that calls Client::run();
+ * AllJoyn's callback threads just queue the completed call.
+ *
+ * Build (C++20): g++ -std=c++20 -I.. ledctl.cpp <your sources> -lalljoyn_c
+ * npm install builds it as the ledctl static library in binding.gyp, along
+ * with the ledctl_bench example.
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef LEDCTL_H
+#define LEDCTL_H
+
+#include <qcc/platform.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <alljoyn_c/BusAttachment.h>
+#include <alljoyn_c/MsgArg.h>
+#include <alljoyn_c/Status.h>
+
+namespace ledctl {
+
+/** Well-known name prefix the LED services advertise */
+extern const char* const DEFAULT_PREFIX;
+
+/** Per-call deadline used when none is given */
+constexpr std::chrono::milliseconds DEFAULT_DEADLINE{5000};
+
+/** The "du" reply shared by flash, on, off and status */
+struct LedState {
+    double brightness = 0.0;
+    uint32_t frequency = 0;
+};
+
+/** A value or the QStatus explaining why there is none; ER_TIMEOUT when the deadline passed */
+template <typename T>
+struct Result {
+    QStatus status = ER_FAIL;
+    T value{};
+
+    bool ok() const { return status == ER_OK; }
+};
+
+template <typename T> class Task;
+
+namespace detail {
+
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+    {
+        auto next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept { }
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return { }; }
+    FinalAwaiter final_suspend() noexcept { return { }; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+    T result()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() { }
+    void result()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+}
+
+/** A lazily started coroutine; awaiting it runs it and resumes the awaiter when it finishes */
+template <typename T>
+class Task {
+  public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) { }
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) { }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+
+}
+
+class Client;
+
+/** A joined session with one LED service; proxies are created per object path on first use */
+class Session {
+  public:
+    Session(Client& client, std::string busName, alljoyn_sessionid id);
+    ~Session();
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    const std::string& name() const { return busName; }
+    alljoyn_sessionid id() const { return sessionId; }
+
+    /** led is an object path element such as "usr0"; empty addresses the default LED */
+    Task<Result<LedState> > flash(double brightness, uint32_t frequency, std::chrono::milliseconds deadline = DEFAULT_DEADLINE, const std::string& led = "");
+    Task<Result<LedState> > on(double brightness, std::chrono::milliseconds deadline = DEFAULT_DEADLINE, const std::string& led = "");
+    Task<Result<LedState> > off(std::chrono::milliseconds deadline = DEFAULT_DEADLINE, const std::string& led = "");
+    Task<Result<LedState> > status(std::chrono::milliseconds deadline = DEFAULT_DEADLINE, const std::string& led = "");
+
+  private:
+    Task<Result<LedState> > call(const char* method, alljoyn_msgarg args, size_t numArgs, std::chrono::milliseconds deadline, std::string led);
+    alljoyn_proxybusobject proxy(const std::string& led);
+
+    Client& client;
+    std::string busName;
+    alljoyn_sessionid sessionId;
+    std::map<std::string, alljoyn_proxybusobject> proxies;
+};
+
+/**
+ * Owns the bus attachment and the completion queue.  Everything except
+ * start() and discover() is asynchronous and must be driven by run().
+ */
+class Client {
+  public:
+    Client();
+    ~Client();
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    /** Creates, starts and connects the bus attachment (blocking) */
+    QStatus start(const char* connectSpec = "unix:abstract=alljoyn");
+
+    /** Collects the names advertised under prefix for window (blocking) */
+    std::vector<std::string> discover(const std::string& prefix, std::chrono::milliseconds window);
+
+    /** Joins the service advertising busName; the Session lives as long as the Client */
+    Task<Result<Session*> > join(std::string busName);
+
+    /** Starts task; run() returns once it and every other spawned task have finished.  Call from the run() thread. */
+    void spawn(Task<void> task);
+
+    /** Resumes completed calls on this thread until no spawned task is left */
+    void run();
+
+    /** Convenience: spawns task and runs until everything finished, returning its result */
+    template <typename T>
+    T run(Task<T> task)
+    {
+        std::optional<T> out;
+        spawn(store(std::move(task), &out));
+        run();
+        return std::move(*out);
+    }
+
+    /** Queues a suspended coroutine for resumption by run(); callable from any thread */
+    void post(std::coroutine_handle<> handle);
+
+    alljoyn_busattachment bus() const { return msgBus; }
+
+  private:
+    template <typename T>
+    static Task<void> store(Task<T> task, std::optional<T>* out) { *out = co_await std::move(task); }
+
+    alljoyn_busattachment msgBus;
+    alljoyn_buslistener busListener;
+    std::vector<std::unique_ptr<Session> > sessions;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::coroutine_handle<> > runnable;
+    size_t active;
+
+    std::vector<std::string> found;
+    std::string findPrefix;
+
+    static void found_advertised_name(const void* context, const char* name, alljoyn_transportmask transport, const char* namePrefix);
+};
+
+}
+
+#endif /* LEDCTL_H */
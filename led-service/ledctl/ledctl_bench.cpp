@@ -0,0 +1,164 @@
+/**
+ * @file
+ * @brief ledctl example: keeps N calls in flight against every discovered LED
+ * service from one thread and reports throughput and latency.
+ *
+ * Usage: ledctl_bench [--calls N] [--concurrency C] [--method status|on|off|flash]
+ *                     [--deadline ms] [--prefix name] [--discover ms]
+ */
+
+/******************************************************************************
+ * Copyright (c) 2010-2014, AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include "ledctl.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std::chrono;
+
+namespace {
+
+struct Options {
+    size_t calls = 10000;
+    size_t concurrency = 100;
+    std::string method = "status";
+    milliseconds deadline = ledctl::DEFAULT_DEADLINE;
+    std::string prefix;
+    milliseconds discoverWindow{1000};
+};
+
+/* Shared by every worker; only touched from the run() thread so needs no locking */
+struct Shared {
+    std::vector<ledctl::Session*> sessions;
+    size_t next = 0;
+    size_t errors = 0;
+    size_t timeouts = 0;
+    std::vector<double> latencies;
+};
+
+ledctl::Task<ledctl::Result<ledctl::LedState> > issue(ledctl::Session& session, const Options& options)
+{
+    if (options.method == "on") {
+        return session.on(1.0, options.deadline);
+    } else if (options.method == "off") {
+        return session.off(options.deadline);
+    } else if (options.method == "flash") {
+        return session.flash(1.0, 1, options.deadline);
+    }
+    return session.status(options.deadline);
+}
+
+/* Pulls call numbers off the shared counter until every call has been issued */
+ledctl::Task<void> worker(Shared& shared, const Options& options)
+{
+    while (shared.next < options.calls) {
+        ledctl::Session& session = *shared.sessions[shared.next++ % shared.sessions.size()];
+        steady_clock::time_point start = steady_clock::now();
+        ledctl::Result<ledctl::LedState> result = co_await issue(session, options);
+        shared.latencies.push_back(duration<double, std::micro>(steady_clock::now() - start).count());
+        if (result.status == ER_TIMEOUT) {
+            ++shared.timeouts;
+        } else if (!result.ok()) {
+            ++shared.errors;
+        }
+    }
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+void usage()
+{
+    std::printf("Usage: ledctl_bench [--calls N] [--concurrency C] [--method status|on|off|flash]\n");
+    std::printf("                    [--deadline ms] [--prefix name] [--discover ms]\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    options.prefix = ledctl::DEFAULT_PREFIX;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        if (std::strcmp(argv[i], "--calls") == 0) {
+            options.calls = std::strtoul(argv[++i], NULL, 10);
+        } else if (std::strcmp(argv[i], "--concurrency") == 0) {
+            options.concurrency = std::max(1ul, std::strtoul(argv[++i], NULL, 10));
+        } else if (std::strcmp(argv[i], "--method") == 0) {
+            options.method = argv[++i];
+        } else if (std::strcmp(argv[i], "--deadline") == 0) {
+            options.deadline = milliseconds(std::strtoul(argv[++i], NULL, 10));
+        } else if (std::strcmp(argv[i], "--prefix") == 0) {
+            options.prefix = argv[++i];
+        } else if (std::strcmp(argv[i], "--discover") == 0) {
+            options.discoverWindow = milliseconds(std::strtoul(argv[++i], NULL, 10));
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    ledctl::Client client;
+    QStatus status = client.start();
+    if (status != ER_OK) {
+        std::fprintf(stderr, "Failed to connect to the bus (%s)\n", QCC_StatusText(status));
+        return 1;
+    }
+
+    Shared shared;
+    for (const std::string& name : client.discover(options.prefix, options.discoverWindow)) {
+        ledctl::Result<ledctl::Session*> joined = client.run(client.join(name));
+        if (joined.ok()) {
+            shared.sessions.push_back(joined.value);
+        } else {
+            std::fprintf(stderr, "Failed to join %s (%s)\n", name.c_str(), QCC_StatusText(joined.status));
+        }
+    }
+    if (shared.sessions.empty()) {
+        std::fprintf(stderr, "No LED service found under %s\n", options.prefix.c_str());
+        return 1;
+    }
+
+    shared.latencies.reserve(options.calls);
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t w = 0; w < options.concurrency; ++w) {
+        client.spawn(worker(shared, options));
+    }
+    client.run();
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    std::sort(shared.latencies.begin(), shared.latencies.end());
+    std::printf("{ \"method\": \"%s\", \"services\": %zu, \"calls\": %zu, \"concurrency\": %zu, "
+                "\"errors\": %zu, \"timeouts\": %zu, \"seconds\": %.3f, \"calls_per_second\": %.1f, "
+                "\"p50_us\": %.0f, \"p99_us\": %.0f, \"max_us\": %.0f }\n",
+                options.method.c_str(), shared.sessions.size(), shared.latencies.size(), options.concurrency,
+                shared.errors, shared.timeouts, seconds, shared.latencies.size() / seconds,
+                percentile(shared.latencies, 0.50), percentile(shared.latencies, 0.99),
+                shared.latencies.empty() ? 0.0 : shared.latencies.back());
+    return 0;
+}
@@ -5,50 +5,35 @@
 //		off
 //		flash <brightness> <frequency>
 //		status
-var exec = require('child_process').exec;
+//
+// The led_addon binding (built with `npm install`, see binding.gyp) keeps one
+// AllJoyn session per process, so commands no longer fork led_client.
+var led = require('./build/Release/led_addon');
 
-// update this script to point to the client process
-var ledClientScript = "./led_client";
-
-function displayStdout(data) {
-    var output = JSON.parse(data);
+function display(output) {
     console.log("cmd - " + output['cmd'] + ", brightness: " + output['brightness'] + ", frequency: " + output['frequency']);
 }
 
-function doOff(callback) {
-    var child = exec(ledClientScript + " off", function(err, stdout, stderr) {
-        callback(stdout);
-    });
-}
-
-function doOn(brightness, callback) {
-    var child = exec(ledClientScript + " on " + brightness, function(err, stdout, stderr) {
-        callback(stdout);
-    });
+function displayError(err) {
+    console.log("command failed: " + err.message);
+    process.exitCode = 1;
 }
 
-function doStatus(brightness, callback) {
-    var child = exec(ledClientScript + " status", function(err, stdout, stderr) {
-        callback(stdout);
+function run(promise) {
+    promise.then(display, displayError).then(function() {
+        led.close();
     });
 }
 
-function doFlash(brightness, frequency, callback) {
-    var child = exec(ledClientScript + " flash " + brightness + " " + frequency, function(err, stdout, stderr) {
-        callback(stdout);
-    });
-}
-
-
 var args = process.argv.slice(2);
 if(args[0] == "on") {
-    doOn(args[1], displayStdout);
+    run(led.on(Number(args[1])));
 } else if(args[0] == "off") {
-    doOff(displayStdout);
+    run(led.off());
 } else if(args[0] == "status") {
-    doStatus(displayStdout);
+    run(led.status());
 } else if(args[0] == "flash") {
-    doFlash(args[1], args[2], displayStdout);
+    run(led.flash(Number(args[1]), Number(args[2])));
 } else {
     console.log("invalid command");
 }
@@ -0,0 +1,88 @@
+// Aggregates the Chrome trace files written by led_service and led_client
+// with --trace (or LED_TRACE) over any number of runs:
+// node ./trace_summary.js <trace.json> [...]
+//
+// Prints one line per process and phase with how many runs had it, how often
+// it ran in total and its mean, p50, p95 and max duration in ms, slowest
+// mean first, so cold-start phases and per-call handlers can be compared
+// across boards.  Files cut short by a crash are read up to the last event.
+var fs = require('fs');
+
+function readEvents(path) {
+    var text = fs.readFileSync(path, 'utf8').trim();
+    try {
+        return JSON.parse(text);
+    } catch (e) {
+        // the closing bracket is only written on a clean exit
+        return JSON.parse(text.replace(/,\s*$/, '') + ']');
+    }
+}
+
+function percentile(sorted, p) {
+    var i = Math.ceil(p * sorted.length) - 1;
+    return sorted[Math.max(0, Math.min(sorted.length - 1, i))];
+}
+
+var files = process.argv.slice(2);
+if (files.length == 0) {
+    console.log("usage: node ./trace_summary.js <trace.json> [...]");
+    process.exit(1);
+}
+
+var phases = {};
+files.forEach(function(path) {
+    var seen = {};
+    var events;
+    try {
+        events = readEvents(path);
+    } catch (e) {
+        console.error("skipping " + path + ": " + e.message);
+        return;
+    }
+    events.forEach(function(event) {
+        if (event.ph != 'X') {
+            return;
+        }
+        var key = event.cat + ' ' + event.name;
+        var phase = phases[key] || (phases[key] = { cat: event.cat, name: event.name, runs: 0, durations: [] });
+        if (!seen[key]) {
+            seen[key] = true;
+            phase.runs++;
+        }
+        phase.durations.push(event.dur / 1000);
+    });
+});
+
+var rows = Object.keys(phases).map(function(key) {
+    var phase = phases[key];
+    var sorted = phase.durations.sort(function(a, b) { return a - b; });
+    var sum = sorted.reduce(function(a, b) { return a + b; }, 0);
+    return {
+        process: phase.cat,
+        phase: phase.name,
+        runs: phase.runs,
+        count: sorted.length,
+        mean: sum / sorted.length,
+        p50: percentile(sorted, 0.50),
+        p95: percentile(sorted, 0.95),
+        max: sorted[sorted.length - 1]
+    };
+});
+rows.sort(function(a, b) {
+    return a.process == b.process ? b.mean - a.mean : (a.process < b.process ? -1 : 1);
+});
+
+function pad(text, width) {
+    text = String(text);
+    while (text.length < width) {
+        text = ' ' + text;
+    }
+    return text;
+}
+
+console.log(pad('process', 12) + pad('phase', 20) + pad('runs', 6) + pad('count', 8) +
+            pad('mean_ms', 11) + pad('p50_ms', 11) + pad('p95_ms', 11) + pad('max_ms', 11));
+rows.forEach(function(row) {
+    console.log(pad(row.process, 12) + pad(row.phase, 20) + pad(row.runs, 6) + pad(row.count, 8) +
+                pad(row.mean.toFixed(3), 11) + pad(row.p50.toFixed(3), 11) + pad(row.p95.toFixed(3), 11) + pad(row.max.toFixed(3), 11));
+});